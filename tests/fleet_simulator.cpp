@@ -0,0 +1,664 @@
+/**
+  * @file    fleet_simulator.cpp
+  * @brief   Host-side load harness. Runs many TP_NBIoT_Interface instances,
+  *          each on its own fake SARA-N2 and TP_Virtual_Clock, through
+  *          start(), PSM cycles with periodic TAU wakes, NON/CON stream
+  *          uplinks, Block1 uploads and timer reconfiguration, against an
+  *          in-process CoAP stand-in. Every FLEET_EDRX_EVERY-th device 
+  *          uses eDRX instead of PSM and wakes for each paging time window.
+  *          Radio-on time and the latency to reach a device with a 
+  *          downlink are reported for each mode. Devices are stepped one 
+  *          wake at a time on a work-stealing thread pool
+  *
+  *          Usage: fleet_simulator [devices] [threads] [days]
+  */
+
+/** Includes
+ */
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tp_nbiot_interface.h"
+
+typedef TP_NBIoT_Interface Iface;
+
+/** Simulated device behaviour
+ */
+#define FLEET_UPLINK_INTERVAL_S  7200
+#define FLEET_BLOCK_UPLOAD_EVERY 24
+#define FLEET_BLOCK_UPLOAD_BYTES 1200
+#define FLEET_BLOCK_SIZE         256
+#define FLEET_RECONFIGURE_EVERY  48
+#define FLEET_RRC_INACTIVITY_S   20
+#define FLEET_HEARTBEAT_S        21600
+#define FLEET_ATTACH_MIN_S       10
+#define FLEET_ATTACH_SPREAD_S    120
+#define FLEET_EDRX_EVERY         2
+#define FLEET_EDRX_CYCLE         Iface::eDRX_cycles::SEC_163_84
+#define FLEET_EDRX_PTW           1
+#define FLEET_DOWNLINK_INTERVAL_S 14400
+
+/** Stand-in for the CoAP ingest backend, shared by every device. Stream
+ *  uplinks arrive as UDP datagrams and confirmable ones are acknowledged
+ *  with a piggybacked 2.04; Block1 uploads arrive through the modem's
+ *  CoAP profile and are answered 2.31 Continue until the last block
+ */
+class CoAP_Stand_In
+{
+
+	public:
+
+		void receive(SaraN2 &modem, const SaraN2::Datagram &request)
+		{
+			if(request.data.size() < 4)
+			{
+				malformed++;
+				return;
+			}
+
+			uint8_t type = (request.data[0] >> 4) & 0x3;
+			uint8_t token_length = request.data[0] & 0xF;
+			if(request.data.size() < 4u + token_length)
+			{
+				malformed++;
+				return;
+			}
+
+			if(type == 1)
+			{
+				non_uplinks++;
+				return;
+			}
+
+			con_uplinks++;
+
+			std::vector<uint8_t> ack = { (uint8_t)(0x60 | token_length), 0x44, request.data[2], request.data[3] };
+			ack.insert(ack.end(), request.data.begin() + 4, request.data.begin() + 4 + token_length);
+			modem.deliver(request.socket, request.ipv4.c_str(), request.port, ack);
+		}
+
+		int post_block(const uint8_t *data, size_t length, uint8_t block, uint8_t more)
+		{
+			(void)data; (void)block;
+			blocks++;
+			block_bytes += length;
+			if(more)
+			{
+				return 231;
+			}
+
+			uploads++;
+			return 204;
+		}
+
+		std::atomic<uint64_t> non_uplinks{0};
+		std::atomic<uint64_t> con_uplinks{0};
+		std::atomic<uint64_t> blocks{0};
+		std::atomic<uint64_t> block_bytes{0};
+		std::atomic<uint64_t> uploads{0};
+		std::atomic<uint64_t> malformed{0};
+};
+
+/** One simulated device. Its clock only moves when the device runs, so
+ *  devices never wait on each other
+ */
+class Device
+{
+
+	public:
+
+		Device(uint32_t seed, bool use_edrx, uint64_t end_ms, CoAP_Stand_In &server) :
+			edrx(use_edrx), _iface(NC, NC, NC, NC, NC, NC), _modem(*SaraN2::last()), _end_ms(end_ms), _seed(seed)
+		{
+			_iface.set_clock(callback(&_clock, &TP_Virtual_Clock::now), callback(this, &Device::sleep));
+			_iface.seed_random(seed);
+
+			/** Searching until the network accepts the attach
+			 */
+			_modem.registered = 2;
+			_attach_ms = (FLEET_ATTACH_MIN_S + next_random() % FLEET_ATTACH_SPREAD_S) * 1000;
+
+			_modem.responder = [this, &server](const SaraN2::Datagram &request)
+			{
+				server.receive(_modem, request);
+			};
+			_modem.post_handler = [&server](const uint8_t *data, size_t length, uint8_t block, uint8_t more)
+			{
+				return server.post_block(data, length, block, more);
+			};
+
+			for(size_t i = 0; i < sizeof(_upload); i++)
+			{
+				_upload[i] = (uint8_t)(seed + i);
+			}
+		}
+
+		/** Run the device up to and including its next wake
+		 *
+		 * @return False once the simulated period is over
+		 */
+		bool step()
+		{
+			if(!_started)
+			{
+				return boot();
+			}
+
+			uint64_t wake_ms = (_next_uplink_ms < _next_tau_ms) ? _next_uplink_ms : _next_tau_ms;
+			if(edrx && _next_ptw_ms < wake_ms)
+			{
+				wake_ms = _next_ptw_ms;
+			}
+
+			if(wake_ms >= _end_ms)
+			{
+				return false;
+			}
+
+			sleep_until(wake_ms);
+
+			if(edrx && wake_ms == _next_ptw_ms)
+			{
+				paging_window();
+				return true;
+			}
+
+			if(!edrx)
+			{
+				_iface.inject_vint(1);
+				_modem.npsmr_urc(0);
+			}
+			_modem.cscon_urc(1);
+
+			if(wake_ms == _next_uplink_ms)
+			{
+				uplink();
+				_next_uplink_ms += FLEET_UPLINK_INTERVAL_S * 1000ULL;
+			}
+			else
+			{
+				taus++;
+			}
+
+			/** Released after the inactivity timer, asleep after T3324, and
+			 *  T3412 runs from the release. In eDRX there is no T3324 and the
+			 *  device is next paged in its following window
+			 */
+			sleep_ms(FLEET_RRC_INACTIVITY_S * 1000);
+			_modem.cscon_urc(0);
+			_next_tau_ms = _clock.now() + (uint64_t)_tau_s * 1000;
+			if(!edrx)
+			{
+				sleep_ms(_active_s * 1000);
+				_modem.npsmr_urc(1);
+				_iface.inject_vint(0);
+			}
+
+			/** Connected time plus, under PSM, the T3324 window in which the
+			 *  device can still be paged
+			 */
+			radio_on_ms += _clock.now() - wake_ms;
+			reachable(wake_ms, _clock.now());
+
+			if(++_wakes % FLEET_RECONFIGURE_EVERY == 0)
+			{
+				reconfigure();
+			}
+
+			return true;
+		}
+
+		/** Sleep function handed to the interface. Registration completes
+		 *  once the attach delay has passed
+		 */
+		void sleep(uint32_t ms)
+		{
+			_clock.sleep(ms);
+			if(_modem.registered != 1 && _clock.now() >= _attach_ms)
+			{
+				_modem.registered = 1;
+			}
+		}
+
+		bool edrx;
+		int start_status = -1;
+		uint32_t start_ms = 0;
+		uint32_t uplinks = 0;
+		uint32_t uplink_failures = 0;
+		uint32_t uploads = 0;
+		uint32_t upload_failures = 0;
+		uint32_t taus = 0;
+		uint32_t reconfigurations = 0;
+		uint32_t paging_windows = 0;
+		uint64_t radio_on_ms = 0;
+		uint32_t downlinks = 0;
+		uint64_t downlink_latency_ms = 0;
+		uint64_t downlink_latency_max_ms = 0;
+
+	private:
+
+		bool boot()
+		{
+			_started = true;
+
+			start_status = _iface.start();
+			Iface::TP_Start_Profile profile;
+			_iface.get_start_profile(profile);
+			start_ms = profile.total_ms;
+			if(start_status != Iface::NBIOT_OK)
+			{
+				return false;
+			}
+
+			static char ipv4[] = "127.0.0.1";
+			static char stream_uri[] = "telemetry";
+			static char upload_uri[] = "coap://127.0.0.1:5683/upload";
+
+			_iface.enable_power_monitor();
+			if(_iface.udp_open(_socket) != Iface::NBIOT_OK ||
+			   _iface.coap_stream_open(_socket, ipv4, 5683, stream_uri, FLEET_HEARTBEAT_S, _stream) != Iface::NBIOT_OK ||
+			   _iface.register_coap_endpoint(ipv4, 5683, upload_uri, sizeof(upload_uri) - 1, _endpoint) != Iface::NBIOT_OK)
+			{
+				start_status = -1;
+				return false;
+			}
+
+			reconfigure();
+
+			if(edrx && !configure_edrx())
+			{
+				start_status = -1;
+				return false;
+			}
+
+			/** Spread first uplinks over an interval so devices don't all
+			 *  report in the same second
+			 */
+			_next_uplink_ms = _clock.now() + (next_random() % FLEET_UPLINK_INTERVAL_S) * 1000ULL;
+			_next_tau_ms = _clock.now() + (uint64_t)_tau_s * 1000;
+			if(edrx)
+			{
+				_next_ptw_ms = _clock.now() + _edrx_cycle_ms;
+			}
+			_next_downlink_ms = _clock.now() + next_downlink_gap_ms();
+
+			return true;
+		}
+
+		/** Leave PSM and request eDRX, which the network grants as asked.
+		 *  VINT stays up since the module doesn't enter deep sleep
+		 */
+		bool configure_edrx()
+		{
+			Iface::eDRX_cycles cycle;
+			uint8_t ptw = 0;
+			if(_iface.disable_power_save_mode() != Iface::NBIOT_OK ||
+			   _iface.set_edrx(FLEET_EDRX_CYCLE, FLEET_EDRX_PTW) != Iface::NBIOT_OK)
+			{
+				return false;
+			}
+
+			_modem.granted_edrx_cycle = _modem.edrx_cycle;
+			_modem.granted_edrx_ptw = _modem.edrx_ptw;
+			if(_iface.get_edrx(cycle, ptw, true) != Iface::NBIOT_OK)
+			{
+				return false;
+			}
+
+			_edrx_cycle_ms = _iface.edrx_cycle_ms(cycle);
+			_edrx_ptw_ms = _iface.edrx_ptw_ms(ptw);
+			_iface.inject_vint(1);
+
+			return _edrx_cycle_ms > _edrx_ptw_ms;
+		}
+
+		/** Monitor paging for one window. The receiver is counted as on for
+		 *  the whole window, an upper bound since it only listens at the
+		 *  paging occasions within it
+		 */
+		void paging_window()
+		{
+			uint64_t start = _clock.now();
+			sleep_ms(_edrx_ptw_ms);
+			radio_on_ms += _edrx_ptw_ms;
+			reachable(start, _clock.now());
+
+			_next_ptw_ms += _edrx_cycle_ms;
+			paging_windows++;
+		}
+
+		/** Deliver any downlink that reached the network by the end of a 
+		 *  period in which the device could be paged or was connected. One 
+		 *  that arrived during the period waits no time
+		 */
+		void reachable(uint64_t from_ms, uint64_t to_ms)
+		{
+			while(_next_downlink_ms <= to_ms)
+			{
+				uint64_t latency_ms = (_next_downlink_ms < from_ms) ? from_ms - _next_downlink_ms : 0;
+				downlinks++;
+				downlink_latency_ms += latency_ms;
+				downlink_latency_max_ms = (latency_ms > downlink_latency_max_ms) ? latency_ms : downlink_latency_max_ms;
+				_next_downlink_ms += next_downlink_gap_ms();
+			}
+		}
+
+		/** Time until the backend next queues a downlink, spread evenly
+		 *  around FLEET_DOWNLINK_INTERVAL_S
+		 */
+		uint64_t next_downlink_gap_ms()
+		{
+			return (FLEET_DOWNLINK_INTERVAL_S / 2 + next_random() % FLEET_DOWNLINK_INTERVAL_S) * 1000ULL;
+		}
+
+		void uplink()
+		{
+			uint8_t reading[12];
+			for(size_t i = 0; i < sizeof(reading); i++)
+			{
+				reading[i] = (uint8_t)next_random();
+			}
+
+			bool confirmed = false;
+			if(_iface.coap_stream_send(_stream, reading, sizeof(reading), confirmed) == Iface::NBIOT_OK)
+			{
+				uplinks++;
+			}
+			else
+			{
+				uplink_failures++;
+			}
+
+			if(++_uplink_count % FLEET_BLOCK_UPLOAD_EVERY != 0)
+			{
+				return;
+			}
+
+			char recv[8];
+			int code = 0;
+			if(_iface.coap_post_blocks(_endpoint, _upload, sizeof(_upload), FLEET_BLOCK_SIZE, recv, SaraN2::TEXT_PLAIN,
+									   code, sizeof(recv)) == Iface::NBIOT_OK)
+			{
+				uploads++;
+			}
+			else
+			{
+				upload_failures++;
+			}
+		}
+
+		/** Request a new T3412 of 1 to 6 hours and T3324 of 1 to 3 minutes
+		 */
+		void reconfigure()
+		{
+			_iface.set_tau_timer(Iface::T3412_units::HR_1, (uint8_t)(1 + next_random() % 6));
+			_iface.set_active_time(Iface::T3324_units::MIN_1, (uint8_t)(1 + next_random() % 3));
+			_iface.sync_psm_timers();
+
+			Iface::TP_PSM_Timers timers;
+			if(_iface.get_psm_timers(timers) == Iface::NBIOT_OK)
+			{
+				_tau_s = timers.granted_tau_s ? timers.granted_tau_s : timers.requested_tau_s;
+				_active_s = timers.granted_active_s ? timers.granted_active_s : timers.requested_active_s;
+			}
+
+			reconfigurations++;
+		}
+
+		void sleep_ms(uint32_t ms)
+		{
+			sleep(ms);
+		}
+
+		void sleep_until(uint64_t ms)
+		{
+			uint64_t now = _clock.now();
+			while(now < ms)
+			{
+				uint64_t step = ms - now;
+				sleep((step > UINT32_MAX) ? UINT32_MAX : (uint32_t)step);
+				now = _clock.now();
+			}
+		}
+
+		uint32_t next_random()
+		{
+			_seed ^= _seed << 13;
+			_seed ^= _seed >> 17;
+			_seed ^= _seed << 5;
+			return _seed;
+		}
+
+		TP_Virtual_Clock _clock;
+		Iface _iface;
+		SaraN2 &_modem;
+		uint64_t _end_ms;
+		uint32_t _seed;
+		uint64_t _attach_ms = 0;
+		bool _started = false;
+		int _socket = -1;
+		int _stream = -1;
+		int _endpoint = -1;
+		uint32_t _tau_s = 3600;
+		uint32_t _active_s = 60;
+		uint64_t _next_uplink_ms = 0;
+		uint64_t _next_tau_ms = 0;
+		uint64_t _next_ptw_ms = UINT64_MAX;
+		uint64_t _next_downlink_ms = UINT64_MAX;
+		uint32_t _edrx_cycle_ms = 0;
+		uint32_t _edrx_ptw_ms = 0;
+		uint32_t _wakes = 0;
+		uint32_t _uplink_count = 0;
+		uint8_t _upload[FLEET_BLOCK_UPLOAD_BYTES];
+};
+
+/** A worker's share of the devices. The owner takes from the back and
+ *  idle workers steal from the front
+ */
+struct Work_Queue
+{
+	std::mutex lock;
+	std::deque<size_t> devices;
+};
+
+/** Radio-on time and downlink latency summed over the devices in one
+ *  power saving mode
+ */
+struct Mode_Totals
+{
+	uint64_t devices = 0;
+	uint64_t paging_windows = 0;
+	uint64_t radio_on_ms = 0;
+	uint64_t downlinks = 0;
+	uint64_t latency_ms = 0;
+	uint64_t latency_max_ms = 0;
+};
+
+static bool take(Work_Queue &queue, size_t &device, bool steal)
+{
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if(queue.devices.empty())
+	{
+		return false;
+	}
+
+	if(steal)
+	{
+		device = queue.devices.front();
+		queue.devices.pop_front();
+	}
+	else
+	{
+		device = queue.devices.back();
+		queue.devices.pop_back();
+	}
+
+	return true;
+}
+
+static void run_worker(size_t self, std::vector<std::unique_ptr<Work_Queue>> &queues,
+					   std::vector<std::unique_ptr<Device>> &devices, std::atomic<size_t> &remaining,
+					   std::atomic<uint64_t> &steals)
+{
+	while(remaining.load() > 0)
+	{
+		size_t device = 0;
+		bool found = take(*queues[self], device, false);
+		for(size_t i = 1; !found && i < queues.size(); i++)
+		{
+			found = take(*queues[(self + i) % queues.size()], device, true);
+			if(found)
+			{
+				steals++;
+			}
+		}
+
+		if(!found)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		/** Step a device a few wakes at a time before handing it back,
+		 *  so that a queue lock isn't taken for every wake
+		 */
+		bool running = true;
+		for(int wake = 0; wake < 8 && running; wake++)
+		{
+			running = devices[device]->step();
+		}
+
+		if(running)
+		{
+			std::lock_guard<std::mutex> guard(queues[self]->lock);
+			queues[self]->devices.push_back(device);
+		}
+		else
+		{
+			remaining--;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t device_count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 1000;
+	size_t thread_count = (argc > 2) ? strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+	uint32_t days = (argc > 3) ? (uint32_t)strtoul(argv[3], nullptr, 10) : 7;
+	if(device_count == 0 || thread_count == 0 || days == 0)
+	{
+		printf("usage: %s [devices] [threads] [days]\n", argv[0]);
+		return 1;
+	}
+
+	CoAP_Stand_In server;
+	uint64_t end_ms = (uint64_t)days * 86400 * 1000;
+
+	/** The fake driver registers itself as it is constructed, so devices
+	 *  are built on one thread
+	 */
+	auto built = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<Device>> devices;
+	devices.reserve(device_count);
+	for(size_t i = 0; i < device_count; i++)
+	{
+		devices.emplace_back(new Device((uint32_t)(0x9E3779B9u * (i + 1)), i % FLEET_EDRX_EVERY == 1, end_ms, server));
+	}
+
+	std::vector<std::unique_ptr<Work_Queue>> queues;
+	for(size_t i = 0; i < thread_count; i++)
+	{
+		queues.emplace_back(new Work_Queue());
+	}
+	for(size_t i = 0; i < device_count; i++)
+	{
+		queues[i % thread_count]->devices.push_back(i);
+	}
+
+	auto started = std::chrono::steady_clock::now();
+	std::atomic<size_t> remaining{device_count};
+	std::atomic<uint64_t> steals{0};
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < thread_count; i++)
+	{
+		threads.emplace_back(run_worker, i, std::ref(queues), std::ref(devices), std::ref(remaining), std::ref(steals));
+	}
+	for(std::thread &thread : threads)
+	{
+		thread.join();
+	}
+	auto finished = std::chrono::steady_clock::now();
+
+	uint64_t start_failures = 0;
+	uint64_t start_total_ms = 0;
+	uint32_t start_max_ms = 0;
+	uint64_t uplinks = 0;
+	uint64_t uplink_failures = 0;
+	uint64_t uploads = 0;
+	uint64_t upload_failures = 0;
+	uint64_t taus = 0;
+	uint64_t reconfigurations = 0;
+	Mode_Totals modes[2];
+	for(const std::unique_ptr<Device> &device : devices)
+	{
+		Mode_Totals &mode = modes[device->edrx ? 1 : 0];
+		mode.devices++;
+		mode.paging_windows += device->paging_windows;
+		mode.radio_on_ms += device->radio_on_ms;
+		mode.downlinks += device->downlinks;
+		mode.latency_ms += device->downlink_latency_ms;
+		mode.latency_max_ms = (device->downlink_latency_max_ms > mode.latency_max_ms) ? device->downlink_latency_max_ms
+																						: mode.latency_max_ms;
+
+		start_failures += (device->start_status != Iface::NBIOT_OK) ? 1 : 0;
+		start_total_ms += device->start_ms;
+		start_max_ms = (device->start_ms > start_max_ms) ? device->start_ms : start_max_ms;
+		uplinks += device->uplinks;
+		uplink_failures += device->uplink_failures;
+		uploads += device->uploads;
+		upload_failures += device->upload_failures;
+		taus += device->taus;
+		reconfigurations += device->reconfigurations;
+	}
+
+	double build_s = std::chrono::duration<double>(started - built).count();
+	double run_s = std::chrono::duration<double>(finished - started).count();
+
+	printf("devices %zu, threads %zu, simulated days %u, %zu bytes per interface\n",
+		   device_count, thread_count, days, sizeof(Iface));
+	printf("build %.2f s, run %.2f s, %.0f device-days/s, %llu steals\n",
+		   build_s, run_s, device_count * days / run_s, (unsigned long long)steals.load());
+	printf("start: %llu failed, mean %llu ms, max %u ms\n", (unsigned long long)start_failures,
+		   (unsigned long long)(start_total_ms / device_count), start_max_ms);
+	printf("uplinks: %llu sent, %llu failed, %llu TAU-only wakes, %llu timer reconfigurations\n",
+		   (unsigned long long)uplinks, (unsigned long long)uplink_failures, (unsigned long long)taus,
+		   (unsigned long long)reconfigurations);
+	printf("uploads: %llu sent, %llu failed\n", (unsigned long long)uploads, (unsigned long long)upload_failures);
+	printf("stand-in: %llu NON, %llu CON, %llu blocks (%llu bytes), %llu uploads, %llu malformed\n",
+		   (unsigned long long)server.non_uplinks.load(), (unsigned long long)server.con_uplinks.load(),
+		   (unsigned long long)server.blocks.load(), (unsigned long long)server.block_bytes.load(),
+		   (unsigned long long)server.uploads.load(), (unsigned long long)server.malformed.load());
+
+	static const char *mode_names[2] = { "PSM", "eDRX" };
+	for(int i = 0; i < 2; i++)
+	{
+		const Mode_Totals &mode = modes[i];
+		if(mode.devices == 0)
+		{
+			continue;
+		}
+
+		printf("%s: %llu devices, %llu paging windows, radio on %.1f s per device-day, "
+			   "%llu downlinks reached after mean %.1f s, max %.1f s\n",
+			   mode_names[i], (unsigned long long)mode.devices, (unsigned long long)mode.paging_windows,
+			   mode.radio_on_ms / 1000.0 / (mode.devices * days), (unsigned long long)mode.downlinks,
+			   mode.downlinks ? mode.latency_ms / 1000.0 / mode.downlinks : 0.0, mode.latency_max_ms / 1000.0);
+	}
+
+	return (start_failures == 0 && uplink_failures == 0 && upload_failures == 0) ? 0 : 1;
+}
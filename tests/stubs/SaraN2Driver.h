@@ -0,0 +1,440 @@
+/**
+  * @file    SaraN2Driver.h
+  * @brief   Host-side fake of the SARA-N2 driver. Every command succeeds,
+  *          settings written are read back unchanged, CoAP profiles and
+  *          timers are held in memory, and UDP datagrams and CoAP POSTs
+  *          are captured and answered by handlers installed by the test
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mbed.h"
+
+/** Driver API level implemented by the fake
+ */
+#define SARAN2_DRIVER_API 2
+
+class SaraN2
+{
+
+	public:
+
+		enum
+		{
+			FALSE = 0,
+			TRUE  = 1
+		};
+
+		enum
+		{
+			AUTOCONNECT,
+			SCRAMBLING,
+			SI_AVOID,
+			COMBINE_ATTACH,
+			CELL_RESELECTION,
+			ENABLE_BIP,
+			NAS_SIM_PSM_ENABLE
+		};
+
+		enum
+		{
+			COAP_PROFILE_0 = 0,
+			COAP_PROFILE_1 = 1,
+			COAP_PROFILE_2 = 2,
+			COAP_PROFILE_3 = 3
+		};
+
+		enum
+		{
+			TEXT_PLAIN = 0
+		};
+
+		union Nuestats_t
+		{
+			struct
+			{
+				int signal_power;
+				int total_power;
+				int tx_power;
+				int tx_time;
+				int rx_time;
+				int cell_id;
+				int ecl;
+				int snr;
+				int earfcn;
+				int pci;
+				int rsrq;
+			} parameters;
+			char data[44];
+		};
+
+		/** A stored CoAP profile
+		 */
+		struct Profile
+		{
+			std::string ipv4;
+			uint16_t port;
+			std::string uri;
+		};
+
+		/** A datagram sent by the interface or waiting to be read by it
+		 */
+		struct Datagram
+		{
+			int socket;
+			std::string ipv4;
+			uint16_t port;
+			std::vector<uint8_t> data;
+		};
+
+		SaraN2(PinName txu, PinName rxu, PinName cts, PinName rst, PinName vint, PinName gpio, int baud) :
+			baud(baud)
+		{
+			(void)txu; (void)rxu; (void)cts; (void)rst; (void)vint; (void)gpio;
+			last() = this;
+		}
+
+		/** The most recently constructed fake, i.e. the one owned by the
+		 *  interface under test
+		 */
+		static SaraN2 *&last()
+		{
+			static SaraN2 *modem = nullptr;
+			return modem;
+		}
+
+		/** Queue a datagram for the interface and raise +NSONMI for it on
+		 *  the next process_urc()
+		 */
+		void deliver(int socket, const char *from_ipv4, uint16_t from_port, const std::vector<uint8_t> &data)
+		{
+			downlinks.push_back({ socket, from_ipv4, from_port, data });
+			nsonmi_due.push_back(socket);
+		}
+
+		int at() { return command("at"); }
+		int reboot_module() { reboots++; return command("reboot_module"); }
+		int get_radio_status(int &status) { status = radio; return command("get_radio_status"); }
+		int deactivate_radio() { return command("deactivate_radio"); }
+		int activate_radio() { return command("activate_radio"); }
+		int gprs_attach() { return command("gprs_attach"); }
+		int gprs_detach() { return command("gprs_detach"); }
+		int auto_register_to_network() { return command("auto_register_to_network"); }
+		int deregister_from_network() { return command("deregister_from_network"); }
+		int enable_power_save_mode() { return command("enable_power_save_mode"); }
+		int disable_power_save_mode() { return command("disable_power_save_mode"); }
+		int query_power_save_mode(int &enabled) { enabled = 1; return command("query_power_save_mode"); }
+		int npsmr(int &status) { status = psm; return command("npsmr"); }
+		int cscon(int &urc, int &status) { urc = 0; status = connected; return command("cscon"); }
+		int cereg(int &urc, int &status) { urc = 0; status = registered; return command("cereg"); }
+		int csq(int &power, int &quality) { power = 20; quality = 99; return command("csq"); }
+		int nuestats(char *data) { memcpy(data, stats.data, sizeof(stats.data)); return command("nuestats", NUESTATS_BYTES); }
+		int configure_ue(int function, int value) { (void)function; (void)value; return command("configure_ue"); }
+		int get_imei(char *imei) { strcpy(imei, "357520071234567"); return command("get_imei"); }
+		int natspeed(int rate, int timeout_s, bool store) { (void)rate; (void)timeout_s; (void)store; return command("natspeed"); }
+		void set_baud(int rate) { baud = rate; }
+		/** Stands for both ends of the UART: the real driver sets AT+IFC and
+		 *  the MCU serial port's CTS input together
+		 */
+		int set_flow_control(bool enable) { flow_control = enable; return command("set_flow_control"); }
+		int get_flow_control(bool &enabled) { enabled = flow_control; return command("get_flow_control"); }
+		int set_cscon_urc(int mode) { (void)mode; return command("set_cscon_urc"); }
+		int set_cereg_urc(int mode) { (void)mode; return command("set_cereg_urc"); }
+		int set_npsmr_urc(int mode) { (void)mode; return command("set_npsmr_urc"); }
+		int set_edrx(char *ptw, char *cycle) { edrx_ptw = ptw; edrx_cycle = cycle; return command("set_edrx"); }
+		int disable_edrx() { return command("disable_edrx"); }
+		int get_edrx(char *ptw, char *cycle) { strcpy(ptw, edrx_ptw.c_str()); strcpy(cycle, edrx_cycle.c_str()); return command("get_edrx"); }
+		int get_edrx_granted(char *ptw, char *cycle)
+		{
+			strcpy(ptw, granted_edrx_ptw.c_str());
+			strcpy(cycle, granted_edrx_cycle.c_str());
+			return command("get_edrx_granted");
+		}
+
+		int set_t3412_timer(char *timer) { t3412 = timer; return command("set_t3412_timer"); }
+		int get_t3412_timer(char *timer) { strcpy(timer, t3412.c_str()); return command("get_t3412_timer"); }
+		int set_t3324_timer(char *timer) { t3324 = timer; return command("set_t3324_timer"); }
+		int get_t3324_timer(char *timer) { strcpy(timer, t3324.c_str()); return command("get_t3324_timer"); }
+
+		int cereg_timers(int &status, char *active_time, char *periodic_tau)
+		{
+			status = registered;
+			strcpy(active_time, granted_active.c_str());
+			strcpy(periodic_tau, granted_tau.c_str());
+			return command("cereg_timers");
+		}
+
+		int write_profile(uint8_t profile, char *ipv4, uint16_t port, char *uri, uint8_t uri_length)
+		{
+			profiles[profile] = { ipv4, port, std::string(uri, uri_length) };
+			profile_writes++;
+			return 0;
+		}
+
+		int read_profile(uint8_t profile, char *ipv4, uint16_t &port, char *uri, size_t uri_len, uint8_t &uri_length)
+		{
+			const Profile &stored = profiles[profile];
+			strcpy(ipv4, stored.ipv4.c_str());
+			port = stored.port;
+			uri_length = (uint8_t)(stored.uri.size() < uri_len ? stored.uri.size() : uri_len - 1);
+			memcpy(uri, stored.uri.data(), uri_length);
+			uri[uri_length] = '\0';
+			return 0;
+		}
+
+		int load_profile(int profile) { loaded_profile = profile; return command("load_profile"); }
+		int select_coap_at_interface() { return command("select_coap_at_interface"); }
+
+		int coap_get(char *recv_data, size_t recv_len, int &response_code)
+		{
+			return coap_response("coap_get", recv_data, recv_len, response_code);
+		}
+
+		int coap_delete(char *recv_data, size_t recv_len, int &response_code)
+		{
+			return coap_response("coap_delete", recv_data, recv_len, response_code);
+		}
+
+		int coap_put(char *send_data, char *recv_data, size_t recv_len, int data_identifier, int &response_code)
+		{
+			(void)send_data; (void)data_identifier;
+			return coap_response("coap_put", recv_data, recv_len, response_code);
+		}
+
+		int coap_post(uint8_t *send_data, size_t length, char *recv_data, size_t recv_len, int data_identifier,
+					  uint8_t block_number, uint8_t more, int &response_code)
+		{
+			(void)data_identifier;
+			int status = coap_response("coap_post", recv_data, recv_len, response_code, AT_LINE_BYTES + 2 * length);
+			if(status == 0 && post_handler)
+			{
+				response_code = post_handler(send_data, length, block_number, more);
+			}
+			return status;
+		}
+
+		int nsocr(uint16_t local_port, int &socket)
+		{
+			(void)local_port;
+			socket = next_socket++;
+			return 0;
+		}
+
+		int nsocl(int socket) { (void)socket; return command("nsocl"); }
+
+		int nsost(int socket, char *ipv4, uint16_t port, uint8_t *data, size_t length)
+		{
+			nsost_begin(socket, ipv4, port, length);
+			nsost_write(data, length);
+			return nsost_end();
+		}
+
+		int nsost_begin(int socket, char *ipv4, uint16_t port, size_t length)
+		{
+			(void)length;
+			outgoing = { socket, ipv4, port, {} };
+			return 0;
+		}
+
+		int nsost_write(const uint8_t *data, size_t length)
+		{
+			transfer(2 * length);
+			outgoing.data.insert(outgoing.data.end(), data, data + length);
+			return 0;
+		}
+
+		int nsost_end()
+		{
+			if(command("nsost_end") != 0)
+			{
+				return -1;
+			}
+
+			sent.push_back(outgoing);
+			if(responder)
+			{
+				responder(outgoing);
+			}
+			return 0;
+		}
+
+		int nsorf(int socket, char *ipv4, uint16_t &port, uint8_t *data, size_t buffer_len, size_t &length,
+				  size_t &remaining)
+		{
+			length = 0;
+			remaining = 0;
+
+			if(command("nsorf") != 0)
+			{
+				return -1;
+			}
+
+			for(auto i = downlinks.begin(); i != downlinks.end(); ++i)
+			{
+				if(i->socket != socket)
+				{
+					continue;
+				}
+
+				strcpy(ipv4, i->ipv4.c_str());
+				port = i->port;
+				length = (i->data.size() < buffer_len) ? i->data.size() : buffer_len;
+				memcpy(data, i->data.data(), length);
+				transfer(2 * length);
+				downlinks.erase(i);
+				break;
+			}
+
+			for(const Datagram &waiting : downlinks)
+			{
+				if(waiting.socket == socket)
+				{
+					remaining += waiting.data.size();
+				}
+			}
+
+			return 0;
+		}
+
+		int process_urc()
+		{
+			while(!nsonmi_due.empty())
+			{
+				int socket = nsonmi_due.front();
+				nsonmi_due.pop_front();
+				if(nsonmi)
+				{
+					nsonmi(socket, 0);
+				}
+			}
+			return 0;
+		}
+
+		void attach_nsonmi(Callback<void(int, int)> handler) { nsonmi = handler; }
+		void attach_cscon(Callback<void(int)> handler) { cscon_urc = handler; }
+		void attach_cereg(Callback<void(int)> handler) { cereg_urc = handler; }
+		void attach_npsmr(Callback<void(int)> handler) { npsmr_urc = handler; }
+		void attach_cereg_timers(Callback<void(const char*, const char*)> handler) { cereg_timers_urc = handler; }
+
+		/** Bytes on the UART for a plain AT command and its OK, and for an
+		 *  AT+NUESTATS response. Payloads go as hex, two bytes per byte
+		 */
+		enum
+		{
+			AT_LINE_BYTES  = 16,
+			NUESTATS_BYTES = 200
+		};
+
+		/** Advances the caller's clock by the time each transfer spends on
+		 *  the UART at the current baud rate. Unset, the UART takes no time
+		 */
+		std::function<void(uint32_t)> uart_sleep;
+
+		/** Calls made to each command, and the number of coming calls to
+		 *  each that fail with -1
+		 */
+		std::map<std::string, int> calls;
+		std::map<std::string, int> failures;
+
+		int baud;
+		bool flow_control = false;
+		int radio = 1;
+		int connected = 0;
+		int registered = 1;
+		int psm = 0;
+		int reboots = 0;
+		Nuestats_t stats = {};
+
+		std::string t3412 = "00100001";
+		std::string t3324 = "00000101";
+		std::string granted_tau;
+		std::string granted_active;
+		std::string edrx_ptw = "0000";
+		std::string edrx_cycle = "0010";
+		std::string granted_edrx_ptw = "0000";
+		std::string granted_edrx_cycle = "0010";
+
+		Profile profiles[4] = {};
+		int profile_writes = 0;
+		int loaded_profile = -1;
+		int response_code = 205;
+		std::string response_payload;
+
+		int next_socket = 0;
+		Datagram outgoing;
+		std::vector<Datagram> sent;
+		std::deque<Datagram> downlinks;
+		std::deque<int> nsonmi_due;
+		std::function<void(const Datagram&)> responder;
+		std::function<int(const uint8_t*, size_t, uint8_t, uint8_t)> post_handler;
+
+		Callback<void(int, int)> nsonmi;
+		Callback<void(int)> cscon_urc;
+		Callback<void(int)> cereg_urc;
+		Callback<void(int)> npsmr_urc;
+		Callback<void(const char*, const char*)> cereg_timers_urc;
+
+	private:
+
+		uint64_t uart_backlog = 0;
+
+		/** Count a command and fail it if failures are queued for it. The
+		 *  command line and its response take bytes on the UART
+		 */
+		int command(const char *name, size_t bytes = AT_LINE_BYTES)
+		{
+			transfer(bytes);
+			calls[name]++;
+			if(failures[name] > 0)
+			{
+				failures[name]--;
+				return -1;
+			}
+			return 0;
+		}
+
+		/** Charge bytes at 10 bits each to uart_sleep, carrying anything
+		 *  under a millisecond over to the next transfer
+		 */
+		void transfer(size_t bytes)
+		{
+			if(!uart_sleep || baud <= 0)
+			{
+				return;
+			}
+
+			uart_backlog += (uint64_t)bytes * 10 * 1000;
+			uint32_t ms = (uint32_t)(uart_backlog / baud);
+			uart_backlog -= (uint64_t)ms * baud;
+			if(ms > 0)
+			{
+				uart_sleep(ms);
+			}
+		}
+
+		int coap_response(const char *name, char *recv_data, size_t recv_len, int &code, size_t bytes = AT_LINE_BYTES)
+		{
+			if(command(name, bytes) != 0)
+			{
+				return -1;
+			}
+
+			code = response_code;
+			if(recv_len > 0)
+			{
+				size_t length = (response_payload.size() < recv_len) ? response_payload.size() : recv_len - 1;
+				memcpy(recv_data, response_payload.data(), length);
+				recv_data[length] = '\0';
+			}
+			return 0;
+		}
+};
@@ -0,0 +1,147 @@
+/**
+  * @file    mbed.h
+  * @brief   Host-side stand-in for the parts of Mbed OS used by the NB-IoT
+  *          interface, so that it can be built and tested without a target
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <utility>
+
+typedef int PinName;
+#define NC (-1)
+
+enum PinDirection
+{
+	PIN_INPUT,
+	PIN_OUTPUT
+};
+
+enum PinMode
+{
+	PullNone,
+	PullUp,
+	PullDown,
+	OpenDrain
+};
+
+/** Function wrapper with the construction forms of mbed::Callback that
+ *  the interface and tests rely on
+ */
+template<typename F> class Callback;
+
+template<typename R, typename... A> class Callback<R(A...)>
+{
+
+	public:
+
+		Callback() {}
+
+		Callback(std::nullptr_t) {}
+
+		Callback(R (*function)(A...)) : _function(function) {}
+
+		template<typename T> Callback(T *object, R (T::*method)(A...)) :
+			_function([object, method](A... args) { return (object->*method)(args...); }) {}
+
+		template<typename F, typename = decltype(std::declval<F&>()(std::declval<A>()...))> Callback(F function) :
+			_function(function) {}
+
+		R operator()(A... args) const
+		{
+			return _function(args...);
+		}
+
+		explicit operator bool() const
+		{
+			return (bool)_function;
+		}
+
+	private:
+
+		std::function<R(A...)> _function;
+};
+
+template<typename T, typename R, typename... A> Callback<R(A...)> callback(T *object, R (T::*method)(A...))
+{
+	return Callback<R(A...)>(object, method);
+}
+
+inline void debug(const char *format, ...)
+{
+	(void)format;
+}
+
+namespace Kernel
+{
+	inline uint64_t get_ms_count()
+	{
+		return 0;
+	}
+}
+
+namespace ThisThread
+{
+	inline void sleep_for(uint32_t ms)
+	{
+		(void)ms;
+	}
+}
+
+class InterruptIn
+{
+
+	public:
+
+		InterruptIn(PinName pin) { (void)pin; }
+
+		void rise(Callback<void()> function) { (void)function; }
+
+		void fall(Callback<void()> function) { (void)function; }
+
+		int read()
+		{
+			return 1;
+		}
+};
+
+class DigitalInOut
+{
+
+	public:
+
+		DigitalInOut(PinName pin, PinDirection direction, PinMode mode, int value)
+		{
+			(void)pin; (void)direction; (void)mode; (void)value;
+		}
+
+		void mode(PinMode mode) { (void)mode; }
+
+		void output() {}
+
+		void input() {}
+
+		void write(int value)
+		{
+			_value = value;
+		}
+
+		int read()
+		{
+			return _value;
+		}
+
+	private:
+
+		int _value = 1;
+};
@@ -0,0 +1,1552 @@
+/**
+  * @file    test_nbiot_interface.cpp
+  * @brief   Host-side tests of the NB-IoT interface's pure components, driven
+  *          through the public API against the fake SARA-N2 in stubs/
+  */
+
+/** Includes
+ */
+#include <vector>
+
+#include "tp_nbiot_interface.h"
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition)                                                              \
+	do                                                                                \
+	{                                                                                 \
+		checks++;                                                                     \
+		if(!(condition))                                                              \
+		{                                                                             \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);       \
+			failures++;                                                               \
+		}                                                                             \
+	} while(0)
+
+typedef TP_NBIoT_Interface Iface;
+typedef TP_Metric_Store::TP_Metric_Sample Sample;
+
+/** An interface on the fake modem, running on virtual time
+ */
+struct Fixture
+{
+	TP_Virtual_Clock clock;
+	Iface iface;
+	SaraN2 &modem;
+
+	Fixture() : iface(NC, NC, NC, NC, NC, NC), modem(*SaraN2::last())
+	{
+		iface.set_clock(callback(&clock, &TP_Virtual_Clock::now), callback(&clock, &TP_Virtual_Clock::sleep));
+	}
+};
+
+/** Bitwise reference CRC-32, as used by Ethernet and zlib
+ */
+static uint32_t reference_crc32(const uint8_t *data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for(size_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for(int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		}
+	}
+
+	return ~crc;
+}
+
+static bool same_sample(const Sample &a, const Sample &b)
+{
+	return a.time_s == b.time_s && a.rsrp == b.rsrp && a.rsrq == b.rsrq && a.earfcn == b.earfcn &&
+		   a.ecl == b.ecl && a.registered == b.registered;
+}
+
+static void test_metric_store_round_trip()
+{
+	static TP_Metric_Store store;
+	store.clear();
+
+	/** Steady and jittered intervals, negative and changing values, and a
+	 *  gap large enough to need the widest delta-of-delta bucket
+	 */
+	std::vector<Sample> written;
+	uint32_t time_s = 1000;
+	for(int i = 0; i < 40; i++)
+	{
+		Sample sample;
+		time_s += (i < 10) ? 60 : (i < 20) ? 60 + (i % 3) * 7 : (i == 30) ? 100000 : 300;
+		sample.time_s = time_s;
+		sample.rsrp = -1100 + (i % 5) * 13;
+		sample.rsrq = (i % 7 == 0) ? -200 : -105;
+		sample.earfcn = (i < 25) ? 3450 : 6300;
+		sample.ecl = i % 3;
+		sample.registered = (i == 17) ? 2 : 1;
+		CHECK(store.append(sample) == Iface::NBIOT_OK);
+		written.push_back(sample);
+	}
+
+	CHECK(store.sample_count() == written.size());
+	CHECK(store.dropped_blocks() == 0);
+
+	Sample read[64];
+	size_t count = 0;
+	CHECK(store.query(0, UINT32_MAX, read, 64, count) == Iface::NBIOT_OK);
+	CHECK(count == written.size());
+	for(size_t i = 0; i < count && i < written.size(); i++)
+	{
+		CHECK(same_sample(read[i], written[i]));
+	}
+
+	/** A window selects samples by time, not by block
+	 */
+	CHECK(store.query(written[5].time_s, written[9].time_s, read, 64, count) == Iface::NBIOT_OK);
+	CHECK(count == 5);
+	CHECK(count == 5 && same_sample(read[0], written[5]) && same_sample(read[4], written[9]));
+
+	CHECK(store.query(0, UINT32_MAX, read, 3, count) == Iface::EXCEEDS_MAX_VALUE);
+
+	Sample older = written.back();
+	older.time_s--;
+	CHECK(store.append(older) == Iface::SAMPLE_OUT_OF_ORDER);
+}
+
+static void test_metric_store_compression_and_eviction()
+{
+	static TP_Metric_Store store;
+	store.clear();
+
+	/** After the first sample in full and the second, whose interval is
+	 *  new, an unchanged reading at a steady interval costs one bit for 
+	 *  the timestamp and one per field
+	 */
+	Sample sample = { 0, -950, -110, 3500, 0, 1 };
+	uint32_t appended = 0;
+	while(store.dropped_blocks() == 0)
+	{
+		sample.time_s += 60;
+		CHECK(store.append(sample) == Iface::NBIOT_OK);
+		appended++;
+	}
+
+	uint32_t header_bits = NBIOT_METRIC_FIELDS * 32;
+	uint32_t second_bits = 2 + 7 + NBIOT_METRIC_FIELDS;
+	uint32_t per_block = 2 + (NBIOT_METRIC_BLOCK_BYTES * 8 - header_bits - second_bits) / (1 + NBIOT_METRIC_FIELDS);
+	CHECK(appended == per_block * NBIOT_METRIC_BLOCKS + 1);
+	CHECK(store.sample_count() == per_block * (NBIOT_METRIC_BLOCKS - 1) + 1);
+
+	/** The blob header carries the format version and block count, each
+	 *  block its little-endian start time, sample count and bit length
+	 */
+	static uint8_t blob[NBIOT_METRIC_BLOCKS * (NBIOT_METRIC_BLOCK_BYTES + 8) + 2];
+	size_t length = 0;
+	CHECK(store.export_blocks(0, UINT32_MAX, blob, sizeof(blob), length) == Iface::NBIOT_OK);
+	CHECK(blob[0] == NBIOT_METRIC_FORMAT_VERSION);
+	CHECK(blob[1] == NBIOT_METRIC_BLOCKS);
+
+	uint32_t first_start = blob[2] | (blob[3] << 8) | (blob[4] << 16) | ((uint32_t)blob[5] << 24);
+	uint16_t first_count = (uint16_t)(blob[6] | (blob[7] << 8));
+	uint16_t first_bits = (uint16_t)(blob[8] | (blob[9] << 8));
+	CHECK(first_start == (per_block + 1) * 60);
+	CHECK(first_count == per_block);
+	CHECK(first_bits == header_bits + second_bits + (per_block - 2) * (1 + NBIOT_METRIC_FIELDS));
+
+	CHECK(store.export_blocks(0, UINT32_MAX, blob, 16, length) == Iface::EXCEEDS_MAX_VALUE);
+}
+
+static void test_gprs_timer_encoding()
+{
+	Fixture fixture;
+
+	/** 3GPP TS 24.008 GPRS Timer 3 and GPRS Timer 2 unit bits
+	 */
+	static const struct { Iface::T3412_units unit; const char *bits; uint32_t seconds; } t3412[] =
+	{
+		{ Iface::T3412_units::MIN_10, "000", 600 },
+		{ Iface::T3412_units::HR_1,   "001", 3600 },
+		{ Iface::T3412_units::HR_10,  "010", 36000 },
+		{ Iface::T3412_units::SEC_2,  "011", 2 },
+		{ Iface::T3412_units::SEC_30, "100", 30 },
+		{ Iface::T3412_units::MIN_1,  "101", 60 },
+		{ Iface::T3412_units::HR_320, "110", 1152000 }
+	};
+
+	for(const auto &entry : t3412)
+	{
+		CHECK(fixture.iface.set_tau_timer(entry.unit, 5) == Iface::NBIOT_OK);
+		CHECK(fixture.modem.t3412 == std::string(entry.bits) + "00101");
+
+		Iface::T3412_units unit;
+		uint8_t multiples = 0;
+		CHECK(fixture.iface.get_tau_timer(unit, multiples) == Iface::NBIOT_OK);
+		CHECK(unit == entry.unit && multiples == 5);
+
+		Iface::TP_PSM_Timers timers;
+		CHECK(fixture.iface.get_psm_timers(timers) == Iface::NBIOT_OK);
+		CHECK(timers.requested_tau_s == entry.seconds * 5);
+	}
+
+	static const struct { Iface::T3324_units unit; const char *bits; uint32_t seconds; } t3324[] =
+	{
+		{ Iface::T3324_units::SEC_2, "000", 2 },
+		{ Iface::T3324_units::MIN_1, "001", 60 },
+		{ Iface::T3324_units::MIN_6, "010", 360 }
+	};
+
+	for(const auto &entry : t3324)
+	{
+		CHECK(fixture.iface.set_active_time(entry.unit, 31) == Iface::NBIOT_OK);
+		CHECK(fixture.modem.t3324 == std::string(entry.bits) + "11111");
+
+		Iface::T3324_units unit;
+		uint8_t multiples = 0;
+		CHECK(fixture.iface.get_active_time(unit, multiples) == Iface::NBIOT_OK);
+		CHECK(unit == entry.unit && multiples == 31);
+	}
+
+	CHECK(fixture.iface.set_tau_timer(Iface::T3412_units::HR_1, 32) == Iface::EXCEEDS_MAX_VALUE);
+	CHECK(fixture.iface.set_active_time(Iface::T3324_units::INVALID, 1) == Iface::INVALID_UNIT_VALUE);
+
+	fixture.modem.t3412 = "0010x001";
+	Iface::T3412_units unit;
+	uint8_t multiples;
+	CHECK(fixture.iface.get_tau_timer(unit, multiples) == Iface::INVALID_UNIT_VALUE);
+	CHECK(unit == Iface::T3412_units::INVALID);
+}
+
+static void test_psm_grant()
+{
+	Fixture fixture;
+	fixture.modem.t3412 = "00100010";
+	fixture.modem.t3324 = "00100011";
+
+	int divergences = 0;
+	fixture.iface.attach_psm_timer_divergence([&divergences](const Iface::TP_PSM_Timers &timers)
+	{
+		(void)timers;
+		divergences++;
+	});
+
+	/** No PSM granted, so the requested values stand in
+	 */
+	Iface::TP_PSM_Timers timers;
+	CHECK(fixture.iface.get_psm_timers(timers) == Iface::NBIOT_OK);
+	CHECK(timers.requested_tau_s == 7200 && timers.requested_active_s == 180);
+	CHECK(timers.granted_tau_unit == Iface::T3412_units::INVALID && timers.granted_tau_s == 0);
+	CHECK(divergences == 0);
+
+	fixture.modem.granted_tau = "00000110";
+	fixture.modem.granted_active = "00100001";
+	CHECK(fixture.iface.get_psm_timers(timers) == Iface::NBIOT_OK);
+	CHECK(timers.granted_tau_s == 3600 && timers.granted_active_s == 60);
+	CHECK(divergences == 1);
+
+	/** The same grant repeated by every +CEREG is reported once
+	 */
+	fixture.modem.cereg_timers_urc("00100001", "00000110");
+	CHECK(fixture.iface.get_psm_timers(timers) == Iface::NBIOT_OK);
+	CHECK(divergences == 1);
+
+	fixture.modem.cereg_timers_urc("00100010", "00000110");
+	CHECK(divergences == 2);
+}
+
+static void test_resume_record_check()
+{
+	uint8_t check_string[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	CHECK(reference_crc32(check_string, sizeof(check_string)) == 0xCBF43926);
+
+	Iface::TP_Resume_Record record;
+	{
+		Fixture fixture;
+		fixture.iface.save_resume(record);
+	}
+
+	CHECK(record.check == reference_crc32((const uint8_t*)&record, offsetof(Iface::TP_Resume_Record, check)));
+
+	Fixture fixture;
+	CHECK(fixture.iface.resume(record) == Iface::NBIOT_OK);
+
+	Iface::TP_Resume_Record corrupt = record;
+	corrupt.baud ^= 1;
+	CHECK(fixture.iface.resume(corrupt) == Iface::INVALID_RESUME_RECORD);
+
+	fixture.modem.registered = 2;
+	CHECK(fixture.iface.resume(record) == Iface::FAIL_TO_CONNECT);
+}
+
+static void test_coap_profile_reuse()
+{
+	static char ipv4[] = "10.0.0.1";
+	static char uri_a[] = "coap://10.0.0.1:5683/a";
+	static char uri_b[] = "coap://10.0.0.1:5683/b";
+	char recv[32];
+	int code = 0;
+	int a = -1;
+	int b = -1;
+
+	Iface::TP_Resume_Record record;
+	SaraN2::Profile profiles[4];
+	{
+		Fixture fixture;
+		CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri_a, sizeof(uri_a) - 1, a) == Iface::NBIOT_OK);
+		CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri_b, sizeof(uri_b) - 1, b) == Iface::NBIOT_OK);
+
+		CHECK(fixture.iface.coap_get(a, recv, code, sizeof(recv)) == Iface::NBIOT_OK);
+		CHECK(fixture.iface.coap_get(b, recv, code, sizeof(recv)) == Iface::NBIOT_OK);
+		CHECK(fixture.modem.profile_writes == 2);
+
+		/** A profile already holding the settings is not rewritten
+		 */
+		CHECK(fixture.iface.coap_get(a, recv, code, sizeof(recv)) == Iface::NBIOT_OK);
+		CHECK(fixture.modem.profile_writes == 2);
+		CHECK(code == 205);
+
+		fixture.iface.save_resume(record);
+		for(int i = 0; i < 4; i++)
+		{
+			profiles[i] = fixture.modem.profiles[i];
+		}
+	}
+
+	/** After resume() endpoints find their profiles in any order
+	 */
+	Fixture fixture;
+	for(int i = 0; i < 4; i++)
+	{
+		fixture.modem.profiles[i] = profiles[i];
+	}
+	CHECK(fixture.iface.resume(record) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri_b, sizeof(uri_b) - 1, b) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri_a, sizeof(uri_a) - 1, a) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.coap_get(b, recv, code, sizeof(recv)) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.coap_get(a, recv, code, sizeof(recv)) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.profile_writes == 0);
+
+	int endpoint;
+	CHECK(fixture.iface.register_coap_endpoint(nullptr, 5683, uri_a, 1, endpoint) == Iface::INVALID_ENDPOINT);
+}
+
+static void test_coap_alias_savings()
+{
+	Fixture fixture;
+
+	/** Uri-Path options "sensors" (1 + 7 bytes) and "temperature-outdoor"
+	 *  (2 + 19 bytes, the length needing an extended byte) replaced by a
+	 *  single-character alias (1 + 1 bytes)
+	 */
+	static char ipv4[] = "10.0.0.1";
+	static char uri[] = "coap://10.0.0.1:5683/sensors/temperature-outdoor?x=1";
+	int endpoint = -1;
+	CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri, sizeof(uri) - 1, endpoint) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.set_coap_alias(endpoint, 't') == Iface::NBIOT_OK);
+
+	uint16_t per_request = 0;
+	uint32_t total = 0;
+	CHECK(fixture.iface.get_coap_alias_savings(endpoint, per_request, total) == Iface::NBIOT_OK);
+	CHECK(per_request == 27);
+	CHECK(total == 0);
+
+	char recv[8];
+	int code;
+	CHECK(fixture.iface.coap_get(endpoint, recv, code, sizeof(recv)) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.profiles[0].uri == "coap://10.0.0.1:5683/t");
+	CHECK(fixture.iface.get_coap_alias_savings(endpoint, per_request, total) == Iface::NBIOT_OK);
+	CHECK(total == 27);
+
+	CHECK(fixture.iface.set_coap_alias(endpoint, '/') == Iface::EXCEEDS_MAX_VALUE);
+}
+
+/** Build a response to a captured CoAP request
+ */
+static std::vector<uint8_t> coap_reply(uint8_t type, uint8_t code, uint16_t message_id, const uint8_t *token,
+									   const std::vector<uint8_t> &options, const char *payload)
+{
+	std::vector<uint8_t> reply = { (uint8_t)(0x40 | (type << 4) | NBIOT_COAP_TOKEN_LENGTH), code,
+								   (uint8_t)(message_id >> 8), (uint8_t)message_id };
+	reply.insert(reply.end(), token, token + NBIOT_COAP_TOKEN_LENGTH);
+	reply.insert(reply.end(), options.begin(), options.end());
+	if(payload != nullptr)
+	{
+		reply.push_back(0xFF);
+		reply.insert(reply.end(), payload, payload + strlen(payload));
+	}
+
+	return reply;
+}
+
+static void test_coap_over_udp()
+{
+	Fixture fixture;
+	static char ipv4[] = "10.0.0.2";
+	static char uri[] = "config/device";
+
+	int socket = -1;
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+
+	/** Answer with a piggybacked 2.05 carrying an ETag and payload
+	 */
+	fixture.modem.responder = [&fixture](const SaraN2::Datagram &request)
+	{
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x45, message_id, &request.data[4], { 0x42, 0xAB, 0xCD }, "hello"));
+	};
+
+	uint8_t payload[16] = {};
+	Iface::TP_CoAP_Response response = {};
+	response.etag[0] = 0x11;
+	response.etag_length = 1;
+	CHECK(fixture.iface.coap_get_validated(socket, ipv4, 5683, uri, payload, sizeof(payload), response) ==
+		  Iface::NBIOT_OK);
+
+	/** CON GET with a 4-byte token, then ETag (4), Uri-Path (11) "config"
+	 *  as a delta of 7 and Uri-Path "device" as a delta of 0
+	 */
+	CHECK(fixture.modem.sent.size() == 1);
+	const std::vector<uint8_t> &request = fixture.modem.sent[0].data;
+	std::vector<uint8_t> options(request.begin() + 4 + NBIOT_COAP_TOKEN_LENGTH, request.end());
+	std::vector<uint8_t> expected = { 0x41, 0x11, 0x76, 'c', 'o', 'n', 'f', 'i', 'g', 0x06, 'd', 'e', 'v', 'i', 'c', 'e' };
+	CHECK(request[0] == 0x44 && request[1] == 0x01);
+	CHECK(options == expected);
+	CHECK(fixture.modem.sent[0].port == 5683);
+
+	CHECK(response.code == 205);
+	CHECK(response.etag_length == 2 && response.etag[0] == 0xAB && response.etag[1] == 0xCD);
+	CHECK(response.payload_length == 5 && memcmp(payload, "hello", 5) == 0);
+
+	/** A confirmable response nobody is waiting for is reset, echoing its
+	 *  message ID, and not handed to the application
+	 */
+	fixture.modem.responder = nullptr;
+	uint8_t stale_token[NBIOT_COAP_TOKEN_LENGTH] = { 0xF0, 0, 0, 1 };
+	fixture.modem.deliver(socket, ipv4, 5683, coap_reply(0, 0x45, 0x1234, stale_token, {}, "late"));
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(fixture.modem.sent.size() == 2);
+	std::vector<uint8_t> reset = { 0x70, 0x00, 0x12, 0x34 };
+	CHECK(fixture.modem.sent.size() == 2 && fixture.modem.sent[1].data == reset);
+
+	Iface::TP_Downlink_Message *message = nullptr;
+	CHECK(fixture.iface.downlink_receive(message) == Iface::NO_MESSAGE);
+
+	/** Anything else is left for the application
+	 */
+	std::vector<uint8_t> other = { 0x00, 0x01, 0x02, 0x03 };
+	fixture.modem.deliver(socket, ipv4, 5683, other);
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(fixture.iface.downlink_receive(message) == Iface::NBIOT_OK);
+	CHECK(message != nullptr && message->length == 4 && memcmp(message->data, other.data(), 4) == 0);
+	if(message != nullptr)
+	{
+		fixture.iface.downlink_release(message);
+	}
+}
+
+static void test_coap_timeout()
+{
+	Fixture fixture;
+	static char ipv4[] = "10.0.0.3";
+	static char uri[] = "x";
+
+	int socket = -1;
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+
+	/** Unanswered, the request is sent NBIOT_COAP_MAX_RETRANSMIT more
+	 *  times, each with the same message ID and token
+	 */
+	uint64_t start_ms = fixture.clock.now();
+	Iface::TP_CoAP_Response response = {};
+	CHECK(fixture.iface.coap_get_validated(socket, ipv4, 5683, uri, nullptr, 0, response) == Iface::COAP_TIMEOUT);
+	CHECK(fixture.modem.sent.size() == NBIOT_COAP_MAX_RETRANSMIT + 1);
+	for(const SaraN2::Datagram &sent : fixture.modem.sent)
+	{
+		CHECK(sent.data == fixture.modem.sent[0].data);
+	}
+
+	uint64_t expected_ms = (uint64_t)NBIOT_COAP_ACK_TIMEOUT_MS * ((1 << (NBIOT_COAP_MAX_RETRANSMIT + 1)) - 1);
+	CHECK(fixture.clock.now() - start_ms >= expected_ms);
+}
+
+static void test_retry_policy()
+{
+	Fixture fixture;
+	Iface::TP_Retry_Policy policy = { 4, 100, 300 };
+	fixture.iface.set_retry_policy(policy);
+
+	/** Two transient failures are retried away, each after between half
+	 *  and all of a backoff that doubles from base_delay_ms
+	 */
+	fixture.modem.failures["activate_radio"] = 2;
+	uint64_t start_ms = fixture.clock.now();
+	CHECK(fixture.iface.activate_radio() == Iface::NBIOT_OK);
+	uint64_t elapsed_ms = fixture.clock.now() - start_ms;
+	CHECK(fixture.modem.calls["activate_radio"] == 3);
+	CHECK(elapsed_ms >= 50 + 100 && elapsed_ms <= 100 + 200);
+
+	Iface::TP_Retry_Stats stats;
+	fixture.iface.get_retry_stats(Iface::TP_Modem_Call::RADIO, stats);
+	CHECK(stats.calls == 1 && stats.retries == 2 && stats.failures == 0);
+
+	/** Attempts stop at max_attempts, with the backoff capped at max_delay_ms,
+	 *  and the driver's status is returned
+	 */
+	fixture.modem.failures["deactivate_radio"] = 10;
+	start_ms = fixture.clock.now();
+	CHECK(fixture.iface.deactivate_radio() == -1);
+	elapsed_ms = fixture.clock.now() - start_ms;
+	CHECK(fixture.modem.calls["deactivate_radio"] == 4);
+	CHECK(elapsed_ms >= 50 + 100 + 150 && elapsed_ms <= 100 + 200 + 300);
+
+	fixture.iface.get_retry_stats(Iface::TP_Modem_Call::RADIO, stats);
+	CHECK(stats.calls == 2 && stats.retries == 5 && stats.failures == 1);
+
+	/** A plain POST could be duplicated at the server, so it is tried once
+	 */
+	static char ipv4[] = "10.0.0.1";
+	static char uri[] = "coap://10.0.0.1:5683/p";
+	uint8_t data[4] = {};
+	char recv[8];
+	int code = 0;
+	CHECK(fixture.iface.configure_coap(ipv4, 5683, uri, sizeof(uri) - 1) == Iface::NBIOT_OK);
+	fixture.modem.failures["coap_post"] = 1;
+	CHECK(fixture.iface.coap_post(data, sizeof(data), recv, SaraN2::TEXT_PLAIN, 0, 0, code, sizeof(recv)) == -1);
+	CHECK(fixture.modem.calls["coap_post"] == 1);
+
+	fixture.iface.get_retry_stats(Iface::TP_Modem_Call::COAP_REQUEST, stats);
+	CHECK(stats.calls == 1 && stats.retries == 0 && stats.failures == 1);
+
+	/** A scatter-gather send is one socket transaction, also tried once,
+	 *  and the command line is still terminated when it fails
+	 */
+	int socket = -1;
+	uint8_t header[2] = { 0x40, 0x02 };
+	Iface::TP_Buffer_Segment segments[2] = { { header, sizeof(header) }, { data, sizeof(data) } };
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+	fixture.iface.reset_retry_stats();
+	CHECK(fixture.iface.udp_sendto(socket, ipv4, 5683, segments, 2) == Iface::NBIOT_OK);
+	fixture.modem.failures["nsost_end"] = 1;
+	CHECK(fixture.iface.udp_sendto(socket, ipv4, 5683, segments, 2) == -1);
+	CHECK(fixture.modem.calls["nsost_end"] == 2 && fixture.modem.sent.size() == 1);
+
+	fixture.iface.get_retry_stats(Iface::TP_Modem_Call::SOCKET, stats);
+	CHECK(stats.calls == 2 && stats.retries == 0 && stats.failures == 1);
+
+	/** max_attempts of 0 behaves as 1
+	 */
+	policy.max_attempts = 0;
+	fixture.iface.set_retry_policy(policy);
+	fixture.iface.reset_retry_stats();
+	fixture.modem.failures["activate_radio"] = 1;
+	CHECK(fixture.iface.activate_radio() == -1);
+	fixture.iface.get_retry_stats(Iface::TP_Modem_Call::RADIO, stats);
+	CHECK(stats.calls == 1 && stats.retries == 0 && stats.failures == 1);
+}
+
+static void test_status_cache()
+{
+	Fixture fixture;
+	int connected = -1;
+	int registered = -1;
+	int psm = -1;
+
+	/** Disabled by default, so every getter queries the modem
+	 */
+	CHECK(fixture.iface.get_connection_status(connected, registered) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.get_connection_status(connected, registered) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.calls["cscon"] == 2 && fixture.modem.calls["cereg"] == 2);
+
+	/** Values from those queries are served without AT traffic until 
+	 *  they are older than max_age_ms
+	 */
+	fixture.iface.set_status_cache_max_age(1000);
+	CHECK(fixture.iface.get_connection_status(connected, registered) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.get_power_save_mode_status(psm) == Iface::NBIOT_OK);
+	fixture.modem.connected = 1;
+	fixture.clock.sleep(1000);
+	CHECK(fixture.iface.get_connection_status(connected, registered) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.get_power_save_mode_status(psm) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.calls["cscon"] == 2 && fixture.modem.calls["npsmr"] == 1);
+	CHECK(connected == 0 && registered == 1 && psm == 0);
+
+	fixture.clock.sleep(1);
+	CHECK(fixture.iface.get_connection_status(connected, registered) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.calls["cscon"] == 3 && fixture.modem.calls["cereg"] == 3);
+	CHECK(connected == 1);
+
+	/** URCs refresh the cache, force_refresh bypasses it
+	 */
+	fixture.modem.cscon_urc(0);
+	fixture.modem.cereg_urc(5);
+	fixture.modem.npsmr_urc(1);
+	Iface::TP_Connection_Status status;
+	CHECK(fixture.iface.get_module_network_status(status, connected, registered, psm) == Iface::NBIOT_OK);
+	CHECK(connected == 0 && registered == 5 && psm == 1);
+	CHECK(status == Iface::TP_Connection_Status::PSM_REGISTERED);
+	CHECK(fixture.modem.calls["cscon"] == 3 && fixture.modem.calls["cereg"] == 3 && fixture.modem.calls["npsmr"] == 1);
+
+	CHECK(fixture.iface.get_connection_status(connected, registered, true) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.calls["cscon"] == 4 && registered == 1);
+
+	/** Only the stale value is queried, and invalidation empties the cache
+	 */
+	fixture.clock.sleep(600);
+	fixture.modem.cereg_urc(1);
+	fixture.clock.sleep(600);
+	CHECK(fixture.iface.get_connection_status(connected, registered) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.calls["cscon"] == 5 && fixture.modem.calls["cereg"] == 4);
+
+	fixture.iface.invalidate_status_cache();
+	CHECK(fixture.iface.get_power_save_mode_status(psm) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.calls["npsmr"] == 2 && psm == 0);
+
+	/** A failed query leaves nothing cached
+	 */
+	int radio = -1;
+	fixture.modem.failures["get_radio_status"] = 3;
+	CHECK(fixture.iface.get_radio_status(radio) == -1);
+	CHECK(fixture.iface.get_radio_status(radio) == Iface::NBIOT_OK && radio == 1);
+	CHECK(fixture.modem.calls["get_radio_status"] == 4);
+}
+
+static void test_uplink_scheduler()
+{
+	Fixture fixture;
+	CHECK(fixture.iface.set_tau_timer(Iface::T3412_units::HR_1, 1) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.set_active_time(Iface::T3324_units::MIN_1, 1) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.sync_psm_timers() == Iface::NBIOT_OK);
+
+	int sends = 0;
+	int send_status = Iface::NBIOT_OK;
+	auto send = [&sends, &send_status]() 
+	{
+		sends++;
+		return send_status;
+	};
+
+	/** Released at t0 and asleep, so the next TAU is at t0 + T3412
+	 */
+	fixture.modem.cscon_urc(1);
+	fixture.modem.cscon_urc(0);
+	fixture.modem.npsmr_urc(1);
+	uint64_t t0 = fixture.clock.now();
+	const uint64_t period_ms = 3600 * 1000;
+
+	uint32_t ms = 1;
+	CHECK(fixture.iface.get_next_uplink_window(ms) == Iface::NBIOT_OK && ms == 0);
+	CHECK(fixture.iface.defer_uplink(send, 36000) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.get_next_uplink_window(ms) == Iface::NBIOT_OK);
+	CHECK(ms == period_ms - NBIOT_TAU_GUARD_MS);
+
+	uint8_t sent = 0;
+	CHECK(fixture.iface.service_uplinks(sent) == Iface::NBIOT_OK && sent == 0);
+	fixture.clock.sleep(ms);
+	CHECK(fixture.iface.service_uplinks(sent) == Iface::NBIOT_OK && sent == 1);
+
+	/** With no release seen since, later TAUs fall whole periods after
+	 *  the first, and the window follows them rather than the deadline
+	 */
+	fixture.clock.sleep(NBIOT_TAU_GUARD_MS + 1000);
+	CHECK(fixture.iface.defer_uplink(send, 36000) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.get_next_uplink_window(ms) == Iface::NBIOT_OK);
+	CHECK(fixture.clock.now() + ms == t0 + 2 * period_ms - NBIOT_TAU_GUARD_MS);
+
+	fixture.clock.sleep(5 * period_ms);
+	CHECK(fixture.iface.get_next_uplink_window(ms) == Iface::NBIOT_OK);
+	CHECK(fixture.clock.now() + ms == t0 + 7 * period_ms - NBIOT_TAU_GUARD_MS);
+
+	/** A failure during a merged wake is kept for the next flush
+	 */
+	fixture.clock.sleep(ms);
+	send_status = -1;
+	CHECK(fixture.iface.service_uplinks(sent) == -1 && sent == 0);
+	send_status = Iface::NBIOT_OK;
+	CHECK(fixture.iface.service_uplinks(sent) == Iface::NBIOT_OK && sent == 1);
+
+	Iface::TP_Uplink_Stats stats;
+	fixture.iface.get_uplink_stats(stats);
+	CHECK(stats.merged_wakes == 3 && stats.forced_wakes == 0 && stats.sent == 2 && stats.failed == 1);
+	CHECK(stats.dropped == 0);
+
+	/** A deadline before the next TAU forces a wake, and a send that fails
+	 *  then is dropped
+	 */
+	fixture.modem.cscon_urc(1);
+	fixture.modem.cscon_urc(0);
+	fixture.modem.npsmr_urc(1);
+	CHECK(fixture.iface.defer_uplink(send, 60) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.get_next_uplink_window(ms) == Iface::NBIOT_OK && ms == 60000);
+	fixture.clock.sleep(ms);
+	send_status = -1;
+	CHECK(fixture.iface.service_uplinks(sent) == -1 && sent == 0);
+	CHECK(fixture.iface.get_next_uplink_window(ms) == Iface::NBIOT_OK && ms == 0);
+
+	fixture.iface.get_uplink_stats(stats);
+	CHECK(stats.forced_wakes == 1 && stats.failed == 2 && stats.dropped == 1);
+
+	/** An RRC connection is a session to join, whatever the timers say
+	 */
+	send_status = Iface::NBIOT_OK;
+	CHECK(fixture.iface.defer_uplink(send, 36000) == Iface::NBIOT_OK);
+	fixture.modem.cscon_urc(1);
+	CHECK(fixture.iface.service_uplinks(sent) == Iface::NBIOT_OK && sent == 1);
+
+	for(int i = 0; i < NBIOT_DEFERRED_UPLINKS; i++)
+	{
+		CHECK(fixture.iface.defer_uplink(send, 36000) == Iface::NBIOT_OK);
+	}
+	CHECK(fixture.iface.defer_uplink(send, 36000) == Iface::QUEUE_FULL);
+}
+
+static void test_edrx_encoding()
+{
+	Fixture fixture;
+
+	/** 3GPP TS 24.008 NB-S1 eDRX cycle fields
+	 */
+	static const struct { Iface::eDRX_cycles cycle; const char *bits; uint32_t ms; } cycles[] =
+	{
+		{ Iface::eDRX_cycles::SEC_20_48,    "0010", 20480 },
+		{ Iface::eDRX_cycles::SEC_40_96,    "0011", 40960 },
+		{ Iface::eDRX_cycles::SEC_81_92,    "0101", 81920 },
+		{ Iface::eDRX_cycles::SEC_163_84,   "1001", 163840 },
+		{ Iface::eDRX_cycles::SEC_327_68,   "1010", 327680 },
+		{ Iface::eDRX_cycles::SEC_655_36,   "1011", 655360 },
+		{ Iface::eDRX_cycles::SEC_1310_72,  "1100", 1310720 },
+		{ Iface::eDRX_cycles::SEC_2621_44,  "1101", 2621440 },
+		{ Iface::eDRX_cycles::SEC_5242_88,  "1110", 5242880 },
+		{ Iface::eDRX_cycles::SEC_10485_76, "1111", 10485760 }
+	};
+
+	uint8_t ptw = 0;
+	for(const auto &entry : cycles)
+	{
+		CHECK(fixture.iface.set_edrx(entry.cycle, ptw) == Iface::NBIOT_OK);
+		CHECK(fixture.modem.edrx_cycle == entry.bits);
+
+		Iface::eDRX_cycles cycle;
+		uint8_t read_ptw = 0xFF;
+		CHECK(fixture.iface.get_edrx(cycle, read_ptw) == Iface::NBIOT_OK);
+		CHECK(cycle == entry.cycle && read_ptw == ptw);
+		CHECK(fixture.iface.edrx_cycle_ms(entry.cycle) == entry.ms);
+
+		ptw = (uint8_t)((ptw + 7) & 0x0F);
+	}
+
+	CHECK(fixture.iface.set_edrx(Iface::eDRX_cycles::SEC_81_92, 13) == Iface::NBIOT_OK);
+	CHECK(fixture.modem.edrx_ptw == "1101");
+	CHECK(fixture.iface.edrx_ptw_ms(0) == 2560 && fixture.iface.edrx_ptw_ms(15) == 40960);
+
+	/** The network's grant is read separately from the request
+	 */
+	fixture.modem.granted_edrx_cycle = "0101";
+	fixture.modem.granted_edrx_ptw = "0011";
+	Iface::eDRX_cycles cycle;
+	CHECK(fixture.iface.get_edrx(cycle, ptw, true) == Iface::NBIOT_OK);
+	CHECK(cycle == Iface::eDRX_cycles::SEC_81_92 && ptw == 3);
+
+	/** Values outside the table are rejected, and unassigned or malformed
+	 *  fields read back as INVALID
+	 */
+	CHECK(fixture.iface.set_edrx(Iface::eDRX_cycles::SEC_20_48, 16) == Iface::EXCEEDS_MAX_VALUE);
+	CHECK(fixture.iface.set_edrx(Iface::eDRX_cycles::INVALID, 0) == Iface::INVALID_UNIT_VALUE);
+	CHECK(fixture.iface.edrx_cycle_ms(Iface::eDRX_cycles::INVALID) == 0);
+
+	fixture.modem.edrx_cycle = "0100";
+	CHECK(fixture.iface.get_edrx(cycle, ptw) == Iface::NBIOT_OK && cycle == Iface::eDRX_cycles::INVALID);
+	fixture.modem.edrx_cycle = "01x0";
+	CHECK(fixture.iface.get_edrx(cycle, ptw) != Iface::NBIOT_OK && cycle == Iface::eDRX_cycles::INVALID);
+}
+
+static void test_downlink_pool()
+{
+	Fixture fixture;
+	static const char ipv4[] = "10.0.0.4";
+
+	int socket = -1;
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.downlink_listen(socket) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.downlink_listen(NBIOT_UDP_MAX_SOCKETS) == Iface::INVALID_SOCKET);
+
+	/** Two more datagrams than buffers. The extras stay at the modem and
+	 *  count as one overflow however often they are polled
+	 */
+	for(uint8_t i = 0; i < NBIOT_DOWNLINK_BUFFERS + 2; i++)
+	{
+		fixture.modem.deliver(socket, ipv4, 5683, { i, (uint8_t)(i + 1) });
+	}
+
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(fixture.modem.downlinks.size() == 2);
+
+	Iface::TP_Downlink_Stats stats;
+	fixture.iface.get_downlink_stats(stats);
+	CHECK(stats.received == NBIOT_DOWNLINK_BUFFERS && stats.overflows == 1 && stats.dropped == 0);
+	CHECK(stats.peak_in_use == NBIOT_DOWNLINK_BUFFERS);
+
+	/** Messages come out oldest first, and releasing buffers lets the
+	 *  rest be collected
+	 */
+	Iface::TP_Downlink_Message *message = nullptr;
+	for(uint8_t i = 0; i < 2; i++)
+	{
+		CHECK(fixture.iface.downlink_receive(message) == Iface::NBIOT_OK);
+		CHECK(message != nullptr && message->socket == socket && message->port == 5683 && message->length == 2);
+		CHECK(message != nullptr && message->data[0] == i && strcmp(message->ipv4, ipv4) == 0);
+		fixture.iface.downlink_release(message);
+	}
+
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(fixture.modem.downlinks.empty());
+	for(uint8_t i = 2; i < NBIOT_DOWNLINK_BUFFERS + 2; i++)
+	{
+		CHECK(fixture.iface.downlink_receive(message) == Iface::NBIOT_OK);
+		CHECK(message != nullptr && message->data[0] == i);
+		fixture.iface.downlink_release(message);
+	}
+	CHECK(fixture.iface.downlink_receive(message) == Iface::NO_MESSAGE && message == nullptr);
+
+	fixture.iface.get_downlink_stats(stats);
+	CHECK(stats.received == NBIOT_DOWNLINK_BUFFERS + 2 && stats.overflows == 1);
+
+	/** A datagram that can't be read is lost and counted once
+	 */
+	fixture.modem.deliver(socket, ipv4, 5683, { 0xAA });
+	fixture.modem.failures["nsorf"] = 1;
+	CHECK(fixture.iface.process_urc() == -1);
+	CHECK(fixture.modem.calls["nsorf"] == NBIOT_DOWNLINK_BUFFERS + 3);
+	fixture.iface.get_downlink_stats(stats);
+	CHECK(stats.dropped == 1);
+
+	/** With a callback attached messages skip the queue, and sockets not
+	 *  listening still raise the udp_attach() callback
+	 */
+	int handed = 0;
+	Iface *iface = &fixture.iface;
+	fixture.iface.downlink_attach([&handed, iface](Iface::TP_Downlink_Message *received)
+	{
+		handed++;
+		iface->downlink_release(received);
+	});
+
+	int other = -1;
+	int notified = -1;
+	CHECK(fixture.iface.udp_open(other) == Iface::NBIOT_OK);
+	fixture.iface.udp_attach([&notified](int notified_socket, int length)
+	{
+		(void)length;
+		notified = notified_socket;
+	});
+
+	fixture.modem.downlinks.clear();
+	fixture.modem.deliver(socket, ipv4, 5683, { 0x01 });
+	fixture.modem.deliver(other, ipv4, 5683, { 0x02 });
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(handed == 1 && notified == other);
+	CHECK(fixture.iface.downlink_receive(message) == Iface::NO_MESSAGE);
+	CHECK(fixture.modem.downlinks.size() == 1);
+}
+
+static void test_coap_nested_request()
+{
+	Fixture fixture;
+	static char ipv4[] = "10.0.0.5";
+	static char uri[] = "state";
+	static char telemetry[] = "telemetry";
+
+	int socket = -1;
+	int stream = -1;
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.coap_stream_open(socket, ipv4, 5683, telemetry, 1, stream) == Iface::NBIOT_OK);
+	fixture.clock.sleep(1000);
+
+	/** The server's reply to a GET is preceded by a datagram for the 
+	 *  application, whose callback tries to make requests of its own
+	 */
+	fixture.modem.responder = [&fixture](const SaraN2::Datagram &request)
+	{
+		if(request.data[1] != 0x01)
+		{
+			return;
+		}
+
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port, { 0x00, 0x01 });
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x45, message_id, &request.data[4], {}, "ok"));
+	};
+
+	int nested_status = -1;
+	int stream_status = -1;
+	bool confirmed = true;
+	Iface *iface = &fixture.iface;
+	fixture.iface.downlink_attach([&](Iface::TP_Downlink_Message *message)
+	{
+		Iface::TP_CoAP_Response nested = {};
+		nested_status = iface->coap_get_validated(socket, ipv4, 5683, uri, nullptr, 0, nested);
+
+		uint8_t reading = 42;
+		stream_status = iface->coap_stream_send(stream, &reading, 1, confirmed);
+		iface->downlink_release(message);
+	});
+
+	uint8_t payload[8];
+	Iface::TP_CoAP_Response response = {};
+	CHECK(fixture.iface.coap_get_validated(socket, ipv4, 5683, uri, payload, sizeof(payload), response) ==
+		  Iface::NBIOT_OK);
+	CHECK(response.code == 205 && response.payload_length == 2);
+
+	/** The nested GET is refused, the heartbeat goes out non-confirmable
+	 *  and stays due
+	 */
+	CHECK(nested_status == Iface::COAP_BUSY);
+	CHECK(stream_status == Iface::NBIOT_OK && !confirmed);
+	CHECK(fixture.modem.sent.size() == 2 && (fixture.modem.sent[1].data[0] & 0x30) == 0x10);
+
+	fixture.modem.responder = [&fixture](const SaraN2::Datagram &request)
+	{
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x44, message_id, &request.data[4], {}, nullptr));
+	};
+	uint8_t reading = 43;
+	CHECK(fixture.iface.coap_stream_send(stream, &reading, 1, confirmed) == Iface::NBIOT_OK && confirmed);
+}
+
+static void test_recovery_tiers()
+{
+	static const char ipv4[] = "10.0.0.5";
+	static const int probe_polls = NBIOT_RECOVERY_PROBE_S * 2 + 1;
+	static const int reboot_polls = NBIOT_RECOVERY_REBOOT_S * 2 + 1;
+	static const int reset_polls = NBIOT_RECOVERY_RESET_S * 2 + 1;
+
+	/** A modem that answers is recovered by the AT probe alone and keeps
+	 *  its sockets
+	 */
+	Fixture fixture;
+	int socket = -1;
+	int stream = -1;
+	bool confirmed = false;
+	uint8_t reading[] = { 0x01 };
+	char uri[] = "/telemetry";
+	char server[] = "10.0.0.5";
+
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.downlink_listen(socket) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.coap_stream_open(socket, server, 5683, uri, 0, stream) == Iface::NBIOT_OK);
+
+	Iface::TP_Recovery_Tier tier = Iface::TP_Recovery_Tier::COUNT;
+	CHECK(fixture.iface.recover(tier) == Iface::NBIOT_OK);
+	CHECK(tier == Iface::TP_Recovery_Tier::AT_PROBE && fixture.modem.reboots == 0);
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::NBIOT_OK);
+
+	fixture.modem.deliver(socket, ipv4, 5683, { 0xAA });
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	Iface::TP_Downlink_Message *message = nullptr;
+	CHECK(fixture.iface.downlink_receive(message) == Iface::NBIOT_OK && message != nullptr);
+	fixture.iface.downlink_release(message);
+
+	/** One that stops answering for the whole probe window is rebooted,
+	 *  which closes its sockets, so listening and the stream are dropped
+	 */
+	fixture.modem.failures["at"] = probe_polls;
+	uint64_t started = fixture.clock.now();
+	CHECK(fixture.iface.recover(tier) == Iface::NBIOT_OK);
+	CHECK(tier == Iface::TP_Recovery_Tier::SOFT_REBOOT && fixture.modem.reboots == 1);
+
+	Iface::TP_Recovery_Stats stats;
+	fixture.iface.get_recovery_stats(stats);
+	CHECK(stats.recovered[(int)Iface::TP_Recovery_Tier::AT_PROBE] == 1);
+	CHECK(stats.recovered[(int)Iface::TP_Recovery_Tier::SOFT_REBOOT] == 1);
+	CHECK(stats.last_ms == fixture.clock.now() - started && stats.last_ms == NBIOT_RECOVERY_PROBE_S * 1000);
+
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::INVALID_STREAM);
+	fixture.modem.deliver(socket, ipv4, 5683, { 0xBB });
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(fixture.iface.downlink_receive(message) == Iface::NO_MESSAGE);
+	CHECK(fixture.modem.downlinks.size() == 1);
+	fixture.modem.downlinks.clear();
+
+	/** If the reboot doesn't help either RESET_N is pulsed, and without a
+	 *  power-cycle hook a modem that stays silent is a failure reported
+	 *  against the hardware reset
+	 */
+	fixture.modem.failures["at"] = probe_polls + reboot_polls;
+	started = fixture.clock.now();
+	CHECK(fixture.iface.recover(tier) == Iface::NBIOT_OK);
+	CHECK(tier == Iface::TP_Recovery_Tier::HARDWARE_RESET && fixture.modem.reboots == 2);
+	fixture.iface.get_recovery_stats(stats);
+	CHECK(stats.last_ms == (NBIOT_RECOVERY_PROBE_S + NBIOT_RECOVERY_REBOOT_S) * 1000 + NBIOT_RESET_PULSE_MS);
+	CHECK(stats.max_ms == stats.last_ms && stats.total_ms == stats.last_ms + NBIOT_RECOVERY_PROBE_S * 1000);
+
+	fixture.modem.failures["at"] = probe_polls + reboot_polls + reset_polls;
+	CHECK(fixture.iface.recover(tier) == Iface::FAIL_TO_CONNECT);
+	CHECK(tier == Iface::TP_Recovery_Tier::HARDWARE_RESET);
+	fixture.iface.get_recovery_stats(stats);
+	CHECK(stats.failures == 1);
+
+	/** The power-cycle hook is the last resort, and a hook that fails
+	 *  leaves the modem unrecovered
+	 */
+	int cycles = 0;
+	int cycle_status = Iface::NBIOT_OK;
+	fixture.iface.attach_power_cycle([&cycles, &cycle_status]()
+	{
+		cycles++;
+		return cycle_status;
+	});
+
+	fixture.modem.failures["at"] = probe_polls + reboot_polls + reset_polls;
+	CHECK(fixture.iface.recover(tier) == Iface::NBIOT_OK);
+	CHECK(tier == Iface::TP_Recovery_Tier::POWER_CYCLE && cycles == 1);
+
+	cycle_status = -1;
+	fixture.modem.failures["at"] = probe_polls + reboot_polls + reset_polls;
+	CHECK(fixture.iface.recover(tier) == Iface::FAIL_TO_CONNECT);
+	CHECK(tier == Iface::TP_Recovery_Tier::POWER_CYCLE && cycles == 2);
+	fixture.modem.failures["at"] = 0;
+
+	fixture.iface.get_recovery_stats(stats);
+	CHECK(stats.recovered[(int)Iface::TP_Recovery_Tier::HARDWARE_RESET] == 1);
+	CHECK(stats.recovered[(int)Iface::TP_Recovery_Tier::POWER_CYCLE] == 1 && stats.failures == 2);
+}
+
+static void test_coap_post_blocks()
+{
+	static char ipv4[] = "10.0.0.1";
+	static char uri[] = "coap://10.0.0.1:5683/upload";
+	uint8_t data[100];
+	char recv[16];
+	int code = 0;
+	int endpoint = -1;
+
+	for(size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (uint8_t)i;
+	}
+
+	Fixture fixture;
+	CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri, sizeof(uri) - 1, endpoint) == Iface::NBIOT_OK);
+
+	std::vector<uint8_t> received;
+	std::vector<uint8_t> numbers;
+	std::vector<uint8_t> more_flags;
+	int reject_block = -1;
+	fixture.modem.post_handler = [&](const uint8_t *block_data, size_t length, uint8_t block, uint8_t more)
+	{
+		received.insert(received.end(), block_data, block_data + length);
+		numbers.push_back(block);
+		more_flags.push_back(more);
+		return (block == reject_block) ? 413 : (more ? 231 : 204);
+	};
+
+	/** Block sizes must be a power of two within what the modem takes
+	 */
+	CHECK(fixture.iface.coap_post_blocks(endpoint, data, sizeof(data), 48, recv, SaraN2::TEXT_PLAIN, code,
+										 sizeof(recv)) == Iface::EXCEEDS_MAX_VALUE);
+	CHECK(fixture.iface.coap_post_blocks(endpoint, data, sizeof(data), NBIOT_COAP_BLOCK_MAX * 2, recv,
+										 SaraN2::TEXT_PLAIN, code, sizeof(recv)) == Iface::EXCEEDS_MAX_VALUE);
+	CHECK(fixture.modem.calls["coap_post"] == 0);
+
+	/** Without flow control blocks are paced, and the payload arrives
+	 *  whole and in order with only the last block marked final
+	 */
+	uint64_t start_ms = fixture.clock.now();
+	CHECK(fixture.iface.coap_post_blocks(endpoint, data, sizeof(data), 32, recv, SaraN2::TEXT_PLAIN, code,
+										 sizeof(recv)) == Iface::NBIOT_OK);
+	CHECK(fixture.clock.now() - start_ms == 3 * NBIOT_BLOCK_PACING_MS);
+	CHECK(code == 204 && received == std::vector<uint8_t>(data, data + sizeof(data)));
+	CHECK(numbers == std::vector<uint8_t>({ 0, 1, 2, 3 }) && more_flags == std::vector<uint8_t>({ 1, 1, 1, 0 }));
+
+	/** With flow control on they go back-to-back, and a block that fails
+	 *  at the modem is resent and counted
+	 */
+	CHECK(fixture.iface.set_flow_control(true) == Iface::NBIOT_OK);
+	Iface::TP_Retry_Policy policy = { 3, 0, 0 };
+	fixture.iface.set_retry_policy(policy);
+	received.clear();
+	numbers.clear();
+	fixture.modem.failures["coap_post"] = 1;
+	start_ms = fixture.clock.now();
+	CHECK(fixture.iface.coap_post_blocks(endpoint, data, sizeof(data), 64, recv, SaraN2::TEXT_PLAIN, code,
+										 sizeof(recv)) == Iface::NBIOT_OK);
+	CHECK(fixture.clock.now() == start_ms);
+	CHECK(received == std::vector<uint8_t>(data, data + sizeof(data)) && numbers.size() == 2);
+
+	Iface::TP_Block_Stats stats;
+	fixture.iface.get_block_stats(stats);
+	CHECK(stats.blocks_sent == 6 && stats.retries == 1 && stats.failures == 0);
+
+	/** A refused block ends the upload with UPLOAD_REJECTED and the
+	 *  server's code, and a block the modem never takes is a failure
+	 */
+	numbers.clear();
+	reject_block = 1;
+	CHECK(fixture.iface.coap_post_blocks(endpoint, data, sizeof(data), 32, recv, SaraN2::TEXT_PLAIN, code,
+										 sizeof(recv)) == Iface::UPLOAD_REJECTED);
+	CHECK(code == 413 && numbers == std::vector<uint8_t>({ 0, 1 }));
+
+	numbers.clear();
+	reject_block = -1;
+	fixture.modem.failures["coap_post"] = 3;
+	CHECK(fixture.iface.coap_post_blocks(endpoint, data, sizeof(data), 32, recv, SaraN2::TEXT_PLAIN, code,
+										 sizeof(recv)) == -1);
+	CHECK(numbers.empty());
+
+	fixture.iface.get_block_stats(stats);
+	CHECK(stats.blocks_sent == 8 && stats.retries == 3 && stats.failures == 1);
+}
+
+static void test_coap_streams()
+{
+	Fixture fixture;
+	static char ipv4[] = "10.0.0.6";
+	static char uri[] = "t";
+	uint8_t reading[] = { 0x12, 0x34 };
+	bool confirmed = true;
+
+	int socket = -1;
+	int stream = -1;
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.coap_stream_open(socket, ipv4, 5683, uri, 60, stream) == Iface::NBIOT_OK);
+
+	/** Uplinks between heartbeats are NON POSTs whose token is the stream
+	 *  prefix followed by a 24-bit sequence number
+	 */
+	fixture.modem.cscon_urc(1);
+	for(uint8_t i = 0; i < 2; i++)
+	{
+		CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::NBIOT_OK);
+		CHECK(!confirmed);
+	}
+
+	CHECK(fixture.modem.sent.size() == 2);
+	for(uint8_t i = 0; i < 2 && i < fixture.modem.sent.size(); i++)
+	{
+		const std::vector<uint8_t> &request = fixture.modem.sent[i].data;
+		std::vector<uint8_t> token(request.begin() + 4, request.begin() + 4 + NBIOT_COAP_TOKEN_LENGTH);
+		CHECK(request[0] == 0x54 && request[1] == 0x02);
+		CHECK(token == std::vector<uint8_t>({ (uint8_t)(NBIOT_COAP_STREAM_TOKEN | stream), 0, 0, i }));
+		CHECK(request[request.size() - 3] == 0xFF && request.back() == 0x34);
+	}
+
+	/** Radio-on time comes from the +CSCON edges alone, so dropping the
+	 *  status cache mid-session doesn't lose it
+	 */
+	fixture.clock.sleep(5000);
+	fixture.iface.invalidate_status_cache();
+	fixture.modem.cscon_urc(0);
+
+	Iface::TP_Uplink_Mode_Stats non_stats;
+	Iface::TP_Uplink_Mode_Stats con_stats;
+	fixture.iface.get_uplink_mode_stats(false, non_stats);
+	CHECK(non_stats.sent == 2 && non_stats.failed == 0 && non_stats.max_ms == 0);
+	CHECK(non_stats.radio_sessions == 1 && non_stats.radio_on_ms == 5000);
+
+	/** Once heartbeat_s has passed the next uplink is confirmable, and its
+	 *  session is charged to the confirmable mode
+	 */
+	fixture.modem.responder = [&fixture](const SaraN2::Datagram &request)
+	{
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.clock.sleep(1500);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x44, message_id, &request.data[4], {}, nullptr));
+	};
+
+	fixture.clock.sleep(55000);
+	fixture.modem.cscon_urc(1);
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::NBIOT_OK);
+	CHECK(confirmed && fixture.modem.sent.size() == 3 && fixture.modem.sent.back().data[0] == 0x44);
+	fixture.modem.responder = nullptr;
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::NBIOT_OK);
+	CHECK(!confirmed && fixture.modem.sent.back().data[0] == 0x54);
+	CHECK(fixture.modem.sent.back().data[7] == 3);
+	fixture.clock.sleep(2000);
+	fixture.modem.cscon_urc(0);
+
+	fixture.iface.get_uplink_mode_stats(true, con_stats);
+	CHECK(con_stats.sent == 1 && con_stats.last_ms == 1500);
+	CHECK(con_stats.radio_sessions == 1 && con_stats.radio_on_ms == 3500);
+	fixture.iface.get_uplink_mode_stats(false, non_stats);
+	CHECK(non_stats.sent == 3 && non_stats.radio_sessions == 1);
+
+	/** An unanswered heartbeat fails but still uses up its sequence number,
+	 *  and the next uplink tries the heartbeat again
+	 */
+	fixture.clock.sleep(60000);
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::COAP_TIMEOUT);
+	CHECK(!confirmed);
+
+	size_t sent = fixture.modem.sent.size();
+	fixture.modem.responder = [&fixture](const SaraN2::Datagram &request)
+	{
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x44, message_id, &request.data[4], {}, nullptr));
+	};
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::NBIOT_OK);
+	CHECK(confirmed && fixture.modem.sent.size() == sent + 1 && fixture.modem.sent.back().data[7] == 5);
+
+	fixture.iface.get_uplink_mode_stats(true, con_stats);
+	CHECK(con_stats.sent == 2 && con_stats.failed == 1);
+
+	CHECK(fixture.iface.coap_stream_close(stream) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.coap_stream_send(stream, reading, sizeof(reading), confirmed) == Iface::INVALID_STREAM);
+}
+
+static void test_snapshot_validity()
+{
+	Fixture fixture;
+	fixture.modem.stats.parameters.signal_power = -1053;
+	fixture.modem.stats.parameters.rsrq = -108;
+	fixture.modem.stats.parameters.snr = 35;
+	fixture.modem.stats.parameters.earfcn = 6300;
+	fixture.modem.stats.parameters.cell_id = 0x1234567;
+	fixture.modem.stats.parameters.ecl = 1;
+	fixture.modem.granted_tau = "00000110";
+	fixture.modem.granted_active = "00100001";
+	fixture.iface.set_status_cache_max_age(60000);
+
+	/** Every source answers, so every bit is set and the registration
+	 *  status and granted timers share one AT+CEREG? read
+	 */
+	Iface::TP_Diagnostics diagnostics;
+	CHECK(fixture.iface.snapshot(diagnostics) == Iface::NBIOT_OK);
+	CHECK(diagnostics.valid == 0xFF && diagnostics.version == NBIOT_DIAGNOSTICS_VERSION);
+	CHECK(diagnostics.rsrp == -1053 && diagnostics.rsrq == -108 && diagnostics.snr == 35 && diagnostics.ecl == 1);
+	CHECK(diagnostics.earfcn == 6300 && diagnostics.band == (uint8_t)Iface::TP_NBIoT_Band::BAND_20);
+	CHECK(diagnostics.cell_id == 0x1234567 && diagnostics.radio == 1 && diagnostics.registered == 1);
+	CHECK(diagnostics.requested_tau_s == 3600 && diagnostics.requested_active_s == 10);
+	CHECK(diagnostics.granted_tau_s == 3600 && diagnostics.granted_active_s == 60);
+	CHECK(fixture.modem.calls["cereg_timers"] == 1 && fixture.modem.calls["cereg"] == 0);
+
+	/** Cached state is used while fresh, and a URC keeps it so
+	 */
+	fixture.modem.cscon_urc(1);
+	int cscon_queries = fixture.modem.calls["cscon"];
+	int cereg_queries = fixture.modem.calls["cereg_timers"];
+	int timer_reads = fixture.modem.calls["get_t3412_timer"];
+	CHECK(fixture.iface.snapshot(diagnostics) == Iface::NBIOT_OK);
+	CHECK(diagnostics.valid == 0xFF && diagnostics.connected == 1);
+	CHECK(diagnostics.connection_status == (uint8_t)Iface::TP_Connection_Status::ACTIVE_REGISTERED_RRC_CONNECTED);
+	CHECK(fixture.modem.calls["cscon"] == cscon_queries && fixture.modem.calls["cereg_timers"] == cereg_queries);
+	CHECK(fixture.modem.calls["get_t3412_timer"] == timer_reads);
+
+	/** A failed query clears its own bit and any bit derived from it, but
+	 *  the rest of the snapshot is still returned
+	 */
+	Iface::TP_Retry_Policy policy = { 1, 0, 0 };
+	fixture.iface.set_retry_policy(policy);
+	fixture.iface.invalidate_status_cache();
+	fixture.modem.failures["cscon"] = 1;
+	CHECK(fixture.iface.snapshot(diagnostics) == Iface::NBIOT_OK);
+	CHECK(diagnostics.valid == (0xFF & ~(Iface::DIAG_CONNECTED | Iface::DIAG_CONNECTION_STATUS)));
+	CHECK(diagnostics.connected == 0 && diagnostics.connection_status == 0);
+
+	/** With the radio off +NUESTATS isn't read at all
+	 */
+	fixture.iface.invalidate_status_cache();
+	fixture.modem.radio = 0;
+	int nuestats_reads = fixture.modem.calls["nuestats"];
+	CHECK(fixture.iface.snapshot(diagnostics) == Iface::NBIOT_OK);
+	CHECK(!(diagnostics.valid & Iface::DIAG_UE_STATS) && (diagnostics.valid & Iface::DIAG_RADIO));
+	CHECK(diagnostics.radio == 0 && diagnostics.rsrp == 0 && diagnostics.cell_id == 0);
+	CHECK(fixture.modem.calls["nuestats"] == nuestats_reads);
+
+	/** When nothing answers the first failure is returned and valid is 0.
+	 *  Timers already read are still reported
+	 */
+	Fixture silent;
+	silent.iface.set_retry_policy(policy);
+	const char *commands[] = { "get_radio_status", "nuestats", "cscon", "cereg_timers", "npsmr", "get_t3412_timer" };
+	for(const char *command : commands)
+	{
+		silent.modem.failures[command] = 1;
+	}
+	CHECK(silent.iface.snapshot(diagnostics) == -1);
+	CHECK(diagnostics.valid == 0 && diagnostics.version == NBIOT_DIAGNOSTICS_VERSION);
+}
+
+static void test_sample_and_upload_metrics()
+{
+	static TP_Metric_Store store;
+	static char ipv4[] = "10.0.0.1";
+	static char uri[] = "coap://10.0.0.1:5683/metrics";
+	uint8_t blob[256];
+	char recv[16];
+	int code = 0;
+	int endpoint = -1;
+	store.clear();
+
+	/** Samples carry the caller's timestamp, so a second interface, as 
+	 *  after an MCU reset with uptime back at zero, keeps appending to a
+	 *  store that outlived the first
+	 */
+	static const uint32_t epoch_s = 1760000000;
+	{
+		Fixture fixture;
+		fixture.modem.stats.parameters.signal_power = -1053;
+		fixture.modem.stats.parameters.rsrq = -108;
+		fixture.modem.stats.parameters.earfcn = 6300;
+		fixture.modem.stats.parameters.ecl = 2;
+		CHECK(fixture.iface.sample_metrics(store, epoch_s) == Iface::NBIOT_OK);
+		CHECK(fixture.iface.sample_metrics(store, epoch_s + 60) == Iface::NBIOT_OK);
+	}
+
+	Fixture fixture;
+	CHECK(fixture.clock.now() == 0);
+	CHECK(fixture.iface.sample_metrics(store, epoch_s + 120) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.sample_metrics(store, epoch_s + 119) == Iface::SAMPLE_OUT_OF_ORDER);
+
+	Sample read[4];
+	size_t count = 0;
+	CHECK(store.query(epoch_s, epoch_s + 120, read, 4, count) == Iface::NBIOT_OK);
+	CHECK(count == 3 && read[0].time_s == epoch_s && read[2].time_s == epoch_s + 120);
+	CHECK(read[0].rsrp == -1053 && read[0].rsrq == -108 && read[0].earfcn == 6300 && read[0].ecl == 2);
+	CHECK(read[0].registered == 1 && read[2].rsrp == 0);
+
+	/** A small history goes up in one POST, and a refusal is reported as
+	 *  UPLOAD_REJECTED just as it is for a block upload
+	 */
+	CHECK(fixture.iface.register_coap_endpoint(ipv4, 5683, uri, sizeof(uri) - 1, endpoint) == Iface::NBIOT_OK);
+	CHECK(fixture.iface.upload_metrics(store, epoch_s, epoch_s + 120, blob, sizeof(blob), endpoint, recv,
+									   SaraN2::TEXT_PLAIN, code, sizeof(recv)) == Iface::NBIOT_OK);
+	CHECK(code == 205 && fixture.modem.calls["coap_post"] == 1);
+
+	fixture.modem.response_code = 400;
+	CHECK(fixture.iface.upload_metrics(store, epoch_s, epoch_s + 120, blob, sizeof(blob), endpoint, recv,
+									   SaraN2::TEXT_PLAIN, code, sizeof(recv)) == Iface::UPLOAD_REJECTED);
+	CHECK(code == 400);
+}
+
+static void test_start_profile()
+{
+	Fixture fixture;
+
+	/** The network's progress is scripted against virtual time: each step
+	 *  takes effect once the clock reaches it
+	 */
+	struct Step { uint64_t at_ms; int registered; int connected; };
+	std::vector<Step> script;
+	fixture.iface.set_clock(callback(&fixture.clock, &TP_Virtual_Clock::now), [&fixture, &script](uint32_t ms)
+	{
+		fixture.clock.sleep(ms);
+		for(const Step &step : script)
+		{
+			if(fixture.clock.now() >= step.at_ms)
+			{
+				fixture.modem.registered = step.registered;
+				fixture.modem.connected = step.connected;
+			}
+		}
+	});
+
+	/** The modem takes 2 s to answer AT after the reboot, then scans, 
+	 *  starts registering and registers on later status polls
+	 */
+	fixture.modem.registered = 0;
+	fixture.modem.failures["at"] = 4;
+	script = { { 4500, 2, 0 }, { 12000, 2, 1 }, { 22000, 1, 1 } };
+	CHECK(fixture.iface.start(60) == Iface::NBIOT_OK);
+
+	Iface::TP_Start_Profile profile;
+	fixture.iface.get_start_profile(profile);
+	CHECK(profile.status == Iface::NBIOT_OK && profile.reached == 0x3F && profile.total_ms == 22000);
+	uint32_t expected_at[] = { 0, 0, 2000, 4500, 12000, 22000 };
+	uint32_t expected_duration[] = { 0, 0, 2000, 2500, 7500, 10000 };
+	for(int i = 0; i < (int)Iface::TP_Start_Phase::COUNT; i++)
+	{
+		CHECK(profile.at_ms[i] == expected_at[i] && profile.duration_ms[i] == expected_duration[i]);
+	}
+
+	/** Buckets are by the bit length of whole seconds: under 1 s in 0,
+	 *  2 s and 2.5 s in 2, 7.5 s in 3 and 10 s in 4
+	 */
+	Iface::TP_Start_Histogram histogram;
+	fixture.iface.get_start_histogram(histogram);
+	CHECK(histogram.starts == 1 && histogram.failures == 0);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::CONFIGURED][0] == 1);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::REBOOTED][0] == 1);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::AT_READY][2] == 1);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::SCANNING][2] == 1);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::REGISTERING][3] == 1);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::REGISTERED][4] == 1);
+
+	/** Phases passed between polls are left unmarked and folded into the
+	 *  next one, and anything over 2^(buckets - 2) s lands in the last bucket
+	 */
+	uint64_t started = fixture.clock.now();
+	fixture.modem.registered = 0;
+	fixture.modem.connected = 0;
+	script = { { started + 600000, 1, 0 } };
+	CHECK(fixture.iface.start(900) == Iface::NBIOT_OK);
+	fixture.iface.get_start_profile(profile);
+	CHECK(profile.reached == 0x27 && profile.duration_ms[(int)Iface::TP_Start_Phase::REGISTERED] == 600000);
+	fixture.iface.get_start_histogram(histogram);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::REGISTERED][NBIOT_START_HISTOGRAM_BUCKETS - 1] == 1);
+
+	/** A start that times out records how far it got and counts as a
+	 *  failure
+	 */
+	started = fixture.clock.now();
+	fixture.modem.registered = 0;
+	script = {};
+	CHECK(fixture.iface.start(5) == Iface::FAIL_TO_CONNECT);
+	fixture.iface.get_start_profile(profile);
+	CHECK(profile.status == Iface::FAIL_TO_CONNECT && profile.reached == 0x07);
+	CHECK(profile.total_ms == fixture.clock.now() - started && profile.total_ms >= 5000);
+	fixture.iface.get_start_histogram(histogram);
+	CHECK(histogram.starts == 3 && histogram.failures == 1);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::AT_READY][0] == 2);
+	CHECK(histogram.buckets[(int)Iface::TP_Start_Phase::REGISTERED][4] == 1);
+
+	fixture.iface.clear_start_histogram();
+	fixture.iface.get_start_histogram(histogram);
+	CHECK(histogram.starts == 0 && histogram.buckets[(int)Iface::TP_Start_Phase::REGISTERED][4] == 0);
+}
+
+static void test_baud_negotiation()
+{
+	/** The fake UART charges 10 bits per byte at the current rate, so the
+	 *  measured throughput follows the rate
+	 */
+	Fixture fixture;
+	fixture.modem.uart_sleep = [&fixture](uint32_t ms) { fixture.clock.sleep(ms); };
+
+	int baud = 0;
+	uint32_t bytes_per_s = 0;
+	fixture.modem.failures["natspeed"] = 3;
+	CHECK(fixture.iface.negotiate_baud_rate(baud, bytes_per_s) == Iface::NBIOT_OK);
+	CHECK(baud == 57600 && fixture.modem.baud == 57600);
+	CHECK(bytes_per_s >= 5600 && bytes_per_s <= 5920);
+	uint32_t slow_bytes_per_s = bytes_per_s;
+
+	CHECK(fixture.iface.negotiate_baud_rate(baud, bytes_per_s) == Iface::NBIOT_OK);
+	CHECK(baud == 460800 && fixture.modem.baud == 460800);
+	CHECK(bytes_per_s >= 44800 && bytes_per_s <= 47400);
+	CHECK(bytes_per_s > 7 * slow_bytes_per_s);
+
+	/** A rate that fails its AT probe is abandoned, both ends go back to
+	 *  the old rate, and the next one down is tried
+	 */
+	Fixture fallback;
+	fallback.modem.uart_sleep = [&fallback](uint32_t ms) { fallback.clock.sleep(ms); };
+	fallback.modem.failures["at"] = 3;
+	CHECK(fallback.iface.negotiate_baud_rate(baud, bytes_per_s) == Iface::NBIOT_OK);
+	CHECK(baud == 230400 && fallback.modem.baud == 230400);
+	CHECK(fallback.modem.calls["natspeed"] == 3);
+	CHECK(bytes_per_s >= 22400 && bytes_per_s <= 23700);
+}
+
+static void test_teardown_in_bulk()
+{
+	/** The fleet simulator creates and destroys interfaces in bulk. The
+	 *  driver's maps and hooks own heap memory, so destroying it twice
+	 *  fails under the address sanitizer
+	 */
+	int destroyed = 0;
+	for(int i = 0; i < 64; i++)
+	{
+		Fixture fixture;
+		fixture.modem.calls["at"] = i;
+		fixture.modem.uart_sleep = [&fixture](uint32_t ms) { fixture.clock.sleep(ms); };
+		destroyed++;
+	}
+	CHECK(destroyed == 64);
+}
+
+static void test_coap_cancel_observe()
+{
+	Fixture fixture;
+	static char ipv4[] = "10.0.0.9";
+	static char uri[] = "alarm";
+
+	int socket = -1;
+	CHECK(fixture.iface.udp_open(socket) == Iface::NBIOT_OK);
+
+	int notifications = 0;
+	auto on_notify = [&notifications](const Iface::TP_CoAP_Response &response) { (void)response; notifications++; };
+
+	/** Registration is answered with a piggybacked 2.05 carrying Observe 1
+	 */
+	fixture.modem.responder = [&fixture](const SaraN2::Datagram &request)
+	{
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x45, message_id, &request.data[4], { 0x61, 0x01 }, "1"));
+	};
+
+	int observation = -1;
+	CHECK(fixture.iface.coap_observe(socket, ipv4, 5683, uri, on_notify, observation) == Iface::NBIOT_OK);
+	CHECK(observation >= 0 && notifications == 1);
+	uint8_t token[NBIOT_COAP_TOKEN_LENGTH];
+	memcpy(token, &fixture.modem.sent[0].data[4], NBIOT_COAP_TOKEN_LENGTH);
+
+	/** An unanswered deregistration leaves the observation active, so
+	 *  later notifications are still acknowledged and delivered
+	 */
+	fixture.modem.responder = nullptr;
+	CHECK(fixture.iface.coap_cancel_observe(observation) == Iface::COAP_TIMEOUT);
+	fixture.modem.deliver(socket, ipv4, 5683, coap_reply(0, 0x45, 0x2000, token, { 0x61, 0x02 }, "2"));
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(notifications == 2);
+	std::vector<uint8_t> ack = { 0x60, 0x00, 0x20, 0x00 };
+	CHECK(fixture.modem.sent.back().data == ack);
+
+	/** A notification racing the deregistration is acknowledged but not
+	 *  delivered, nor is the response, and the slot is then freed
+	 */
+	fixture.modem.responder = [&fixture, &token](const SaraN2::Datagram &request)
+	{
+		uint16_t message_id = (uint16_t)((request.data[2] << 8) | request.data[3]);
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(2, 0x45, message_id, &request.data[4], {}, "done"));
+		fixture.modem.deliver(request.socket, request.ipv4.c_str(), request.port,
+							  coap_reply(1, 0x45, 0x2001, token, { 0x61, 0x03 }, "3"));
+	};
+	CHECK(fixture.iface.coap_cancel_observe(observation) == Iface::NBIOT_OK);
+	CHECK(notifications == 2);
+
+	fixture.modem.responder = nullptr;
+	fixture.modem.deliver(socket, ipv4, 5683, coap_reply(0, 0x45, 0x2002, token, { 0x61, 0x04 }, "4"));
+	CHECK(fixture.iface.process_urc() == Iface::NBIOT_OK);
+	CHECK(notifications == 2);
+	std::vector<uint8_t> reset = { 0x70, 0x00, 0x20, 0x02 };
+	CHECK(fixture.modem.sent.back().data == reset);
+	CHECK(fixture.iface.coap_cancel_observe(observation) == Iface::INVALID_OBSERVATION);
+}
+
+int main()
+{
+	test_metric_store_round_trip();
+	test_metric_store_compression_and_eviction();
+	test_gprs_timer_encoding();
+	test_psm_grant();
+	test_resume_record_check();
+	test_coap_profile_reuse();
+	test_coap_alias_savings();
+	test_coap_over_udp();
+	test_coap_timeout();
+	test_retry_policy();
+	test_status_cache();
+	test_uplink_scheduler();
+	test_edrx_encoding();
+	test_downlink_pool();
+	test_coap_nested_request();
+	test_recovery_tiers();
+	test_coap_post_blocks();
+	test_coap_streams();
+	test_snapshot_validity();
+	test_sample_and_upload_metrics();
+	test_start_profile();
+	test_baud_negotiation();
+	test_teardown_in_bulk();
+	test_coap_cancel_observe();
+
+	printf("%d checks, %d failed\n", checks, failures);
+
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Worst-case stack usage of the public TP_NBIoT_Interface methods.
+
+Build tp_nbiot_interface.cpp with GCC 10 or later using
+
+    -fstack-usage -fcallgraph-info=su
+
+and point this script at the build directory. Frame sizes come from the
+.su/.ci files and the call graph from the .ci files, so each figure is the
+deepest chain of frames reachable from the method. Calls into code that was
+not built with the flags above, i.e. the SaraN2 driver or Mbed OS, carry no
+frame size; they are listed so that their cost can be added to the budget.
+Recursion and dynamically sized frames make the figure unbounded.
+
+    tools/stack_report.py BUILD_DIR [--budget tools/stack_budget.txt] [--exclude stubs/]
+
+Functions defined in a source path containing an --exclude string are
+treated in the same way as the driver, so that a host build against the
+stand-ins in tests/stubs/ measures the interface alone. "make -C tests stack"
+builds and checks it that way.
+
+The budget file has one "<method> <bytes>" pair per line, with "*" as the
+default for methods not listed. The exit status is 1 if any method is over
+budget or unbounded, so the script can be run as a CI step.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+CLASS = "TP_NBIoT_Interface"
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tp_nbiot_interface.h")
+
+NODE = re.compile(r'node: \{ title: "([^"]+)" label: "((?:[^"\\]|\\.)*)"')
+EDGE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+FRAME = re.compile(r'\\n(\d+) bytes \((static|dynamic|dynamic,bounded)\)')
+
+
+def public_methods(header):
+    """Names of the methods declared in the public section of the class."""
+    text = open(header).read()
+    body = text[text.index("class " + CLASS):]
+    public = body[body.index("public:"):body.index("private:")]
+    return set(re.findall(r"^\s+[\w:<>]+[\s\*&]+(\w+)\(", public, re.M))
+
+
+def load_graph(build_dir, exclude=()):
+    """Return name, frame and callee maps from every .ci file under build_dir."""
+    names, frames, dynamic, callees = {}, {}, set(), {}
+    for root, _, files in os.walk(build_dir):
+        for name in files:
+            if not name.endswith(".ci"):
+                continue
+            text = open(os.path.join(root, name)).read()
+            for title, label in NODE.findall(text):
+                lines = label.split("\\n")
+                names[title] = lines[0]
+                frame = FRAME.search(label)
+                if len(lines) > 1 and any(path in lines[1] for path in exclude):
+                    frame = None
+                if frame:
+                    frames[title] = int(frame.group(1))
+                    if frame.group(2) == "dynamic":
+                        dynamic.add(title)
+            for source, target in EDGE.findall(text):
+                callees.setdefault(source, set()).add(target)
+    return names, frames, dynamic, callees
+
+
+def worst_case(node, frames, dynamic, callees, memo, active):
+    """Deepest stack from node, whether it is bounded, and unsized callees."""
+    if node in memo:
+        return memo[node]
+    if node in active or node in dynamic:
+        return 0, False, set()
+    if node not in frames:
+        return 0, True, {node}
+
+    active.add(node)
+    deepest, bounded, unsized = 0, True, set()
+    for callee in callees.get(node, ()):
+        depth, callee_bounded, callee_unsized = worst_case(callee, frames, dynamic, callees, memo, active)
+        deepest = max(deepest, depth)
+        bounded = bounded and callee_bounded
+        unsized |= callee_unsized
+    active.discard(node)
+
+    memo[node] = (frames[node] + deepest, bounded, unsized)
+    return memo[node]
+
+
+def demangle(symbols):
+    """Readable names for callees, whose .ci labels are often truncated."""
+    mangled = [s.split(":")[-1] for s in symbols]
+    try:
+        out = subprocess.run(["c++filt"], input="\n".join(mangled), capture_output=True, text=True).stdout
+        return out.split("\n")[:len(mangled)]
+    except OSError:
+        return mangled
+
+
+def load_budget(path):
+    budget = {}
+    for line in open(path):
+        line = line.split("#")[0].split()
+        if len(line) == 2:
+            budget[line[0]] = int(line[1])
+    return budget
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("build_dir")
+    parser.add_argument("--budget", help="file of per-method stack budgets in bytes")
+    parser.add_argument("--header", default=HEADER)
+    parser.add_argument("--exclude", action="append", default=[],
+                        help="treat functions from source paths containing this as unsized")
+    parser.add_argument("--verbose", action="store_true", help="list callees without a frame size")
+    args = parser.parse_args()
+
+    names, frames, dynamic, callees = load_graph(args.build_dir, args.exclude)
+    if not names:
+        sys.exit("no .ci files found, build with -fstack-usage -fcallgraph-info=su")
+
+    methods = public_methods(args.header)
+    budget = load_budget(args.budget) if args.budget else {}
+    method_name = re.compile(r"\b" + CLASS + r"::(\w+)\(")
+
+    rows = []
+    memo = {}
+    for node, label in names.items():
+        match = method_name.search(label)
+        if not match or match.group(1) not in methods or node not in frames:
+            continue
+        depth, bounded, unsized = worst_case(node, frames, dynamic, callees, memo, set())
+        signature = label[label.index(CLASS + "::") + len(CLASS) + 2:]
+        limit = budget.get(match.group(1), budget.get("*"))
+        unsized = sorted(unsized - {"__indirect_call"})
+        rows.append((depth, bounded, signature, limit, sorted(demangle(unsized))))
+
+    failed = False
+    print("%8s  %8s  %s" % ("bytes", "budget", "method"))
+    for depth, bounded, signature, limit, unsized in sorted(rows, key=lambda r: (-r[0], r[2])):
+        over = not bounded or (limit is not None and depth > limit)
+        failed = failed or over
+        print("%7d%s  %8s  %s%s" % (depth, "" if bounded else "+", "-" if limit is None else limit,
+                                    signature, "  OVER BUDGET" if over else ""))
+        if args.verbose:
+            for callee in unsized:
+                print("%20s+ %s" % ("", callee))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
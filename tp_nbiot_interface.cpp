@@ -1,6 +1,6 @@
 /**
   * @file    tp_nbiot_interface.cpp
-  * @version 0.4.0
+  * @version 0.5.0
   * @author  Adam Mitchell
   * @brief   C++ file of the Thingpilot NB-IoT interface. This interface is hardware agnostic
   *          and depends on the underlying modem drivers exposing an identical interface
@@ -14,6 +14,71 @@
  */
 #include "tp_nbiot_interface.h"
 
+#if DEVICE_TRNG
+	#include "hal/trng_api.h"
+#endif /* #if DEVICE_TRNG */
+
+/** 3-bit GPRS timer unit fields as specified in 3GPP TS 24.008, indexed by 
+ *  T3412_units/T3324_units, and the reverse lookups indexed by unit field
+ */
+static const uint8_t t3412_unit_bits[] = { 0x6, 0x2, 0x1, 0x0, 0x5, 0x4, 0x3, 0x7 };
+static const uint8_t t3324_unit_bits[] = { 0x2, 0x1, 0x0, 0x7 };
+
+/** Length in seconds of each T3412_units/T3324_units value. Deactivated
+ *  timers are 0
+ */
+static const uint32_t t3412_unit_seconds[] = { 1152000, 36000, 3600, 600, 60, 30, 2, 0 };
+static const uint32_t t3324_unit_seconds[] = { 360, 60, 2, 0 };
+
+/** 4-bit NB-S1 eDRX cycle fields as specified in 3GPP TS 24.008, indexed by
+ *  eDRX_cycles, and the reverse lookup indexed by field
+ */
+static const uint8_t edrx_cycle_bits[] = { 0x2, 0x3, 0x5, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF };
+
+static const TP_NBIoT_Interface::eDRX_cycles edrx_cycles_from_bits[] =
+{
+	TP_NBIoT_Interface::eDRX_cycles::INVALID,
+	TP_NBIoT_Interface::eDRX_cycles::INVALID,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_20_48,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_40_96,
+	TP_NBIoT_Interface::eDRX_cycles::INVALID,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_81_92,
+	TP_NBIoT_Interface::eDRX_cycles::INVALID,
+	TP_NBIoT_Interface::eDRX_cycles::INVALID,
+	TP_NBIoT_Interface::eDRX_cycles::INVALID,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_163_84,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_327_68,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_655_36,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_1310_72,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_2621_44,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_5242_88,
+	TP_NBIoT_Interface::eDRX_cycles::SEC_10485_76
+};
+
+static const TP_NBIoT_Interface::T3412_units t3412_units_from_bits[] =
+{
+	TP_NBIoT_Interface::T3412_units::MIN_10,
+	TP_NBIoT_Interface::T3412_units::HR_1,
+	TP_NBIoT_Interface::T3412_units::HR_10,
+	TP_NBIoT_Interface::T3412_units::SEC_2,
+	TP_NBIoT_Interface::T3412_units::SEC_30,
+	TP_NBIoT_Interface::T3412_units::MIN_1,
+	TP_NBIoT_Interface::T3412_units::HR_320,
+	TP_NBIoT_Interface::T3412_units::DEACT
+};
+
+static const TP_NBIoT_Interface::T3324_units t3324_units_from_bits[] =
+{
+	TP_NBIoT_Interface::T3324_units::SEC_2,
+	TP_NBIoT_Interface::T3324_units::MIN_1,
+	TP_NBIoT_Interface::T3324_units::MIN_6,
+	TP_NBIoT_Interface::T3324_units::INVALID,
+	TP_NBIoT_Interface::T3324_units::INVALID,
+	TP_NBIoT_Interface::T3324_units::INVALID,
+	TP_NBIoT_Interface::T3324_units::INVALID,
+	TP_NBIoT_Interface::T3324_units::DEACT
+};
+
 
 #if BOARD == WRIGHT_V1_0_0 || BOARD == DEVELOPMENT_BOARD_V1_1_0
 	/** Constructor for the TP_NBIoT_Interface class, specifically when 
@@ -23,16 +88,31 @@
 	 * @param txu Pin connected to SaraN2 TXD (This is MCU TXU)
 	 * @param rxu Pin connected to SaraN2 RXD (This is MCU RXU)
 	 * @param cts Pin connected to SaraN2 CTS
-	 * @param rst Pin connected to SaraN2 RST
-	 * @param vint Pin conencted to SaraN2 VINT
+	 * @param rst Pin connected to SaraN2 RST, owned by hardware_reset() so
+	 *            it is not passed to the driver
+	 * @param vint Pin conencted to SaraN2 VINT, owned by the power monitor
+	 *             so it is not passed to the driver
 	 * @param gpio Pin connected to SaraN2 GPIO1
 	 * @param baud Baud rate for UART between MCU and SaraN2
 	 */  
 	TP_NBIoT_Interface::TP_NBIoT_Interface(PinName txu, PinName rxu, PinName cts, PinName rst, 
 										PinName vint, PinName gpio, int baud) :
-										_modem(txu, rxu, cts, rst, vint, gpio, baud) 
+										_modem(txu, rxu, cts, NC, NC, gpio, baud),
+										_vint(vint),
+										_rst(rst, PIN_INPUT, PullNone, 1),
+										_baud(baud) 
 	{
-		
+		for(int i = 0; i < NBIOT_COAP_PROFILES; i++)
+		{
+			_coap_slots[i].endpoint = COAP_SLOT_FREE;
+			_coap_slots[i].last_used = 0;
+		}
+
+		_modem.attach_nsonmi(callback(this, &TP_NBIoT_Interface::nsonmi_handler));
+		_modem.attach_cscon(callback(this, &TP_NBIoT_Interface::cscon_handler));
+		_modem.attach_cereg(callback(this, &TP_NBIoT_Interface::cereg_handler));
+		_modem.attach_npsmr(callback(this, &TP_NBIoT_Interface::npsmr_handler));
+		_modem.attach_cereg_timers(callback(this, &TP_NBIoT_Interface::cereg_timers_handler));
 	}
 #endif /* #if BOARD == ... */
 
@@ -40,9 +120,60 @@
  */
 TP_NBIoT_Interface::~TP_NBIoT_Interface()
 {
-	#if _COMMS_NBIOT_DRIVER == COMMS_DRIVER_SARAN2
-    	_modem.~SaraN2();
-    #endif /* #if _COMMS_NBIOT_DRIVER == COMMS_DRIVER_SARAN2 */
+	/** _modem is a member, so it is destroyed automatically after this body
+	 *  runs. Calling its destructor here as well would destroy it twice
+	 */
+}
+
+/** Run a modem operation under the current retry policy. Failures that
+ *  is_retryable() classifies as transient are retried after a jittered,
+ *  exponentially increasing delay. Operations that must not be repeated,
+ *  such as a POST, are attempted once but still counted
+ *
+ * @param call Category under which to record attempts and failures
+ * @param operation Callable returning a driver status code
+ * @param idempotent False if repeating the operation could duplicate
+ *                   its effect at the far end
+ * @return Status of the last attempt
+ */
+template <typename F>
+int TP_NBIoT_Interface::retry(TP_Modem_Call call, F operation, bool idempotent)
+{
+	TP_Retry_Stats &stats = _retry_stats[(int)call];
+	uint8_t max_attempts = idempotent ? _retry_policy.max_attempts : 1;
+	uint32_t delay_ms = _retry_policy.base_delay_ms;
+
+	stats.calls++;
+
+	int status = -1;
+
+	for(uint8_t attempt = 1; ; attempt++)
+	{
+		status = operation();
+		if(status == TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		if(attempt >= max_attempts || !is_retryable(status))
+		{
+			stats.failures++;
+			return status;
+		}
+
+		stats.retries++;
+
+		/** Sleep somewhere between half and all of the current backoff so that
+		 *  retries from devices that failed together don't stay in step
+		 */
+		sleep_ms(delay_ms / 2 + next_random() % (delay_ms / 2 + 1));
+
+		delay_ms = delay_ms * 2;
+		if(delay_ms > _retry_policy.max_delay_ms)
+		{
+			delay_ms = _retry_policy.max_delay_ms;
+		}
+	}
 }
 
 /** Determine when the modem is ready to recieve AT commands
@@ -57,8 +188,29 @@ int TP_NBIoT_Interface::ready(uint8_t timeout_s)
 
     if(_driver == TP_NBIoT_Interface::SARAN2)
     {
-        time_t start_time = time(NULL);
+        uint64_t start_time = now_ms();
+
+        if(_power_monitor && !_vint_level)
+        {
+            /** Activity on RXD wakes the module from deep sleep, so send a 
+             *  single probe and then wait for VINT instead of repeating it
+             */
+            _modem.at();
 
+            while(!_vint_level)
+            {
+                if(now_ms() >= start_time + (uint64_t)timeout_s * 1000)
+                {
+                    return TP_NBIoT_Interface::FAIL_TO_CONNECT;
+                }
+
+                sleep_ms(NBIOT_VINT_POLL_MS);
+            }
+        }
+
+        /** The probes below are not run under the retry policy, since this
+         *  loop is itself the retry, bounded by timeout_s
+         */
         while(true)
         {
             status = _modem.at();
@@ -68,458 +220,823 @@ int TP_NBIoT_Interface::ready(uint8_t timeout_s)
                 return TP_NBIoT_Interface::NBIOT_OK;
             }
 
-            time_t current_time = time(NULL);
-            if(current_time >= start_time + timeout_s)
+            uint64_t current_time = now_ms();
+            if(current_time >= start_time + (uint64_t)timeout_s * 1000)
 			{
 				return TP_NBIoT_Interface::FAIL_TO_CONNECT;
 			}
 
-			ThisThread::sleep_for(500);
+			sleep_ms(500);
         }
     }
 
     return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Initialise the modem with default parameters:
- *  AUTOCONNECT = TRUE
- *  CELL_RESELECTION = TRUE
- *  SIM_PSM = TRUE
- *  MODULE_PSM = TRUE
- * 
- *  Then attempt to connect to a network for 5 minutes; if this is 
- *  unsuccessful then turn off the modem and report that status
- *  back to the application. If it is successful then the modem 
- *  may not necessarily enter PSM instantly - this is determined by
- *  T3324/T3412 timer settings
+/** Switch the modem and MCU UART to the fastest baud rate that
+ *  passes an AT probe, starting at 460800 and working down. The
+ *  chosen rate is stored in the modem so it survives a reboot.
+ *  If no faster rate is stable both ends are reverted to the
+ *  rate in use before the call
  *
- * @param timeout_s Timeout period in seconds 
- * @return Inidicates success or failure reason
+ * @param &baud Address of integer in which to store the baud rate
+ *              in use after negotiation
+ * @param &bytes_per_s Address of uint32_t in which to store the UART 
+ *                     throughput measured at that rate, see 
+ *                     measure_link_throughput()
+ * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::start(uint16_t timeout_s)
+int TP_NBIoT_Interface::negotiate_baud_rate(int &baud, uint32_t &bytes_per_s)
 {
+	static const int rates[] = { 460800, 230400, 115200 };
+
 	int status = -1;
+
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = enable_autoconnect();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		for(size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
 		{
-            debug("\r\nLine %d, status %d",__LINE__,status);
-			return status;
-		}
-
-		status = enable_cell_reselection();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-            status = enable_cell_reselection();
-            if(status != TP_NBIoT_Interface::NBIOT_OK)
-		    {
-                debug("\r\nLine %d, status %d",__LINE__,status);
-                return status;
-            }
-		}
-
-		status = enable_sim_power_save_mode();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-            debug("\r\nLine %d, status %d",__LINE__,status);
-			return status;
-		}
+			if(rates[i] <= _baud)
+			{
+				break;
+			}
 
-		status = enable_power_save_mode();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-            debug("\r\nLine %d, status %d",__LINE__,status);
-			return status;
-		}
+			/** The modem acknowledges at the old rate and then switches. If it
+			 *  doesn't see a valid command at the new rate within the timeout
+			 *  it falls back to the old rate by itself. This probe is sent once,
+			 *  without the retry policy: after a lost response the modem may
+			 *  already be on the new rate, so a repeat at the old one would
+			 *  only be garbled, and a refused rate moves on to the next
+			 */
+			status = _modem.natspeed(rates[i], NBIOT_BAUD_REVERT_TIMEOUT_S, false);
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				continue;
+			}
 
-		status = reboot_modem();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-            debug("\r\nLine %d, status %d",__LINE__,status);
-			return status;
-		}
+			/** set_baud() only reconfigures the MCU serial port and sends
+			 *  nothing to the modem
+			 */
+			_modem.set_baud(rates[i]);
 
-		TP_Connection_Status conn_status;
-		int connected = 0;
-		int registered = 0;
-		int psm = 0;
-		status = get_module_network_status(conn_status, connected, registered, psm);
-		time_t start_time = time(NULL);
+			status = ready(1);
+			if(status == TP_NBIoT_Interface::NBIOT_OK)
+			{
+				status = measure_link_throughput(bytes_per_s);
+			}
 
-		/** Attempt to connect and register to the network for 5 minutes. If we fail
-		 *  then turn off the radio to conserve power and let the application decide 
-		 *  what to do
-		 */
-		while(true)
-		{
-            status = get_module_network_status(conn_status, connected, registered, psm);
-            if (conn_status == TP_Connection_Status::ACTIVE_REGISTERED_RRC_CONNECTED ||
-		        conn_status == TP_Connection_Status::ACTIVE_REGISTERED_RRC_RELEASED ||
-			    conn_status == TP_Connection_Status::PSM_REGISTERED)
-              {  
-                  break;
-              }
-            debug("\r\nconn_status %d, connected %d, registered %d, psm %d",conn_status, connected, registered, psm);
-			time_t current_time = time(NULL);
-			if(current_time >= start_time + timeout_s)
+			if(status == TP_NBIoT_Interface::NBIOT_OK)
 			{
-				status = deactivate_radio();
-				if(status != TP_NBIoT_Interface::NBIOT_OK)
+				status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
 				{
-					return status;
-				}
-
-				return TP_NBIoT_Interface::FAIL_TO_CONNECT;
+					return _modem.natspeed(rates[i], NBIOT_BAUD_REVERT_TIMEOUT_S, true);
+				});
 			}
 
-			ThisThread::sleep_for(2500);
-		}
-
-		return TP_NBIoT_Interface::NBIOT_OK;
-	}
+			if(status == TP_NBIoT_Interface::NBIOT_OK)
+			{
+				_baud = rates[i];
+				baud = _baud;
+				return TP_NBIoT_Interface::NBIOT_OK;
+			}
 
-	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
-}
+			/** Put the MCU back on the old rate and wait for the modem to do
+			 *  the same before trying the next candidate
+			 */
+			_modem.set_baud(_baud);
+			sleep_ms((NBIOT_BAUD_REVERT_TIMEOUT_S + 1) * 1000);
 
-/** Power-cycle the NB-IoT modem
- * 
- * @return Indicates success or failure reason
- */
-int TP_NBIoT_Interface::reboot_modem()
-{
-	int status = -1;
+			status = ready();
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				return status;
+			}
+		}
 
-	if(_driver == TP_NBIoT_Interface::SARAN2)
-	{
-		status = _modem.reboot_module();
+		status = measure_link_throughput(bytes_per_s);
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		baud = _baud;
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Is the modem TX/RX circuitry turned on or off? 1 is on, 0 is off
- * 
- * @param &status Address of integer value to which to return the status
- *                value of the radio
+/** Enable or disable hardware flow control on the modem UART. The 
+ *  modem holds CTS to pause the MCU when its receive buffer fills,
+ *  which prevents overruns at high baud rates and lets block uploads
+ *  stream without pacing delays. The MCU serial port belongs to the
+ *  driver, so its set_flow_control() must switch both ends: AT+IFC
+ *  on the modem and the CTS input passed to the constructor on the 
+ *  MCU UART. A driver that only configures the modem leaves the MCU
+ *  ignoring CTS, and unpaced uploads can then overrun the modem
+ *
+ * @param enable True to enable CTS flow control, false to disable it
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::get_radio_status(int &radio_status)
+int TP_NBIoT_Interface::set_flow_control(bool enable)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.get_radio_status(radio_status);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.set_flow_control(enable);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		_flow_control = enable;
+
 		return TP_NBIoT_Interface::NBIOT_OK;
-	}	
+	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable TX and RX RF circuits
- * 
+/** Read back the flow control setting from the modem, i.e. to verify
+ *  that it took effect or survived a reboot
+ *
+ * @param &enabled Address of bool in which to store the setting
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::deactivate_radio()
+int TP_NBIoT_Interface::get_flow_control(bool &enabled)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.deactivate_radio();
+		status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.get_flow_control(enabled);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		/** Don't stream unpaced uploads if the modem has lost the setting
+		 */
+		_flow_control = enabled;
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable TX and RX RF circuits
+/** Initialise the modem with default parameters:
+ *  AUTOCONNECT = TRUE
+ *  CELL_RESELECTION = TRUE
+ *  SIM_PSM = TRUE
+ *  MODULE_PSM = TRUE
  * 
- * @return Indicates success or failure reason
+ *  Then attempt to connect to a network for 5 minutes; if this is 
+ *  unsuccessful then turn off the modem and report that status
+ *  back to the application. If it is successful then the modem 
+ *  may not necessarily enter PSM instantly - this is determined by
+ *  T3324/T3412 timer settings
+ *
+ * @param timeout_s Timeout period in seconds 
+ * @return Inidicates success or failure reason
  */
-int TP_NBIoT_Interface::activate_radio()
+int TP_NBIoT_Interface::start(uint16_t timeout_s)
 {
-	int status = -1;
+	_start_profile = {};
+	_start_ms = now_ms();
 
-	if(_driver == TP_NBIoT_Interface::SARAN2)
+	int status = run_start(timeout_s);
+
+	_start_profile.total_ms = (uint32_t)(now_ms() - _start_ms);
+	_start_profile.status = status;
+
+	_start_histogram.starts++;
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
 	{
-		status = _modem.activate_radio();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		_start_histogram.failures++;
+	}
+
+	for(int phase = 0; phase < (int)TP_Start_Phase::COUNT; phase++)
+	{
+		if(!(_start_profile.reached & (1 << phase)))
 		{
-			return status;
+			continue;
 		}
 
-		return TP_NBIoT_Interface::NBIOT_OK;
+		int bucket = 0;
+		for(uint32_t s = _start_profile.duration_ms[phase] / 1000; s > 0; s >>= 1)
+		{
+			bucket++;
+		}
+		if(bucket >= NBIOT_START_HISTOGRAM_BUCKETS)
+		{
+			bucket = NBIOT_START_HISTOGRAM_BUCKETS - 1;
+		}
+
+		if(_start_histogram.buckets[phase][bucket] < UINT16_MAX)
+		{
+			_start_histogram.buckets[phase][bucket]++;
+		}
 	}
 
-	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+	return status;
 }
 
-/** Attempt to attach to network GPRS service
+/** Retrieve the phase breakdown of the most recent call to start()
  *
- * @return Indicates success or failure reason
+ * @param &profile Address of TP_Start_Profile in which to store the breakdown
+ * @return None
  */
-int TP_NBIoT_Interface::gprs_attach()
+void TP_NBIoT_Interface::get_start_profile(TP_Start_Profile &profile)
 {
-	int status = -1;
+	profile = _start_profile;
+}
 
-	if(_driver == TP_NBIoT_Interface::SARAN2)
-	{
-		status = _modem.gprs_attach();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+/** Retrieve the phase duration histograms accumulated over every call
+ *  to start()
+ *
+ * @param &histogram Address of TP_Start_Histogram in which to store the 
+ *                   histograms
+ * @return None
+ */
+void TP_NBIoT_Interface::get_start_histogram(TP_Start_Histogram &histogram)
+{
+	histogram = _start_histogram;
+}
 
-		return TP_NBIoT_Interface::NBIOT_OK;
-	}
+/** Empty the phase duration histograms, i.e. once they have been 
+ *  uploaded
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::clear_start_histogram()
+{
+	_start_histogram = {};
+}
 
-	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+/** Save the interface state that outlives MCU deep sleep, i.e. into
+ *  backup RAM before entering standby, so that the next boot can 
+ *  call resume() instead of start()
+ *
+ * @param &record Address of TP_Resume_Record in which to store the state
+ * @return None
+ */
+void TP_NBIoT_Interface::save_resume(TP_Resume_Record &record)
+{
+	record = {};
+	record.magic = NBIOT_RESUME_MAGIC;
+	record.version = NBIOT_RESUME_VERSION;
+	record.length = sizeof(TP_Resume_Record);
+	record.baud = _baud;
+	record.coap_token = _coap_token;
+	record.coap_message_id = _coap_message_id;
+	record.flow_control = _flow_control ? 1 : 0;
+	record.psm_timers_valid = (_psm_timers_requested_valid ? 1 : 0) | (_psm_timers_granted_valid ? 2 : 0);
+	memcpy(record.coap_profile_hash, _coap_profile_hash, sizeof(record.coap_profile_hash));
+	record.psm_timers = _psm_timers;
+	record.check = crc32((const uint8_t*)&record, offsetof(TP_Resume_Record, check));
 }
 
-/** Attempt to detach from network GPRS service
+/** Restore the state saved by save_resume() on a newly constructed
+ *  interface and check, with a single AT+CEREG? query, that the modem
+ *  is still registered. Nothing is written to the modem's NVM and the
+ *  modem is not rebooted. CoAP endpoints must be registered again, in
+ *  any order; each is placed in the free profile already holding its
+ *  settings, if there is one, so that it isn't rewritten
  *
- * @return Indicates success or failure reason
+ * @param &record State saved by save_resume()
+ * @return Indicates success or failure reason, INVALID_RESUME_RECORD 
+ *         if the record is corrupt or from another version, and 
+ *         FAIL_TO_CONNECT if the modem is no longer registered, in
+ *         which case start() is needed
  */
-int TP_NBIoT_Interface::gprs_detach()
+int TP_NBIoT_Interface::resume(const TP_Resume_Record &record)
 {
+	if(record.magic != NBIOT_RESUME_MAGIC || record.version != NBIOT_RESUME_VERSION || 
+	   record.length != sizeof(TP_Resume_Record) ||
+	   record.check != crc32((const uint8_t*)&record, offsetof(TP_Resume_Record, check)))
+	{
+		return TP_NBIoT_Interface::INVALID_RESUME_RECORD;
+	}
+
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.gprs_detach();
+		/** The modem keeps a negotiated baud rate across sleep, so only the
+		 *  MCU end needs to follow
+		 */
+		if(record.baud != _baud)
+		{
+			_modem.set_baud(record.baud);
+			_baud = record.baud;
+		}
+
+		_flow_control = record.flow_control != 0;
+		_coap_token = record.coap_token;
+		_coap_message_id = record.coap_message_id;
+		memcpy(_coap_profile_hash, record.coap_profile_hash, sizeof(_coap_profile_hash));
+
+		_psm_timers = record.psm_timers;
+		_psm_timers_requested_valid = (record.psm_timers_valid & 1) != 0;
+		_psm_timers_granted_valid = (record.psm_timers_valid & 2) != 0;
+		if(_psm_timers_granted_valid)
+		{
+			_t3412_s = _psm_timers.granted_tau_s;
+			_t3324_s = _psm_timers.granted_active_s;
+		}
+
+		/** Waking the modem from PSM can cost the first command, which the
+		 *  retry policy absorbs
+		 */
+		int urc;
+		int registered;
+		status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.cereg(urc, registered);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		write_cached_state(_registered_state, registered);
+
+		if(registered != 1 && registered != 5)
+		{
+			return TP_NBIoT_Interface::FAIL_TO_CONNECT;
+		}
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Attempt to automatically register to network
- *  using SIM card home PLMN
+/** The configuration, reboot and registration sequence of start(),
+ *  marking each phase in _start_profile as it is reached
  *
+ * @param timeout_s Timeout period in seconds
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::auto_register_to_network()
+int TP_NBIoT_Interface::run_start(uint16_t timeout_s)
 {
 	int status = -1;
-
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.auto_register_to_network();
+		status = enable_autoconnect();
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
+            debug("\r\nLine %d, status %d",__LINE__,status);
 			return status;
 		}
 
-		return TP_NBIoT_Interface::NBIOT_OK;
-	}
+		status = enable_cell_reselection();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+            debug("\r\nLine %d, status %d",__LINE__,status);
+			return status;
+		}
+
+		status = enable_sim_power_save_mode();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+            debug("\r\nLine %d, status %d",__LINE__,status);
+			return status;
+		}
+
+		status = enable_power_save_mode();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+            debug("\r\nLine %d, status %d",__LINE__,status);
+			return status;
+		}
+
+		mark_start_phase(TP_Start_Phase::CONFIGURED);
+
+		status = reboot_modem();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+            debug("\r\nLine %d, status %d",__LINE__,status);
+			return status;
+		}
+
+		mark_start_phase(TP_Start_Phase::REBOOTED);
+
+		status = ready();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+            debug("\r\nLine %d, status %d",__LINE__,status);
+			return status;
+		}
+
+		mark_start_phase(TP_Start_Phase::AT_READY);
+
+		seed_random_from_imei();
+
+		TP_Connection_Status conn_status;
+		int connected = 0;
+		int registered = 0;
+		int psm = 0;
+		status = get_module_network_status(conn_status, connected, registered, psm, true);
+		uint64_t start_time = now_ms();
+
+		/** Attempt to connect and register to the network for 5 minutes. If we fail
+		 *  then turn off the radio to conserve power and let the application decide 
+		 *  what to do
+		 */
+		while(true)
+		{
+            status = get_module_network_status(conn_status, connected, registered, psm, true);
+            if(conn_status == TP_Connection_Status::ACTIVE_SCANNING_FOR_BASE_STATION)
+            {
+                mark_start_phase(TP_Start_Phase::SCANNING);
+            }
+            else if(conn_status == TP_Connection_Status::ACTIVE_STARTING_REGISTRATION)
+            {
+                mark_start_phase(TP_Start_Phase::REGISTERING);
+            }
+            if (conn_status == TP_Connection_Status::ACTIVE_REGISTERED_RRC_CONNECTED ||
+		        conn_status == TP_Connection_Status::ACTIVE_REGISTERED_RRC_RELEASED ||
+			    conn_status == TP_Connection_Status::PSM_REGISTERED)
+              {  
+                  mark_start_phase(TP_Start_Phase::REGISTERED);
+                  break;
+              }
+            debug("\r\nconn_status %d, connected %d, registered %d, psm %d",conn_status, connected, registered, psm);
+			uint64_t current_time = now_ms();
+			if(current_time >= start_time + (uint64_t)timeout_s * 1000)
+			{
+				status = deactivate_radio();
+				if(status != TP_NBIoT_Interface::NBIOT_OK)
+				{
+					return status;
+				}
+
+				return TP_NBIoT_Interface::FAIL_TO_CONNECT;
+			}
+
+			sleep_ms(NBIOT_START_POLL_MS);
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Deregister from network
+/** Record that start() has reached a phase, unless it already has
+ *
+ * @param phase Phase reached
+ * @return None
+ */
+void TP_NBIoT_Interface::mark_start_phase(TP_Start_Phase phase)
+{
+	uint8_t bit = (uint8_t)(1 << (int)phase);
+	if(_start_profile.reached & bit)
+	{
+		return;
+	}
+
+	uint32_t at_ms = (uint32_t)(now_ms() - _start_ms);
+
+	/** Measure from the latest phase already reached, so a phase skipped
+	 *  between polls is folded into the next one
+	 */
+	uint32_t previous_ms = 0;
+	for(int i = 0; i < (int)phase; i++)
+	{
+		if(_start_profile.reached & (1 << i))
+		{
+			previous_ms = _start_profile.at_ms[i];
+		}
+	}
+
+	_start_profile.at_ms[(int)phase] = at_ms;
+	_start_profile.duration_ms[(int)phase] = at_ms - previous_ms;
+	_start_profile.reached |= bit;
+}
+
+/** Power-cycle the NB-IoT modem. Sockets are dropped as described
+ *  for recover()
  * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::deregister_from_network()
+int TP_NBIoT_Interface::reboot_modem()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.deregister_from_network();
+		/** Nothing observed before a reboot, successful or not, can be trusted
+		 */
+		invalidate_status_cache();
+
+		status = retry(TP_Modem_Call::REBOOT, [&]()
+		{
+			return _modem.reboot_module();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		drop_socket_state();
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable entire module Power Save Mode (PSM)
+/** Reset the modem by pulling its RESET_N pin low. Works when the
+ *  modem no longer answers AT commands, unlike reboot_modem(). 
+ *  Sockets are dropped as described for recover()
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::hardware_reset()
+{
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		invalidate_status_cache();
+
+		/** RESET_N has an internal pull-up, so it is only ever driven low
+		 *  and released again rather than driven high
+		 */
+		_rst.mode(OpenDrain);
+		_rst.output();
+		_rst.write(0);
+		sleep_ms(NBIOT_RESET_PULSE_MS);
+		_rst.write(1);
+		_rst.input();
+
+		drop_socket_state();
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Bring an unresponsive modem back, escalating through an AT probe, 
+ *  a soft reboot, a hardware reset and finally the power-cycle hook 
+ *  until it answers AT. Each tier waits a bounded time. URC settings
+ *  made with enable_status_urcs() don't survive a reboot and must be
+ *  reapplied if the tier used was SOFT_REBOOT or above. The modem 
+ *  also closes its sockets then, so downlink_listen() settings, 
+ *  Observe registrations and NON streams are dropped and sockets
+ *  must be reopened with udp_open()
+ *
+ * @param &tier Address of TP_Recovery_Tier in which to store the tier
+ *              that recovered the modem, or the last one tried
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::recover(TP_Recovery_Tier &tier)
+{
+	static const uint8_t tier_timeout_s[(int)TP_Recovery_Tier::COUNT] =
+	{
+		NBIOT_RECOVERY_PROBE_S, NBIOT_RECOVERY_REBOOT_S, NBIOT_RECOVERY_RESET_S, NBIOT_RECOVERY_POWER_S
+	};
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		uint64_t start_time = now_ms();
+
+		for(int i = 0; i < (int)TP_Recovery_Tier::COUNT; i++)
+		{
+			/** Without a hook the power-cycle tier isn't tried, so it mustn't be
+			 *  reported as the last tier either
+			 */
+			if((TP_Recovery_Tier)i == TP_Recovery_Tier::POWER_CYCLE && !_power_cycle)
+			{
+				continue;
+			}
+
+			tier = (TP_Recovery_Tier)i;
+			int tier_status = TP_NBIoT_Interface::NBIOT_OK;
+
+			switch(tier)
+			{
+				case TP_Recovery_Tier::SOFT_REBOOT:
+					/** A single attempt, without the retry policy, since a wedged
+					 *  modem will not answer and the next tier doesn't need it to
+					 */
+					invalidate_status_cache();
+					_modem.reboot_module();
+					break;
+
+				case TP_Recovery_Tier::HARDWARE_RESET:
+					hardware_reset();
+					break;
+
+				case TP_Recovery_Tier::POWER_CYCLE:
+					invalidate_status_cache();
+					tier_status = _power_cycle();
+					break;
+
+				default:
+					break;
+			}
+
+			if(tier_status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				continue;
+			}
+
+			if(ready(tier_timeout_s[i]) == TP_NBIoT_Interface::NBIOT_OK)
+			{
+				uint32_t elapsed_ms = (uint32_t)(now_ms() - start_time);
+
+				if(tier != TP_Recovery_Tier::AT_PROBE)
+				{
+					drop_socket_state();
+				}
+
+				_recovery_stats.recovered[i]++;
+				_recovery_stats.last_ms = elapsed_ms;
+				_recovery_stats.total_ms += elapsed_ms;
+				if(elapsed_ms > _recovery_stats.max_ms)
+				{
+					_recovery_stats.max_ms = elapsed_ms;
+				}
+
+				return TP_NBIoT_Interface::NBIOT_OK;
+			}
+		}
+
+		_recovery_stats.failures++;
+
+		return TP_NBIoT_Interface::FAIL_TO_CONNECT;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Register a function that removes and restores power to the modem,
+ *  used as the last recovery tier. Without one that tier is skipped
+ *
+ * @param hook Function performing the power cycle and returning its status
+ * @return None
+ */
+void TP_NBIoT_Interface::attach_power_cycle(Callback<int()> hook)
+{
+	_power_cycle = hook;
+}
+
+/** Retrieve the recovery counters and timings
+ *
+ * @param &stats Address of TP_Recovery_Stats in which to store the counters
+ * @return None
+ */
+void TP_NBIoT_Interface::get_recovery_stats(TP_Recovery_Stats &stats)
+{
+	stats = _recovery_stats;
+}
+
+/** Is the modem TX/RX circuitry turned on or off? 1 is on, 0 is off
  * 
+ * @param &status Address of integer value to which to return the status
+ *                value of the radio
+ * @param force_refresh Query the modem even if the cached value is fresh
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_power_save_mode()
+int TP_NBIoT_Interface::get_radio_status(int &radio_status, bool force_refresh)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.enable_power_save_mode();
+		if(!force_refresh && read_cached_state(_radio_state, radio_status))
+		{
+			return TP_NBIoT_Interface::NBIOT_OK;
+		}
+
+		status = retry(TP_Modem_Call::RADIO, [&]()
+		{
+			return _modem.get_radio_status(radio_status);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		write_cached_state(_radio_state, radio_status);
+
 		return TP_NBIoT_Interface::NBIOT_OK;
-	}
+	}	
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable entire module Power Save Mode (PSM)
+/** Disable TX and RX RF circuits
  * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_power_save_mode()
+int TP_NBIoT_Interface::deactivate_radio()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.disable_power_save_mode();
+		status = retry(TP_Modem_Call::RADIO, [&]()
+		{
+			return _modem.deactivate_radio();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		write_cached_state(_radio_state, 0);
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Query whether or not Power Save Mode (PSM) is enabled
- *  
- * @param &power_save_mode Address of integer in which to store
- *                         value of power save mode setting. 1 
- *                         means that PSM is enabled, 0 means 
- *                         that PSM is disabled
+/** Enable TX and RX RF circuits
+ * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::query_power_save_mode(int &power_save_mode)
+int TP_NBIoT_Interface::activate_radio()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.query_power_save_mode(power_save_mode);
+		status = retry(TP_Modem_Call::RADIO, [&]()
+		{
+			return _modem.activate_radio();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		write_cached_state(_radio_state, 1);
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Determine whether or not the modem is in power save mode or not
- * 
- * @param &psm Address of integer in which to store actual PSM value,
- *             1 = in PSM, 0 = active
+/** Attempt to attach to network GPRS service
+ *
  * @return Indicates success or failure reason
- */ 
-int TP_NBIoT_Interface::get_power_save_mode_status(int &psm)
+ */
+int TP_NBIoT_Interface::gprs_attach()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.npsmr(psm);
+		status = retry(TP_Modem_Call::REGISTRATION, [&]()
+		{
+			return _modem.gprs_attach();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		_registered_state.valid = false;
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Return u-blox defined connection status based on radio connection status, 
- *  network registration status and PSM status. This document can be found in 8.4
- *  at https://www.u-blox.com/sites/default/files/SARA-N2-Application-Development_AppNote_%28UBX-16017368%29.pdf
- * 
- * @param &status Address of TP_Connection_Status to return u-blox defined connection
- *                status to
- * @param &connected Address of integer value in which to store radio connection status
- *                   where 1 = connected and 0 is not connected
- * @param &registered Address of integer value in which to store network registration
- *                    status. See AT+CEREG=0/AT+CEREG? for possible values
- * @param &psm Address of integer value in which to store PSM status where 1 = in PSM
- *             and 0 is in Active mode
+/** Attempt to detach from network GPRS service
+ *
  * @return Indicates success or failure reason
- */ 
-int TP_NBIoT_Interface::get_module_network_status(TP_Connection_Status &status, int &connected, 
-                                                  int &registered, int &psm)
+ */
+int TP_NBIoT_Interface::gprs_detach()
 {
-	int func_status = -1;
+	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		func_status = get_connection_status(connected, registered);
-		if(func_status != TP_NBIoT_Interface::NBIOT_OK)
+		status = retry(TP_Modem_Call::REGISTRATION, [&]()
 		{
-			return func_status;
-		}
-
-		func_status = get_power_save_mode_status(psm);
-		if(func_status != TP_NBIoT_Interface::NBIOT_OK)
+			return _modem.gprs_detach();
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
-			return func_status;
+			return status;
 		}
 
-		if(registered == 0 && connected == 0 && psm == 0)
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_NO_NETWORK_ACTIVITY;
-		}
-		else if(registered == 2 && connected == 0 && psm == 0)
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_SCANNING_FOR_BASE_STATION;
-		}
-		else if(registered == 2 && connected == 1 && psm == 0)
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_STARTING_REGISTRATION;
-		}
-		else if((registered == 1 || registered == 5) && (connected == 1 && psm == 0))
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_REGISTERED_RRC_CONNECTED;
-		}
-		else if((registered == 1 || registered == 5) && (connected == 0 && psm == 0))
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_REGISTERED_RRC_RELEASED;
-		}
-		else if((registered == 1 || registered == 5) && (connected == 0 && psm == 1))
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::PSM_REGISTERED;
-		}
-		else if(registered == 3)
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::REGISTRATION_FAILED;
-		}
-		else
-		{
-			status = TP_NBIoT_Interface::TP_Connection_Status::STATE_UNDEFINED;
-		}
+		_registered_state.valid = false;
 
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
@@ -527,99 +1044,27 @@ int TP_NBIoT_Interface::get_module_network_status(TP_Connection_Status &status,
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Query UE for radio connection and network registration status
- * 
- * @param &connected Address of integer in which to store radio 
- *                   connection status
- * @param &reg_status Address of integer in which to store
- *                    network registration status
+/** Attempt to automatically register to network
+ *  using SIM card home PLMN
+ *
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::get_connection_status(int &connected, int &reg_status)
+int TP_NBIoT_Interface::auto_register_to_network()
 {
-    int status = -1;
-
-    if(_driver == TP_NBIoT_Interface::SARAN2)
-    {
-        int urc;
-
-        status = _modem.cscon(urc, connected);
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
-
-        status = _modem.cereg(urc, reg_status);
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
-
-        return TP_NBIoT_Interface::NBIOT_OK;
-    }
-
-    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
-}
-
-
-/** Get last known RSRP and RSRQ
- * 
- * @param &power Address of integer in which to return
- *               last known RSRP
- * @param &quality Address of integer in which to return
- *                 last known RSRQ
- * @return Indicates success or failure reason
- */
-int TP_NBIoT_Interface::get_csq(int &power, int &quality)
-{
-    int status = -1;
-
-    if(_driver == TP_NBIoT_Interface::SARAN2)
-    {
-        status = _modem.csq(power, quality);
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
-
-        return TP_NBIoT_Interface::NBIOT_OK;
-    }
-
-    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
-}
-
-/** Return LTE channel number, EARFCN
- * 
- * @param &band Address of TP_NBIoT_Band value in which to store
- *              determined EARFCN
- * @return Indicates success or failure reason
- */
-int TP_NBIoT_Interface::get_band(TP_NBIoT_Band &band)
-{
-	int status = -1;
+	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		SaraN2::Nuestats_t stats;
-
-		status = get_nuestats(stats.data);
+		status = retry(TP_Modem_Call::REGISTRATION, [&]()
+		{
+			return _modem.auto_register_to_network();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
-		if(stats.parameters.earfcn >= EARFCN_B8_LOW && stats.parameters.earfcn <= EARFCN_B8_HIGH)
-		{
-			band = TP_NBIoT_Interface::TP_NBIoT_Band::BAND_8;
-		}
-		else if(stats.parameters.earfcn >= EARFCN_B20_LOW && stats.parameters.earfcn <= EARFCN_B20_HIGH)
-		{
-			band = TP_NBIoT_Interface::TP_NBIoT_Band::BAND_20;
-		}
-		else 
-		{
-			band = TP_NBIoT_Interface::TP_NBIoT_Band::BAND_UNKNOWN;
-		}
+		_registered_state.valid = false;
 
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
@@ -627,111 +1072,105 @@ int TP_NBIoT_Interface::get_band(TP_NBIoT_Band &band)
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Return operation stats, of a given type, of the module
- * 
- * @param *data Point to .data parameter of Nuestats_t struct
- *              to copy data into
- * @return Indicates success or failure reason
- */
-int TP_NBIoT_Interface::get_nuestats(char *data)
-{
-    int status = -1;
-
-    if(_driver == TP_NBIoT_Interface::SARAN2)
-    {
-        status = _modem.nuestats(data);
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
-
-        return TP_NBIoT_Interface::NBIOT_OK;
-    }
-
-    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
-}
-
-/** Allow the platform to automatically attempt to connect to the 
- *  network after power-on or reboot. Will set AT+CFUN=1 and read
- *  the SIM PLMN. Will use APN provided by network.
+/** Deregister from network
  * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_autoconnect()
+int TP_NBIoT_Interface::deregister_from_network()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::AUTOCONNECT, SaraN2::TRUE);
+		status = retry(TP_Modem_Call::REGISTRATION, [&]()
+		{
+			return _modem.deregister_from_network();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		_registered_state.valid = false;
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable previously described autoconnect functionality
+/** Enable entire module Power Save Mode (PSM)
  * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_autoconnect()
+int TP_NBIoT_Interface::enable_power_save_mode()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::AUTOCONNECT, SaraN2::FALSE);
+		status = retry(TP_Modem_Call::POWER_SAVE_MODE, [&]()
+		{
+			return _modem.enable_power_save_mode();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		_psm_state.valid = false;
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable CR_0354_0338 scrambling. This is an operator specific 
- *  setting so please confirm with your mobile network provider
- *  if you're unsure as to what to set this to
+/** Disable entire module Power Save Mode (PSM)
  * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_scrambling()
+int TP_NBIoT_Interface::disable_power_save_mode()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::SCRAMBLING, SaraN2::TRUE);
+		status = retry(TP_Modem_Call::POWER_SAVE_MODE, [&]()
+		{
+			return _modem.disable_power_save_mode();
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		_psm_state.valid = false;
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable previously described CR_0354_0338 scrambling functionality
- * 
+/** Query whether or not Power Save Mode (PSM) is enabled
+ *  
+ * @param &power_save_mode Address of integer in which to store
+ *                         value of power save mode setting. 1 
+ *                         means that PSM is enabled, 0 means 
+ *                         that PSM is disabled
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_scrambling()
+int TP_NBIoT_Interface::query_power_save_mode(int &power_save_mode)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::SCRAMBLING, SaraN2::FALSE);
+		status = retry(TP_Modem_Call::POWER_SAVE_MODE, [&]()
+		{
+			return _modem.query_power_save_mode(power_save_mode);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -743,175 +1182,510 @@ int TP_NBIoT_Interface::disable_scrambling()
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable the scheduling of conflicted NSIB. This is an operator 
- *  specific setting so please confirm with your mobile network 
- *  provider if you're unsure as to what to set this to
+/** Determine whether or not the modem is in power save mode or not
  * 
+ * @param &psm Address of integer in which to store actual PSM value,
+ *             1 = in PSM, 0 = active
+ * @param force_refresh Query the modem even if the cached value is fresh
  * @return Indicates success or failure reason
- */
-int TP_NBIoT_Interface::enable_si_avoid()
+ */ 
+int TP_NBIoT_Interface::get_power_save_mode_status(int &psm, bool force_refresh)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::SI_AVOID, SaraN2::TRUE);
+		if(!force_refresh && _power_monitor)
+		{
+			psm = _vint_level ? 0 : 1;
+			return TP_NBIoT_Interface::NBIOT_OK;
+		}
+
+		if(!force_refresh && read_cached_state(_psm_state, psm))
+		{
+			return TP_NBIoT_Interface::NBIOT_OK;
+		}
+
+		status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.npsmr(psm);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		write_cached_state(_psm_state, psm);
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable the previously described scheduling of conflicted NSIB
+/** Return u-blox defined connection status based on radio connection status, 
+ *  network registration status and PSM status. This document can be found in 8.4
+ *  at https://www.u-blox.com/sites/default/files/SARA-N2-Application-Development_AppNote_%28UBX-16017368%29.pdf
  * 
+ * @param &status Address of TP_Connection_Status to return u-blox defined connection
+ *                status to
+ * @param &connected Address of integer value in which to store radio connection status
+ *                   where 1 = connected and 0 is not connected
+ * @param &registered Address of integer value in which to store network registration
+ *                    status. See AT+CEREG=0/AT+CEREG? for possible values
+ * @param &psm Address of integer value in which to store PSM status where 1 = in PSM
+ *             and 0 is in Active mode
+ * @param force_refresh Query the modem even if the cached values are fresh
  * @return Indicates success or failure reason
- */
-int TP_NBIoT_Interface::disable_si_avoid()
+ */ 
+int TP_NBIoT_Interface::get_module_network_status(TP_Connection_Status &status, int &connected, 
+                                                  int &registered, int &psm, bool force_refresh)
 {
-	int status = -1;
+	int func_status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::SI_AVOID, SaraN2::FALSE);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		func_status = get_connection_status(connected, registered, force_refresh);
+		if(func_status != TP_NBIoT_Interface::NBIOT_OK)
 		{
-			return status;
+			return func_status;
+		}
+
+		func_status = get_power_save_mode_status(psm, force_refresh);
+		if(func_status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return func_status;
 		}
 
+		status = classify_connection(connected, registered, psm);
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable combined EPS/IMSI network attach
+/** Query UE for radio connection and network registration status
  * 
+ * @param &connected Address of integer in which to store radio 
+ *                   connection status
+ * @param &reg_status Address of integer in which to store
+ *                    network registration status
+ * @param force_refresh Query the modem even if the cached values are fresh
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_combine_attach()
+int TP_NBIoT_Interface::get_connection_status(int &connected, int &reg_status, bool force_refresh)
 {
-	int status = -1;
+    int status = -1;
 
-	if(_driver == TP_NBIoT_Interface::SARAN2)
-	{
-		status = _modem.configure_ue(SaraN2::COMBINE_ATTACH, SaraN2::TRUE);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+    if(_driver == TP_NBIoT_Interface::SARAN2)
+    {
+        int urc;
 
-		return TP_NBIoT_Interface::NBIOT_OK;
-	}
+        /** Only query whichever of the two values has gone stale
+         */
+        if(force_refresh || !read_cached_state(_connected_state, connected))
+        {
+            status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+            {
+                return _modem.cscon(urc, connected);
+            });
+            if(status != TP_NBIoT_Interface::NBIOT_OK)
+            {
+                return status;
+            }
 
-	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+            write_cached_state(_connected_state, connected);
+        }
+
+        if(force_refresh || !read_cached_state(_registered_state, reg_status))
+        {
+            status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+            {
+                return _modem.cereg(urc, reg_status);
+            });
+            if(status != TP_NBIoT_Interface::NBIOT_OK)
+            {
+                return status;
+            }
+
+            write_cached_state(_registered_state, reg_status);
+        }
+
+        return TP_NBIoT_Interface::NBIOT_OK;
+    }
+
+    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable combined EPS/IMSI network attach
+
+/** Get last known RSRP and RSRQ
  * 
+ * @param &power Address of integer in which to return
+ *               last known RSRP
+ * @param &quality Address of integer in which to return
+ *                 last known RSRQ
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_combine_attach()
+int TP_NBIoT_Interface::get_csq(int &power, int &quality)
 {
-	int status = -1;
+    int status = -1;
 
-	if(_driver == TP_NBIoT_Interface::SARAN2)
-	{
-		status = _modem.configure_ue(SaraN2::COMBINE_ATTACH, SaraN2::FALSE);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+    if(_driver == TP_NBIoT_Interface::SARAN2)
+    {
+        status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+        {
+            return _modem.csq(power, quality);
+        });
+        if(status != TP_NBIoT_Interface::NBIOT_OK)
+        {
+            return status;
+        }
 
-		return TP_NBIoT_Interface::NBIOT_OK;
-	}
+        return TP_NBIoT_Interface::NBIOT_OK;
+    }
 
-	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable RRC cell reselection
+/** Return LTE channel number, EARFCN
  * 
+ * @param &band Address of TP_NBIoT_Band value in which to store
+ *              determined EARFCN
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_cell_reselection()
+int TP_NBIoT_Interface::get_band(TP_NBIoT_Band &band)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::CELL_RESELECTION, SaraN2::TRUE);
+		status = get_nuestats(_nuestats.data);
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
+		band = band_from_earfcn(_nuestats.parameters.earfcn);
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable RRC cell reselection
+/** Return operation stats, of a given type, of the module
  * 
+ * @param *data Point to .data parameter of Nuestats_t struct
+ *              to copy data into
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_cell_reselection()
+int TP_NBIoT_Interface::get_nuestats(char *data)
 {
-	int status = -1;
-
-	if(_driver == TP_NBIoT_Interface::SARAN2)
-	{
-		status = _modem.configure_ue(SaraN2::CELL_RESELECTION, SaraN2::FALSE);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+    int status = -1;
 
-		return TP_NBIoT_Interface::NBIOT_OK;
+    if(_driver == TP_NBIoT_Interface::SARAN2)
+    {
+        status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+        {
+            return _modem.nuestats(data);
+        });
+        if(status != TP_NBIoT_Interface::NBIOT_OK)
+        {
+            return status;
+        }
+
+        return TP_NBIoT_Interface::NBIOT_OK;
+    }
+
+    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Gather every radio and network metric in a single modem session.
+ *  Values held fresh by the status cache, the VINT monitor or earlier
+ *  timer reads cost no AT traffic; +NUESTATS supplies signal and cell
+ *  figures in place of AT+CSQ, and one AT+CEREG? read supplies both
+ *  registration and the granted PSM timers. A query that fails only 
+ *  clears its bit in valid
+ *
+ * @param &diagnostics Address of TP_Diagnostics in which to store the 
+ *                     snapshot
+ * @return Indicates success or failure reason, NBIOT_OK if any field
+ *         is valid
+ */
+int TP_NBIoT_Interface::snapshot(TP_Diagnostics &diagnostics)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		int failure = TP_NBIoT_Interface::NBIOT_OK;
+		int value;
+		int urc;
+
+		diagnostics = {};
+		diagnostics.version = NBIOT_DIAGNOSTICS_VERSION;
+
+		status = get_radio_status(value);
+		if(status == TP_NBIoT_Interface::NBIOT_OK)
+		{
+			diagnostics.radio = (uint8_t)value;
+			diagnostics.valid |= DIAG_RADIO;
+		}
+		else
+		{
+			failure = status;
+		}
+
+		/** With the RF circuits off +NUESTATS has nothing worth reading
+		 */
+		if(!(diagnostics.valid & DIAG_RADIO) || diagnostics.radio == 1)
+		{
+			status = get_nuestats(_nuestats.data);
+			if(status == TP_NBIoT_Interface::NBIOT_OK)
+			{
+				diagnostics.rsrp = (int16_t)_nuestats.parameters.signal_power;
+				diagnostics.rsrq = (int16_t)_nuestats.parameters.rsrq;
+				diagnostics.snr = (int16_t)_nuestats.parameters.snr;
+				diagnostics.total_power = (int16_t)_nuestats.parameters.total_power;
+				diagnostics.tx_power = (int16_t)_nuestats.parameters.tx_power;
+				diagnostics.tx_time_ms = (uint32_t)_nuestats.parameters.tx_time;
+				diagnostics.rx_time_ms = (uint32_t)_nuestats.parameters.rx_time;
+				diagnostics.cell_id = (uint32_t)_nuestats.parameters.cell_id;
+				diagnostics.earfcn = (uint32_t)_nuestats.parameters.earfcn;
+				diagnostics.pci = (uint16_t)_nuestats.parameters.pci;
+				diagnostics.ecl = (uint8_t)_nuestats.parameters.ecl;
+				diagnostics.band = (uint8_t)band_from_earfcn(_nuestats.parameters.earfcn);
+				diagnostics.valid |= DIAG_UE_STATS;
+			}
+			else
+			{
+				failure = status;
+			}
+		}
+
+		bool fresh = read_cached_state(_connected_state, value);
+		if(!fresh)
+		{
+			status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+			{
+				return _modem.cscon(urc, value);
+			});
+			if(status == TP_NBIoT_Interface::NBIOT_OK)
+			{
+				write_cached_state(_connected_state, value);
+				fresh = true;
+			}
+			else
+			{
+				failure = status;
+			}
+		}
+		if(fresh)
+		{
+			diagnostics.connected = (uint8_t)value;
+			diagnostics.valid |= DIAG_CONNECTED;
+		}
+
+		/** A CEREG mode 4 read carries the granted timers alongside the
+		 *  registration status, so one transaction answers both
+		 */
+		fresh = read_cached_state(_registered_state, value);
+		if(!fresh || !_psm_timers_granted_valid)
+		{
+			char active_time[10];
+			char periodic_tau[10];
+
+			status = retry(TP_Modem_Call::TIMER, [&]()
+			{
+				return _modem.cereg_timers(value, active_time, periodic_tau);
+			});
+			if(status == TP_NBIoT_Interface::NBIOT_OK)
+			{
+				write_cached_state(_registered_state, value);
+				fresh = true;
+				status = store_granted_timers(active_time, periodic_tau);
+			}
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				failure = status;
+			}
+		}
+		if(fresh)
+		{
+			diagnostics.registered = (uint8_t)value;
+			diagnostics.valid |= DIAG_REGISTERED;
+		}
+		if(_psm_timers_granted_valid)
+		{
+			diagnostics.granted_tau_s = _psm_timers.granted_tau_s;
+			diagnostics.granted_active_s = _psm_timers.granted_active_s;
+			diagnostics.valid |= DIAG_GRANTED_TIMERS;
+		}
+
+		status = get_power_save_mode_status(value);
+		if(status == TP_NBIoT_Interface::NBIOT_OK)
+		{
+			diagnostics.psm = (uint8_t)value;
+			diagnostics.valid |= DIAG_PSM;
+		}
+		else
+		{
+			failure = status;
+		}
+
+		/** The requested timers only change through set_tau_timer() and 
+		 *  set_active_time(), so a previous read is still good
+		 */
+		if(!_psm_timers_requested_valid)
+		{
+			status = read_requested_timers();
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				failure = status;
+			}
+		}
+		if(_psm_timers_requested_valid)
+		{
+			diagnostics.requested_tau_s = _psm_timers.requested_tau_s;
+			diagnostics.requested_active_s = _psm_timers.requested_active_s;
+			diagnostics.valid |= DIAG_REQUESTED_TIMERS;
+		}
+
+		uint32_t status_inputs = DIAG_CONNECTED | DIAG_REGISTERED | DIAG_PSM;
+		if((diagnostics.valid & status_inputs) == status_inputs)
+		{
+			diagnostics.connection_status = (uint8_t)classify_connection(diagnostics.connected, 
+																		 diagnostics.registered, diagnostics.psm);
+			diagnostics.valid |= DIAG_CONNECTION_STATUS;
+		}
+
+		return (diagnostics.valid != 0) ? TP_NBIoT_Interface::NBIOT_OK : failure;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Enable Bearer Independent Protocol (BIP) where BIP is the interface
- *  between the SIM and the ME which provides access to the data bearers
- *  supported by the ME
- * 
+/** Take one radio metric sample from +NUESTATS, which reports RSRP
+ *  and RSRQ as well as the cell, and from the registration status,
+ *  cached if fresh, and add it to a metric store
+ *
+ * @param &store Store to which to add the sample
+ * @param time_s Time of the sample in seconds on the store's time 
+ *               base, see TP_Metric_Store
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_bip()
+int TP_NBIoT_Interface::sample_metrics(TP_Metric_Store &store, uint32_t time_s)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::ENABLE_BIP, SaraN2::TRUE);
+		int registered;
+		if(!read_cached_state(_registered_state, registered))
+		{
+			int urc;
+			status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+			{
+				return _modem.cereg(urc, registered);
+			});
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				return status;
+			}
+
+			write_cached_state(_registered_state, registered);
+		}
+
+		status = get_nuestats(_nuestats.data);
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
-		return TP_NBIoT_Interface::NBIOT_OK;
+		TP_Metric_Store::TP_Metric_Sample sample;
+		sample.time_s = time_s;
+		sample.rsrp = _nuestats.parameters.signal_power;
+		sample.rsrq = _nuestats.parameters.rsrq;
+		sample.earfcn = _nuestats.parameters.earfcn;
+		sample.ecl = _nuestats.parameters.ecl;
+		sample.registered = registered;
+
+		return store.append(sample);
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable previously described BIP functionality
+/** Upload the stored metric history within a time window as a single
+ *  compressed blob, see TP_Metric_Store::export_blocks(). Blobs larger
+ *  than NBIOT_COAP_BLOCK_MAX are sent with coap_post_blocks()
+ *
+ * @param &store Store from which to take the history
+ * @param from_s Start of the window in seconds, inclusive
+ * @param to_s End of the window in seconds, inclusive
+ * @param *buffer Pointer to a byte array in which to build the blob
+ * @param buffer_len Size of buffer in bytes
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param *recv_data Pointer to a byte array where the data
+ *                   returned from the server will be stored
+ * @param data_intenfier Integer value representing the data
+ *                       format type, i.e. TEXT_PLAIN
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason, UPLOAD_REJECTED if the
+ *         server answered with other than 2.xx
+ */
+int TP_NBIoT_Interface::upload_metrics(TP_Metric_Store &store, uint32_t from_s, uint32_t to_s, uint8_t *buffer,
+									   size_t buffer_len, int endpoint, char *recv_data, int data_indentifier,
+									   int &response_code, size_t recv_len)
+{
+	size_t length = 0;
+	int status = store.export_blocks(from_s, to_s, buffer, buffer_len, length);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	if(length > NBIOT_COAP_BLOCK_MAX)
+	{
+		return coap_post_blocks(endpoint, buffer, length, NBIOT_COAP_BLOCK_MAX, recv_data, data_indentifier,
+								response_code, recv_len);
+	}
+
+	status = coap_post(endpoint, buffer, length, recv_data, data_indentifier, 0, 0, response_code, recv_len);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	/** Reported the same way whichever path was taken
+	 */
+	if(response_code / 100 != 2)
+	{
+		return TP_NBIoT_Interface::UPLOAD_REJECTED;
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Allow the platform to automatically attempt to connect to the 
+ *  network after power-on or reboot. Will set AT+CFUN=1 and read
+ *  the SIM PLMN. Will use APN provided by network.
  * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_bip()
+int TP_NBIoT_Interface::enable_autoconnect()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::ENABLE_BIP, SaraN2::FALSE);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::AUTOCONNECT, SaraN2::TRUE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -923,21 +1697,22 @@ int TP_NBIoT_Interface::disable_bip()
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** When enabled, the SIM is only powered when it is accessed and will be 
- *  un-powered when not required, i.e. when in PSM
- *
+/** Disable previously described autoconnect functionality
+ * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::enable_sim_power_save_mode()
+int TP_NBIoT_Interface::disable_autoconnect()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::NAS_SIM_PSM_ENABLE, SaraN2::TRUE);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::AUTOCONNECT, SaraN2::FALSE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
-            status = _modem.configure_ue(SaraN2::NAS_SIM_PSM_ENABLE, SaraN2::TRUE);
 			return status;
 		}
 
@@ -947,17 +1722,22 @@ int TP_NBIoT_Interface::enable_sim_power_save_mode()
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Disable previously described SIM PSM
- *
+/** Enable CR_0354_0338 scrambling. This is an operator specific 
+ *  setting so please confirm with your mobile network provider
+ *  if you're unsure as to what to set this to
+ * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::disable_sim_power_save_mode()
+int TP_NBIoT_Interface::enable_scrambling()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.configure_ue(SaraN2::NAS_SIM_PSM_ENABLE, SaraN2::FALSE);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::SCRAMBLING, SaraN2::TRUE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -969,93 +1749,72 @@ int TP_NBIoT_Interface::disable_sim_power_save_mode()
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Configure CoAP profile 0 with a given IP address, port and URI
- *
- * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
- *              destination server as a string, for example:
- *              char ipv4[] = "168.134.102.18"; 
- * @param port Destination server port
- * @param *uri Pointer to a byte array storing the URI, for example:
- *             char uri[] = "http://coap.me:5683/sink";
- * @param uri_length Number of characters in URI, cannot be greater
- *                   than 200
+/** Disable previously described CR_0354_0338 scrambling functionality
+ * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::configure_coap(char *ipv4, uint16_t port, char *uri, uint8_t uri_length)
+int TP_NBIoT_Interface::disable_scrambling()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.select_profile(SaraN2::COAP_PROFILE_0);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
 		{
-			return status;
-		}
-
-		status = _modem.set_coap_ip_port(ipv4, port);
+			return _modem.configure_ue(SaraN2::SCRAMBLING, SaraN2::FALSE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
 
-		status = _modem.set_coap_uri(uri, uri_length);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
 
-		status = _modem.pdu_header_add_uri_path();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
 
-		status = _modem.set_profile_validity(SaraN2::PROFILE_VALID);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
+/** Enable the scheduling of conflicted NSIB. This is an operator 
+ *  specific setting so please confirm with your mobile network 
+ *  provider if you're unsure as to what to set this to
+ * 
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::enable_si_avoid()
+{
+	int status = -1;
 
-		status = _modem.save_profile(SaraN2::COAP_PROFILE_0);
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::SI_AVOID, SaraN2::TRUE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
 		}
+
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Perform a HTTP GET request over CoAP and capture the server
- *  response in recv_data
- *
- * @param *recv_data Pointer to a byte array that will be populated
- *              	 with the response from the server
- * @param &response_code Address of integer where CoAP operation response code
- *                       will be stored
+/** Disable the previously described scheduling of conflicted NSIB
+ * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::coap_get(char *recv_data, int &response_code)
+int TP_NBIoT_Interface::disable_si_avoid()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.load_profile(SaraN2::COAP_PROFILE_0);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
-
-		status = _modem.select_coap_at_interface();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
 		{
-			return status;
-		}
-
-		status = _modem.coap_get(recv_data, response_code);
+			return _modem.configure_ue(SaraN2::SI_AVOID, SaraN2::FALSE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1063,38 +1822,24 @@ int TP_NBIoT_Interface::coap_get(char *recv_data, int &response_code)
 
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
-	
+
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Perform a HTTP DELETE request over CoAP and capture the server
- *  response in recv_data
- *
- * @param *recv_data Pointer to a byte array that will be populated
- *              	 with the response from the server
- * @param &response_code Address of integer where CoAP operation response code
- *                       will be stored
+/** Enable combined EPS/IMSI network attach
+ * 
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::coap_delete(char *recv_data, int &response_code)
+int TP_NBIoT_Interface::enable_combine_attach()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.load_profile(SaraN2::COAP_PROFILE_0);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
-
-		status = _modem.select_coap_at_interface();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
 		{
-			return status;
-		}
-
-		status = _modem.coap_delete(recv_data, response_code);
+			return _modem.configure_ue(SaraN2::COMBINE_ATTACH, SaraN2::TRUE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1102,43 +1847,24 @@ int TP_NBIoT_Interface::coap_delete(char *recv_data, int &response_code)
 
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
-	
+
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Perform a PUT request using CoAP and save the returned 
- *  data into recv_data
+/** Disable combined EPS/IMSI network attach
  * 
- * @param *send_data Pointer to a byte array containing the 
- *                   data to be sent to the server
- * @param *recv_data Pointer to a byte array where the data 
- *                   returned from the server will be stored
- * @param data_intenfier Integer value representing the data 
- *                       format type. Possible values are enumerated
- *                       in the driver header file, i.e. TEXT_PLAIN
- * @param &response_code Address of integer where CoAP operation response code
- *                       will be stored
  * @return Indicates success or failure reason
- */ 
-int TP_NBIoT_Interface::coap_put(char *send_data, char *recv_data, int data_indentifier, int &response_code)
+ */
+int TP_NBIoT_Interface::disable_combine_attach()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.load_profile(SaraN2::COAP_PROFILE_0);
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
-		{
-			return status;
-		}
-
-		status = _modem.select_coap_at_interface();
-		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
 		{
-			return status;
-		}
-
-		status = _modem.coap_put(send_data, recv_data, data_indentifier, response_code);
+			return _modem.configure_ue(SaraN2::COMBINE_ATTACH, SaraN2::FALSE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1150,131 +1876,45 @@ int TP_NBIoT_Interface::coap_put(char *send_data, char *recv_data, int data_inde
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Perform a POST request using CoAP and save the returned 
- *  data into recv_data
+/** Enable RRC cell reselection
  * 
- * @param *send_data Pointer to a byte array containing the 
- *                   data to be sent to the server
- * @param *recv_data Pointer to a byte array where the data 
- *                   returned from the server will be stored
- * @param data_intenfier Integer value representing the data 
- *                       format type. Possible values are enumerated
- *                       in the driver header file, i.e. SaraN2::TEXT_PLAIN
- * @param &response_code Address of integer where CoAP operation response code
- *                       will be stored
  * @return Indicates success or failure reason
- */ 
-int TP_NBIoT_Interface::coap_post(uint8_t *send_data, size_t buffer_len, char *recv_data, int data_indentifier,
-                                    uint8_t send_block_number, uint8_t send_more_block, int &response_code)
+ */
+int TP_NBIoT_Interface::enable_cell_reselection()
 {
-    int status = -1;
-    if(_driver == TP_NBIoT_Interface::SARAN2)
-    {
-        //todo: load_profile and select_coap_at_interface outside of loop?
-        status = _modem.load_profile(SaraN2::COAP_PROFILE_0);
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
+	int status = -1;
 
-        status = _modem.select_coap_at_interface();
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
-        
-        status = _modem.coap_post(send_data, buffer_len, recv_data, data_indentifier, send_block_number, 
-                                send_more_block, response_code);
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::CELL_RESELECTION, SaraN2::TRUE);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
 
-        if(status != TP_NBIoT_Interface::NBIOT_OK)
-        {
-            return status;
-        }
-        return TP_NBIoT_Interface::NBIOT_OK;
-    }
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
 
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Set T3412 timer to multiples of given units
+/** Disable RRC cell reselection
  * 
- * @param unit Enumerated value within T3412_units enum class
- * @param multiples Value no greater than 31 that determines
- *                  how many multiples of unit to set the
- *                  timer to
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::set_tau_timer(T3412_units unit, uint8_t multiples)
+int TP_NBIoT_Interface::disable_cell_reselection()
 {
-    if(multiples > 31)
-    {
-        return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
-    }
-
-    char binary[8];
-    dec_to_bin_5_bit(multiples, binary);
-
-    char data[9];
-	memcpy(&data[8], &"\0", 1);
-
-    char unit_char[3];
-
-    switch(unit)
-    {
-        case T3412_units::HR_320: 
-        {
-            memcpy(&unit_char[0], &"110", 3);
-            break;
-        }
-        case T3412_units::HR_10: 
-        {
-            memcpy(&unit_char[0], &"010", 3);
-            break;
-        }
-        case T3412_units::HR_1: 
-        {
-            memcpy(&unit_char[0], &"001", 3);
-            break;
-        }
-        case T3412_units::MIN_10: 
-        {
-            memcpy(&unit_char[0], &"000", 3);
-            break;
-        }
-        case T3412_units::MIN_1: 
-        {
-            memcpy(&unit_char[0], &"101", 3);
-            break;
-        }
-        case T3412_units::SEC_30: 
-        {
-            memcpy(&unit_char[0], &"100", 3);
-            break;
-        }
-        case T3412_units::SEC_2: 
-        {
-            memcpy(&unit_char[0], &"011", 3);
-            break;
-        }
-        case T3412_units::DEACT: 
-        {
-            memcpy(&unit_char[0], &"111", 3);
-            break;
-        }
-		default:
-		{
-			return TP_NBIoT_Interface::INVALID_UNIT_VALUE;
-		}
-    }
-    
-    memcpy(&data[0], unit_char, 3);
-    memcpy(&data[3], &binary[0], 5);
-
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.set_t3412_timer(data);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::CELL_RESELECTION, SaraN2::FALSE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1283,22 +1923,25 @@ int TP_NBIoT_Interface::set_tau_timer(T3412_units unit, uint8_t multiples)
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
-    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
-}   
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
 
-/** Retrieve T3412 timer value as binary string
+/** Enable Bearer Independent Protocol (BIP) where BIP is the interface
+ *  between the SIM and the ME which provides access to the data bearers
+ *  supported by the ME
  * 
- * @param *timer Pointer to char array in which to store
- *               timer value as binary string
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::get_tau_timer(char *timer)
+int TP_NBIoT_Interface::enable_bip()
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.get_t3412_timer(timer);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::ENABLE_BIP, SaraN2::TRUE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1306,145 +1949,75 @@ int TP_NBIoT_Interface::get_tau_timer(char *timer)
 
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
-	
+
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Retrieve T3412 timer value as units and multiples
+/** Disable previously described BIP functionality
  * 
- * @param &unit Address of T3412_units value into which
- *              the determined timer unit will be stored
- * @param &multiples Address of uint8_t into which 
- *                   the determined multiples value will be 
- *                   stored
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::get_tau_timer(T3412_units &unit, uint8_t &multiples)
+int TP_NBIoT_Interface::disable_bip()
 {
 	int status = -1;
-    char timer[10];
 
-    status = get_tau_timer(timer);
-    if(status != TP_NBIoT_Interface::NBIOT_OK)
-    {
-        return status;
-    }
-
-    if(strncmp(timer, "110", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::HR_320;
-    }
-    else if(strncmp(timer, "010", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::HR_10;
-    }
-    else if(strncmp(timer, "001", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::HR_1;
-    }
-    else if(strncmp(timer, "000", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::MIN_10;
-    }
-    else if(strncmp(timer, "101", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::MIN_1;
-    }
-    else if(strncmp(timer, "100", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::SEC_30;
-    }
-    else if(strncmp(timer, "011", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::SEC_2;
-    }
-    else if(strncmp(timer, "111", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3412_units::DEACT;
-    }
-    else
-    {
-        unit = TP_NBIoT_Interface::T3412_units::INVALID;
-    }
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::ENABLE_BIP, SaraN2::FALSE);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
 
-    uint8_t binary_value = 16;
-    for(int i = 3; i < 8; i++)
-    {
-        if((int)timer[i] == 49) // 1
-        {
-            multiples = multiples + binary_value;
-        }
-        
-        if(binary_value == 1)
-        {
-            break;
-        }
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
 
-        binary_value = binary_value / 2;
-    }
-    
-    return TP_NBIoT_Interface::NBIOT_OK;
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Set T3324 timer to multiples of given units
- * 
- * @param unit Enumerated value within T3324_units enum class
- * @param multiples Value no greater than 31 that determines
- *                  how many multiples of unit to set the
- *                  timer to
+/** When enabled, the SIM is only powered when it is accessed and will be 
+ *  un-powered when not required, i.e. when in PSM
+ *
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::set_active_time(T3324_units unit, uint8_t multiples)
+int TP_NBIoT_Interface::enable_sim_power_save_mode()
 {
-	if(multiples > 31)
-	{
-		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
-	}
-
-	char binary[8];
-    dec_to_bin_5_bit(multiples, binary);
-
-    char data[9];
-	memcpy(&data[8], &"\0", 1);
-
-    char unit_char[3];
+	int status = -1;
 
-	switch(unit)
+	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		case T3324_units::MIN_6:
-		{
-			memcpy(&unit_char[0], &"010", 3);
-			break;
-		}
-		case T3324_units::MIN_1:
-		{
-			memcpy(&unit_char[0], &"001", 3);
-			break;
-		}
-		case T3324_units::SEC_2:
-		{
-			memcpy(&unit_char[0], &"000", 3);
-			break;
-		}
-		case T3324_units::DEACT:
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
 		{
-			memcpy(&unit_char[0], &"111", 3);
-			break;
-		}
-		default:
+			return _modem.configure_ue(SaraN2::NAS_SIM_PSM_ENABLE, SaraN2::TRUE);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
-			return TP_NBIoT_Interface::INVALID_UNIT_VALUE;
+			return status;
 		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
-	memcpy(&data[0], unit_char, 3);
-    memcpy(&data[3], &binary[0], 5);
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
 
-    int status = -1;
+/** Disable previously described SIM PSM
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::disable_sim_power_save_mode()
+{
+	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.set_t3324_timer(data);
+		status = retry(TP_Modem_Call::CONFIGURE_UE, [&]()
+		{
+			return _modem.configure_ue(SaraN2::NAS_SIM_PSM_ENABLE, SaraN2::FALSE);
+		});
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1453,22 +2026,33 @@ int TP_NBIoT_Interface::set_active_time(T3324_units unit, uint8_t multiples)
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
 
-    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Retrieve T3324 timer value as binary string
- * 
- * @param *timer Pointer to char array in which to store
- *               timer value as binary string
+/** Configure CoAP profile 0 with a given IP address, port and URI
+ *
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              destination server as a string, for example:
+ *              char ipv4[] = "168.134.102.18"; 
+ * @param port Destination server port
+ * @param *uri Pointer to a byte array storing the URI, for example:
+ *             char uri[] = "http://coap.me:5683/sink";
+ * @param uri_length Number of characters in URI, cannot be greater
+ *                   than 200
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::get_active_time(char *timer)
+int TP_NBIoT_Interface::configure_coap(char *ipv4, uint16_t port, char *uri, uint8_t uri_length)
 {
 	int status = -1;
 
 	if(_driver == TP_NBIoT_Interface::SARAN2)
 	{
-		status = _modem.get_t3324_timer(timer);
+		/** Profile 0 now belongs to the application, so stop the endpoint
+		 *  registry from evicting it
+		 */
+		_coap_slots[0].endpoint = COAP_SLOT_PINNED;
+
+		status = write_coap_profile(SaraN2::COAP_PROFILE_0, ipv4, port, uri, uri_length);
 		if(status != TP_NBIoT_Interface::NBIOT_OK)
 		{
 			return status;
@@ -1476,102 +2060,4265 @@ int TP_NBIoT_Interface::get_active_time(char *timer)
 
 		return TP_NBIoT_Interface::NBIOT_OK;
 	}
-	
+
 	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Retrieve T3324 timer value as units and multiples
- * 
- * @param &unit Address of T3324_units value into which
- *              the determined timer unit will be stored
- * @param &multiples Address of uint8_t into which 
- *                   the determined multiples value will be 
- *                   stored
+/** Perform a HTTP GET request over CoAP and capture the server
+ *  response in recv_data
+ *
+ * @param *recv_data Pointer to a byte array that will be populated
+ *              	 with the response from the server
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
  * @return Indicates success or failure reason
  */
-int TP_NBIoT_Interface::get_active_time(T3324_units &unit, uint8_t &multiples)
+int TP_NBIoT_Interface::coap_get(char *recv_data, int &response_code, size_t recv_len)
 {
 	int status = -1;
-    char timer[10];
 
-    status = get_active_time(timer);
-    if(status != TP_NBIoT_Interface::NBIOT_OK)
-    {
-        return status;
-    }
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.load_profile(SaraN2::COAP_PROFILE_0);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
 
-    if(strncmp(timer, "010", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3324_units::MIN_6;
-    }
-    else if(strncmp(timer, "001", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3324_units::MIN_1;
-    }
-    else if(strncmp(timer, "000", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3324_units::SEC_2;
-    }
-    else if(strncmp(timer, "111", 3) == 0)
-    {
-        unit = TP_NBIoT_Interface::T3324_units::DEACT;
-    }
-    else
-    {
-        unit = TP_NBIoT_Interface::T3324_units::INVALID;
-    }
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.select_coap_at_interface();
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_get(recv_data, recv_len, response_code);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+	
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Perform a HTTP DELETE request over CoAP and capture the server
+ *  response in recv_data
+ *
+ * @param *recv_data Pointer to a byte array that will be populated
+ *              	 with the response from the server
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_delete(char *recv_data, int &response_code, size_t recv_len)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.load_profile(SaraN2::COAP_PROFILE_0);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.select_coap_at_interface();
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_delete(recv_data, recv_len, response_code);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+	
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Perform a PUT request using CoAP and save the returned 
+ *  data into recv_data
+ * 
+ * @param *send_data Pointer to a byte array containing the 
+ *                   data to be sent to the server
+ * @param *recv_data Pointer to a byte array where the data 
+ *                   returned from the server will be stored
+ * @param data_intenfier Integer value representing the data 
+ *                       format type. Possible values are enumerated
+ *                       in the driver header file, i.e. TEXT_PLAIN
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */ 
+int TP_NBIoT_Interface::coap_put(char *send_data, char *recv_data, int data_indentifier, int &response_code,
+								 size_t recv_len)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.load_profile(SaraN2::COAP_PROFILE_0);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.select_coap_at_interface();
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_put(send_data, recv_data, recv_len, data_indentifier, response_code);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
 
-    uint8_t binary_value = 16;
-    for(int i = 3; i < 8; i++)
+/** Perform a POST request using CoAP and save the returned 
+ *  data into recv_data
+ * 
+ * @param *send_data Pointer to a byte array containing the 
+ *                   data to be sent to the server
+ * @param *recv_data Pointer to a byte array where the data 
+ *                   returned from the server will be stored
+ * @param data_intenfier Integer value representing the data 
+ *                       format type. Possible values are enumerated
+ *                       in the driver header file, i.e. SaraN2::TEXT_PLAIN
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */ 
+int TP_NBIoT_Interface::coap_post(uint8_t *send_data, size_t buffer_len, char *recv_data, int data_indentifier,
+                                    uint8_t send_block_number, uint8_t send_more_block, int &response_code,
+                                    size_t recv_len)
+{
+    int status = -1;
+    if(_driver == TP_NBIoT_Interface::SARAN2)
     {
-        if((int)timer[i] == 49) // 1
+        //todo: load_profile and select_coap_at_interface outside of loop?
+        status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+        {
+            return _modem.load_profile(SaraN2::COAP_PROFILE_0);
+        });
+        if(status != TP_NBIoT_Interface::NBIOT_OK)
+        {
+            return status;
+        }
+
+        status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+        {
+            return _modem.select_coap_at_interface();
+        });
+        if(status != TP_NBIoT_Interface::NBIOT_OK)
         {
-            multiples = multiples + binary_value;
+            return status;
         }
         
-        if(binary_value == 1)
+        status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
         {
-            break;
-        }
+            return _modem.coap_post(send_data, buffer_len, recv_data, recv_len, data_indentifier, send_block_number, 
+                                    send_more_block, response_code);
+        }, false);
 
-        binary_value = binary_value / 2;
+        if(status != TP_NBIoT_Interface::NBIOT_OK)
+        {
+            return status;
+        }
+        return TP_NBIoT_Interface::NBIOT_OK;
     }
-    
-    return TP_NBIoT_Interface::NBIOT_OK;
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
 }
 
-/** Convert decimal number (with max value of 5-bits) to a binary string,
- *  i.e. 10 = "01010"
- * 
- * @param multiples Decimal value to convert to binary
- * @param *binary Pointer to a char array to which to return 
- *                the binary string
- * @return None
+/** Register a CoAP endpoint with the profile manager. Endpoints are
+ *  assigned to one of the modem's CoAP profiles on first use and the
+ *  least recently used profile is rewritten when all are occupied.
+ *  ipv4 and uri are not copied so must remain valid until the 
+ *  endpoint is unregistered
+ *
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              destination server as a string
+ * @param port Destination server port
+ * @param *uri Pointer to a byte array storing the URI
+ * @param uri_length Number of characters in URI, cannot be greater
+ *                   than NBIOT_COAP_URI_MAX
+ * @param &endpoint Address of integer in which to store the endpoint
+ *                  handle to pass to subsequent requests
+ * @return Indicates success or failure reason, INVALID_ENDPOINT if
+ *         ipv4 or uri is null
  */
-void TP_NBIoT_Interface::dec_to_bin_5_bit(uint8_t multiples, char *binary)
+int TP_NBIoT_Interface::register_coap_endpoint(char *ipv4, uint16_t port, char *uri, uint8_t uri_length, int &endpoint)
 {
-    int buffer[8];
-    int i = 0;
+	/** A null ipv4 marks a free entry, so it can't be registered
+	 */
+	if(ipv4 == nullptr || uri == nullptr)
+	{
+		return TP_NBIoT_Interface::INVALID_ENDPOINT;
+	}
 
-    for(i; multiples > 0; i++)
-    {
-        buffer[i] = multiples % 2;
-        multiples = multiples / 2;
-    }
+	if(uri_length > NBIOT_COAP_URI_MAX)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
 
-    int padding = 5 - i;
+	for(int i = 0; i < NBIOT_COAP_MAX_ENDPOINTS; i++)
+	{
+		if(_coap_endpoints[i].ipv4 == nullptr)
+		{
+			_coap_endpoints[i].ipv4 = ipv4;
+			_coap_endpoints[i].port = port;
+			_coap_endpoints[i].uri = uri;
+			_coap_endpoints[i].uri_length = uri_length;
+			_coap_endpoints[i].alias = 0;
+			_coap_endpoints[i].alias_saving = 0;
+			_coap_endpoints[i].alias_saved_total = 0;
+
+			endpoint = i;
+			return TP_NBIoT_Interface::NBIOT_OK;
+		}
+	}
 
-    for(int j = 0; j < padding; j++)
-    {
-        sprintf(&binary[j], "%d", 0);
-    }
+	return TP_NBIoT_Interface::NO_FREE_ENDPOINT;
+}
 
-    int index = 4 - padding;
-    for(padding; padding < 5; padding++)
-    {
-        sprintf(&binary[padding], "%d", buffer[index]);
-        index--;
-    }
+/** Remove a CoAP endpoint from the profile manager, releasing
+ *  any profile it occupies
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::unregister_coap_endpoint(int endpoint)
+{
+	if(endpoint < 0 || endpoint >= NBIOT_COAP_MAX_ENDPOINTS || _coap_endpoints[endpoint].ipv4 == nullptr)
+	{
+		return TP_NBIoT_Interface::INVALID_ENDPOINT;
+	}
+
+	for(int i = 0; i < NBIOT_COAP_PROFILES; i++)
+	{
+		if(_coap_slots[i].endpoint == endpoint)
+		{
+			_coap_slots[i].endpoint = COAP_SLOT_FREE;
+		}
+	}
+
+	_coap_endpoints[endpoint].ipv4 = nullptr;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Address an endpoint by a one-character alias instead of its full
+ *  path. Its profile is written as coap://ipv4:port/alias so that each
+ *  request carries a single one-byte Uri-Path option, and the server 
+ *  is expected to map the alias back to the resource
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param alias Letter, digit or one of "-._~", or 0 to go back to the 
+ *              full URI
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::set_coap_alias(int endpoint, char alias)
+{
+	if(endpoint < 0 || endpoint >= NBIOT_COAP_MAX_ENDPOINTS || _coap_endpoints[endpoint].ipv4 == nullptr)
+	{
+		return TP_NBIoT_Interface::INVALID_ENDPOINT;
+	}
+
+	/** Only unreserved characters, so the alias never needs escaping
+	 */
+	bool unreserved = (alias >= 'a' && alias <= 'z') || (alias >= 'A' && alias <= 'Z') || 
+					  (alias >= '0' && alias <= '9') || (alias != 0 && strchr("-._~", alias) != nullptr);
+	if(alias != 0 && !unreserved)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	CoAP_Endpoint &ep = _coap_endpoints[endpoint];
+	if(ep.alias == alias)
+	{
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	ep.alias = alias;
+	ep.alias_saving = 0;
+	if(alias != 0)
+	{
+		uint16_t full = uri_path_option_bytes(ep.uri, ep.uri_length);
+		ep.alias_saving = (full > 2) ? full - 2 : 0;
+	}
+
+	/** The profile holding the old URI no longer matches, so release it
+	 *  and let the next request write the new one
+	 */
+	for(int i = 0; i < NBIOT_COAP_PROFILES; i++)
+	{
+		if(_coap_slots[i].endpoint == endpoint)
+		{
+			_coap_slots[i].endpoint = COAP_SLOT_FREE;
+		}
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Report the CoAP header bytes an endpoint's alias saves
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param &per_request Address of uint16_t in which to store the Uri-Path
+ *                     bytes saved by each request
+ * @param &total Address of uint32_t in which to store the bytes saved by
+ *               all requests made through the alias so far
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_coap_alias_savings(int endpoint, uint16_t &per_request, uint32_t &total)
+{
+	if(endpoint < 0 || endpoint >= NBIOT_COAP_MAX_ENDPOINTS || _coap_endpoints[endpoint].ipv4 == nullptr)
+	{
+		return TP_NBIoT_Interface::INVALID_ENDPOINT;
+	}
+
+	per_request = _coap_endpoints[endpoint].alias_saving;
+	total = _coap_endpoints[endpoint].alias_saved_total;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Perform a GET request to a registered endpoint. The endpoint's
+ *  profile is only rewritten if it isn't already held by the modem
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param *recv_data Pointer to a byte array that will be populated
+ *              	 with the response from the server
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_get(int endpoint, char *recv_data, int &response_code, size_t recv_len)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = select_coap_endpoint(endpoint);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_get(recv_data, recv_len, response_code);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Perform a DELETE request to a registered endpoint. The endpoint's
+ *  profile is only rewritten if it isn't already held by the modem
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param *recv_data Pointer to a byte array that will be populated
+ *              	 with the response from the server
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_delete(int endpoint, char *recv_data, int &response_code, size_t recv_len)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = select_coap_endpoint(endpoint);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_delete(recv_data, recv_len, response_code);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Perform a PUT request to a registered endpoint. The endpoint's
+ *  profile is only rewritten if it isn't already held by the modem
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param *send_data Pointer to a byte array containing the 
+ *                   data to be sent to the server
+ * @param *recv_data Pointer to a byte array where the data 
+ *                   returned from the server will be stored
+ * @param data_intenfier Integer value representing the data 
+ *                       format type, i.e. TEXT_PLAIN
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_put(int endpoint, char *send_data, char *recv_data, int data_indentifier, int &response_code,
+								 size_t recv_len)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = select_coap_endpoint(endpoint);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_put(send_data, recv_data, recv_len, data_indentifier, response_code);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Perform a POST request to a registered endpoint. The endpoint's
+ *  profile is only rewritten if it isn't already held by the modem
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param *send_data Pointer to a byte array containing the 
+ *                   data to be sent to the server
+ * @param buffer_len Number of bytes in send_data
+ * @param *recv_data Pointer to a byte array where the data 
+ *                   returned from the server will be stored
+ * @param data_intenfier Integer value representing the data 
+ *                       format type, i.e. TEXT_PLAIN
+ * @param send_block_number Block1 number of this chunk
+ * @param send_more_block 1 if further blocks follow, otherwise 0
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_post(int endpoint, uint8_t *send_data, size_t buffer_len, char *recv_data, 
+								  int data_indentifier, uint8_t send_block_number, uint8_t send_more_block, 
+								  int &response_code, size_t recv_len)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = select_coap_endpoint(endpoint);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+		{
+			return _modem.coap_post(send_data, buffer_len, recv_data, recv_len, data_indentifier, send_block_number, 
+									send_more_block, response_code);
+		}, false);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** POST a payload larger than one block to a registered endpoint as a
+ *  sequence of Block1 transfers. The profile is selected once for the
+ *  whole upload and blocks are sent back-to-back when flow control is 
+ *  enabled, otherwise NBIOT_BLOCK_PACING_MS apart. Resending a block is
+ *  safe, so failed blocks are retried under the retry policy. The upload
+ *  stops early, returning UPLOAD_REJECTED, if the server answers a block
+ *  with other than 2.xx
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @param *send_data Pointer to a byte array containing the payload
+ * @param buffer_len Number of bytes in send_data
+ * @param block_size Block size, a power of two from 16 to NBIOT_COAP_BLOCK_MAX
+ * @param *recv_data Pointer to a byte array where the data 
+ *                   returned from the server will be stored
+ * @param data_intenfier Integer value representing the data 
+ *                       format type, i.e. TEXT_PLAIN
+ * @param &response_code Address of integer where the response code to
+ *                       the last block sent will be stored
+ * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_post_blocks(int endpoint, uint8_t *send_data, size_t buffer_len, size_t block_size, 
+										 char *recv_data, int data_indentifier, int &response_code, size_t recv_len)
+{
+	if(block_size < 16 || block_size > NBIOT_COAP_BLOCK_MAX || (block_size & (block_size - 1)) != 0)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	size_t blocks = (buffer_len + block_size - 1) / block_size;
+	if(blocks == 0 || blocks > 256)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = select_coap_endpoint(endpoint);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		TP_Retry_Stats &request_stats = _retry_stats[(int)TP_Modem_Call::COAP_REQUEST];
+
+		for(size_t block = 0; block < blocks; block++)
+		{
+			if(block > 0 && !_flow_control)
+			{
+				sleep_ms(NBIOT_BLOCK_PACING_MS);
+			}
+
+			size_t offset = block * block_size;
+			size_t length = (buffer_len - offset < block_size) ? buffer_len - offset : block_size;
+			uint8_t more = (block + 1 < blocks) ? 1 : 0;
+			uint32_t retries = request_stats.retries;
+
+			/** Unlike a plain POST, a block carries its number, so the server
+			 *  simply overwrites it if it arrives twice
+			 */
+			status = retry(TP_Modem_Call::COAP_REQUEST, [&]()
+			{
+				return _modem.coap_post(&send_data[offset], length, recv_data, recv_len, data_indentifier,
+										(uint8_t)block, more, response_code);
+			});
+
+			_block_stats.retries += request_stats.retries - retries;
+
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				_block_stats.failures++;
+				return status;
+			}
+
+			_block_stats.blocks_sent++;
+
+			/** The remaining blocks would only be rejected too
+			 */
+			if(response_code / 100 != 2)
+			{
+				return TP_NBIoT_Interface::UPLOAD_REJECTED;
+			}
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Retrieve the block upload counters
+ *
+ * @param &stats Address of TP_Block_Stats in which to store the counters
+ * @return None
+ */
+void TP_NBIoT_Interface::get_block_stats(TP_Block_Stats &stats)
+{
+	stats = _block_stats;
+}
+
+/** Set T3412 timer to multiples of given units
+ * 
+ * @param unit Enumerated value within T3412_units enum class
+ * @param multiples Value no greater than 31 that determines
+ *                  how many multiples of unit to set the
+ *                  timer to
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::set_tau_timer(T3412_units unit, uint8_t multiples)
+{
+    if(multiples > 31)
+    {
+        return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+    }
+
+    if((int)unit < 0 || (int)unit >= (int)T3412_units::INVALID)
+    {
+        return TP_NBIoT_Interface::INVALID_UNIT_VALUE;
+    }
+
+    char data[9];
+    encode_gprs_timer(t3412_unit_bits[(int)unit], multiples, data);
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.set_t3412_timer(data);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		/** The cached request is out of date until get_psm_timers() reads it back,
+		 *  and the grant until the network answers the new request
+		 */
+		_psm_timers_requested_valid = false;
+		_psm_timers_granted_valid = false;
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Retrieve T3412 timer value as binary string
+ * 
+ * @param *timer Pointer to char array in which to store
+ *               timer value as binary string
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_tau_timer(char *timer)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.get_t3412_timer(timer);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+	
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Retrieve T3412 timer value as units and multiples
+ * 
+ * @param &unit Address of T3412_units value into which
+ *              the determined timer unit will be stored
+ * @param &multiples Address of uint8_t into which 
+ *                   the determined multiples value will be 
+ *                   stored
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_tau_timer(T3412_units &unit, uint8_t &multiples)
+{
+	int status = -1;
+    char timer[10];
+
+    status = get_tau_timer(timer);
+    if(status != TP_NBIoT_Interface::NBIOT_OK)
+    {
+        return status;
+    }
+
+    uint8_t unit_bits;
+    status = decode_gprs_timer(timer, unit_bits, multiples);
+    if(status != TP_NBIoT_Interface::NBIOT_OK)
+    {
+        unit = TP_NBIoT_Interface::T3412_units::INVALID;
+        return status;
+    }
+
+    unit = t3412_units_from_bits[unit_bits];
+    
+    return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Set T3324 timer to multiples of given units
+ * 
+ * @param unit Enumerated value within T3324_units enum class
+ * @param multiples Value no greater than 31 that determines
+ *                  how many multiples of unit to set the
+ *                  timer to
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::set_active_time(T3324_units unit, uint8_t multiples)
+{
+	if(multiples > 31)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	if((int)unit < 0 || (int)unit >= (int)T3324_units::INVALID)
+	{
+		return TP_NBIoT_Interface::INVALID_UNIT_VALUE;
+	}
+
+    char data[9];
+    encode_gprs_timer(t3324_unit_bits[(int)unit], multiples, data);
+
+    int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.set_t3324_timer(data);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		/** The cached request is out of date until get_psm_timers() reads it back,
+		 *  and the grant until the network answers the new request
+		 */
+		_psm_timers_requested_valid = false;
+		_psm_timers_granted_valid = false;
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+    return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Retrieve T3324 timer value as binary string
+ * 
+ * @param *timer Pointer to char array in which to store
+ *               timer value as binary string
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_active_time(char *timer)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.get_t3324_timer(timer);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+	
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Retrieve T3324 timer value as units and multiples
+ * 
+ * @param &unit Address of T3324_units value into which
+ *              the determined timer unit will be stored
+ * @param &multiples Address of uint8_t into which 
+ *                   the determined multiples value will be 
+ *                   stored
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_active_time(T3324_units &unit, uint8_t &multiples)
+{
+	int status = -1;
+    char timer[10];
+
+    status = get_active_time(timer);
+    if(status != TP_NBIoT_Interface::NBIOT_OK)
+    {
+        return status;
+    }
+
+    uint8_t unit_bits;
+    status = decode_gprs_timer(timer, unit_bits, multiples);
+    if(status != TP_NBIoT_Interface::NBIOT_OK)
+    {
+        unit = TP_NBIoT_Interface::T3324_units::INVALID;
+        return status;
+    }
+
+    unit = t3324_units_from_bits[unit_bits];
+    
+    return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Replace the time source and sleep function used for every timeout,
+ *  poll interval and backoff in the interface. By default these are
+ *  Kernel::get_ms_count() and ThisThread::sleep_for()
+ *
+ * @param clock Function returning the current time in milliseconds
+ * @param sleep Function that blocks, or advances virtual time, for
+ *              the given number of milliseconds
+ * @return None
+ */
+void TP_NBIoT_Interface::set_clock(Callback<uint64_t()> clock, Callback<void(uint32_t)> sleep)
+{
+	_clock = clock;
+	_sleep = sleep;
+}
+
+/** Seed the generator behind retry jitter and CoAP token/message ID
+ *  starting points. Without a call it is seeded from the hardware 
+ *  RNG where the target has one and from the modem IMEI once start()
+ *  reaches the modem, so devices that fail together back off 
+ *  differently. Pass a value from persistent storage to also make
+ *  each boot differ on targets without a hardware RNG
+ *
+ * @param seed Any value, mixed into the current state
+ * @return None
+ */
+void TP_NBIoT_Interface::seed_random(uint32_t seed)
+{
+	next_random();
+	_random_state ^= seed;
+
+	if(_random_state == 0)
+	{
+		_random_state = 0x9E3779B9;
+	}
+}
+
+/** Set the retry policy applied to modem transactions
+ *
+ * @param &policy Maximum attempts and backoff bounds. max_attempts
+ *                of 1 disables retries
+ * @return None
+ */
+void TP_NBIoT_Interface::set_retry_policy(const TP_Retry_Policy &policy)
+{
+	_retry_policy = policy;
+
+	if(_retry_policy.max_attempts == 0)
+	{
+		_retry_policy.max_attempts = 1;
+	}
+}
+
+/** Retrieve the attempt, retry and failure counters for a category
+ *  of modem transaction
+ *
+ * @param call Category of modem transaction
+ * @param &stats Address of TP_Retry_Stats in which to store the counters
+ * @return None
+ */
+void TP_NBIoT_Interface::get_retry_stats(TP_Modem_Call call, TP_Retry_Stats &stats)
+{
+	stats = _retry_stats[(int)call];
+}
+
+/** Zero the retry counters for every category
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::reset_retry_stats()
+{
+	memset(_retry_stats, 0, sizeof(_retry_stats));
+}
+
+/** Serve get_connection_status, get_power_save_mode_status, get_radio_status
+ *  and get_module_network_status from cached values no older than max_age_ms
+ *  instead of querying the modem. Cached values are refreshed by queries and
+ *  by +CSCON, +CEREG and +NPSMR URCs. 0 disables the cache
+ *
+ * @param max_age_ms Maximum age in milliseconds of a cached value
+ * @return None
+ */
+void TP_NBIoT_Interface::set_status_cache_max_age(uint32_t max_age_ms)
+{
+	_status_cache_max_age_ms = max_age_ms;
+}
+
+/** Discard all cached status values, including the network-granted PSM
+ *  timers, so the next getter queries the modem
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::invalidate_status_cache()
+{
+	_connected_state.valid = false;
+	_registered_state.valid = false;
+	_psm_state.valid = false;
+	_radio_state.valid = false;
+	_psm_timers_granted_valid = false;
+}
+
+/** Ask the modem to report radio connection, network registration and PSM
+ *  changes as URCs so that the status cache stays current without polling.
+ *  Registration is reported in CEREG mode 4 so that network-granted PSM
+ *  timers arrive too. URCs are dispatched from process_urc() or during 
+ *  any other command
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::enable_status_urcs()
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.set_cscon_urc(1);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.set_cereg_urc(4);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.set_npsmr_urc(1);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Track the modem's power state from its VINT pin, which is driven high
+ *  while the module is active and falls when it enters deep-sleep PSM.
+ *  While enabled, get_power_save_mode_status() answers from the pin with
+ *  no AT traffic, and ready() waits for VINT to rise before probing
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::enable_power_monitor()
+{
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		_vint_level = _vint.read();
+		_vint.rise(callback(this, &TP_NBIoT_Interface::vint_handler));
+		_vint.fall(callback(this, &TP_NBIoT_Interface::vint_handler));
+		_power_monitor = true;
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Stop tracking VINT and return to querying the modem for PSM state
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::disable_power_monitor()
+{
+	_power_monitor = false;
+	_vint.rise(nullptr);
+	_vint.fall(nullptr);
+}
+
+/** Set the VINT level seen by the power monitor as though the pin had
+ *  changed, so that simulated modems can drive PSM entry and exit
+ *
+ * @param level 1 for active, 0 for deep-sleep PSM
+ * @return None
+ */
+void TP_NBIoT_Interface::inject_vint(int level)
+{
+	_vint_level = level;
+}
+
+/** Read T3412 and T3324 from the modem for use by the uplink scheduler,
+ *  preferring the values granted by the network. Call after changing 
+ *  either timer
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::sync_psm_timers()
+{
+	/** get_psm_timers() applies the granted values to the scheduler
+	 */
+	TP_PSM_Timers timers;
+
+	return get_psm_timers(timers);
+}
+
+/** Hold an uplink until the modem next has a radio session for its own
+ *  reasons, i.e. it is RRC connected, awake in its T3324 active window or 
+ *  about to perform a periodic TAU, so that one session serves both. If
+ *  no such opportunity arises within max_hold_s the uplink is sent anyway.
+ *  Relies on the status URCs enabled by enable_status_urcs()
+ *
+ * @param send Function that performs the uplink, i.e. a coap_post() or 
+ *             udp_sendto(), and returns its status
+ * @param max_hold_s Longest time in seconds the uplink may be held
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::defer_uplink(Callback<int()> send, uint32_t max_hold_s)
+{
+	if(_deferred_count >= NBIOT_DEFERRED_UPLINKS)
+	{
+		return TP_NBIoT_Interface::QUEUE_FULL;
+	}
+
+	_deferred_uplinks[_deferred_count].send = send;
+	_deferred_uplinks[_deferred_count].deadline_ms = now_ms() + (uint64_t)max_hold_s * 1000;
+	_deferred_count++;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Send any deferred uplinks if the modem is in a radio session or one is
+ *  due, or if any has reached its deadline. Uplinks whose send fails stay
+ *  queued until their deadline has passed; one whose send fails after 
+ *  that, i.e. on the forced wake its deadline caused, is dropped and 
+ *  counted in TP_Uplink_Stats::dropped. Call periodically and after
+ *  process_urc()
+ *
+ * @param &sent Address of uint8_t in which to store the number of uplinks
+ *              sent by this call
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::service_uplinks(uint8_t &sent)
+{
+	sent = 0;
+
+	if(_deferred_count == 0)
+	{
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	uint64_t now = now_ms();
+
+	/** Use whatever the URCs last told us rather than querying, since a
+	 *  query is exactly the kind of wake we're trying to avoid
+	 */
+	bool connected = _connected_state.valid && _connected_state.value == 1;
+	bool awake = _psm_state.valid && _psm_state.value == 0;
+	bool tau_due = false;
+
+	/** Don't trust a stale "awake" once the active window must have closed,
+	 *  i.e. if the +NPSMR for PSM entry was missed
+	 */
+	if(awake && _rrc_release_valid && _t3324_s > 0)
+	{
+		awake = now < _rrc_release_ms + (uint64_t)_t3324_s * 1000;
+	}
+
+	uint64_t next_tau_ms = 0;
+	if(next_tau(now, next_tau_ms))
+	{
+		tau_due = now + NBIOT_TAU_GUARD_MS >= next_tau_ms;
+	}
+
+	bool deadline_reached = false;
+	for(uint8_t i = 0; i < _deferred_count; i++)
+	{
+		if(now >= _deferred_uplinks[i].deadline_ms)
+		{
+			deadline_reached = true;
+		}
+	}
+
+	if(connected || awake || tau_due)
+	{
+		_uplink_stats.merged_wakes++;
+	}
+	else if(deadline_reached)
+	{
+		_uplink_stats.forced_wakes++;
+	}
+	else
+	{
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	/** Everything goes in the same session, whatever its deadline. Only
+	 *  the uplinks queued before this flush are sent, any deferred by the
+	 *  send functions themselves wait for the next one
+	 */
+	int status = TP_NBIoT_Interface::NBIOT_OK;
+	uint8_t count = _deferred_count;
+	uint8_t kept = 0;
+
+	for(uint8_t i = 0; i < count; i++)
+	{
+		Deferred_Uplink entry = _deferred_uplinks[i];
+
+		int send_status = entry.send();
+		if(send_status == TP_NBIoT_Interface::NBIOT_OK)
+		{
+			_uplink_stats.sent++;
+			sent++;
+			continue;
+		}
+
+		_uplink_stats.failed++;
+		status = send_status;
+
+		/** A failed uplink is kept for the next flush until its deadline.
+		 *  One that fails once its deadline has passed, i.e. on the forced
+		 *  wake it caused, is dropped
+		 */
+		if(now < entry.deadline_ms)
+		{
+			_deferred_uplinks[kept++] = entry;
+		}
+		else
+		{
+			_uplink_stats.dropped++;
+		}
+	}
+
+	for(uint8_t i = count; i < _deferred_count; i++)
+	{
+		_deferred_uplinks[kept++] = _deferred_uplinks[i];
+	}
+	_deferred_count = kept;
+
+	return status;
+}
+
+/** Time until service_uplinks() is next expected to send, either for the
+ *  next periodic TAU or the earliest deadline. Useful to decide how long
+ *  the application can sleep
+ *
+ * @param &ms Address of uint32_t in which to store the delay in milliseconds.
+ *            0 if nothing is deferred or a send is already due
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_next_uplink_window(uint32_t &ms)
+{
+	ms = 0;
+
+	if(_deferred_count == 0)
+	{
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	uint64_t now = now_ms();
+	uint64_t next = _deferred_uplinks[0].deadline_ms;
+
+	for(uint8_t i = 1; i < _deferred_count; i++)
+	{
+		if(_deferred_uplinks[i].deadline_ms < next)
+		{
+			next = _deferred_uplinks[i].deadline_ms;
+		}
+	}
+
+	/** service_uplinks() treats a TAU as due from NBIOT_TAU_GUARD_MS 
+	 *  before it, so if that window has already opened there is no wait
+	 */
+	uint64_t next_tau_ms = 0;
+	if(next_tau(now, next_tau_ms))
+	{
+		uint64_t window_ms = (next_tau_ms > NBIOT_TAU_GUARD_MS) ? next_tau_ms - NBIOT_TAU_GUARD_MS : 0;
+		if(window_ms < next)
+		{
+			next = window_ms;
+		}
+	}
+
+	if(next > now)
+	{
+		ms = (uint32_t)(next - now);
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Retrieve the uplink scheduler counters
+ *
+ * @param &stats Address of TP_Uplink_Stats in which to store the counters
+ * @return None
+ */
+void TP_NBIoT_Interface::get_uplink_stats(TP_Uplink_Stats &stats)
+{
+	stats = _uplink_stats;
+}
+
+/** Expected time of the next periodic TAU. T3412 starts when the RRC 
+ *  connection is released and restarts at each TAU, so once the first
+ *  one after the release has passed without a new release being seen, 
+ *  the next is expected a whole number of periods after it
+ *
+ * @param now Current time in milliseconds
+ * @param &tau_ms Address of uint64_t in which to store the time of the
+ *                first TAU after now
+ * @return True if a TAU is expected, false if the release time or T3412
+ *         is unknown
+ */
+bool TP_NBIoT_Interface::next_tau(uint64_t now, uint64_t &tau_ms)
+{
+	if(!_rrc_release_valid || _t3412_s == 0)
+	{
+		return false;
+	}
+
+	uint64_t period_ms = (uint64_t)_t3412_s * 1000;
+	tau_ms = _rrc_release_ms + period_ms;
+	if(now >= tau_ms)
+	{
+		tau_ms += ((now - tau_ms) / period_ms + 1) * period_ms;
+	}
+
+	return true;
+}
+
+/** Request extended DRX with a given cycle length and paging time window
+ *
+ * @param cycle Enumerated value within eDRX_cycles enum class
+ * @param ptw Paging time window as a value no greater than 15, where
+ *            the window is (ptw + 1) * 2.56 seconds
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::set_edrx(eDRX_cycles cycle, uint8_t ptw)
+{
+	if(ptw > 15)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	if((int)cycle < 0 || (int)cycle >= (int)eDRX_cycles::INVALID)
+	{
+		return TP_NBIoT_Interface::INVALID_UNIT_VALUE;
+	}
+
+	char ptw_data[5];
+	char edrx_data[5];
+	encode_bits(ptw, 4, ptw_data);
+	encode_bits(edrx_cycle_bits[(int)cycle], 4, edrx_data);
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.set_edrx(ptw_data, edrx_data);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Stop requesting extended DRX
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::disable_edrx()
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.disable_edrx();
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Retrieve the requested eDRX cycle and paging time window, or those
+ *  granted by the network which may differ
+ *
+ * @param &cycle Address of eDRX_cycles value into which the cycle
+ *               length will be stored
+ * @param &ptw Address of uint8_t into which the paging time window 
+ *             will be stored, where the window is (ptw + 1) * 2.56 seconds
+ * @param granted If true return the values in use by the network rather
+ *                than those requested
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_edrx(eDRX_cycles &cycle, uint8_t &ptw, bool granted)
+{
+	char ptw_data[5];
+	char edrx_data[5];
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			if(granted)
+			{
+				return _modem.get_edrx_granted(ptw_data, edrx_data);
+			}
+
+			return _modem.get_edrx(ptw_data, edrx_data);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		uint8_t edrx_bits;
+		status = decode_bits(edrx_data, 4, edrx_bits);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			cycle = TP_NBIoT_Interface::eDRX_cycles::INVALID;
+			return status;
+		}
+
+		status = decode_bits(ptw_data, 4, ptw);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		cycle = edrx_cycles_from_bits[edrx_bits];
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Length of an eDRX cycle in milliseconds, for comparing the downlink 
+ *  latency of eDRX against PSM
+ *
+ * @param cycle Enumerated value within eDRX_cycles enum class
+ * @return Cycle length in milliseconds, 0 if invalid
+ */
+uint32_t TP_NBIoT_Interface::edrx_cycle_ms(eDRX_cycles cycle)
+{
+	if((int)cycle < 0 || (int)cycle >= (int)eDRX_cycles::INVALID)
+	{
+		return 0;
+	}
+
+	/** Each step doubles the cycle, starting from 20.48 s
+	 */
+	return (uint32_t)20480 << (int)cycle;
+}
+
+/** Length of a paging time window in milliseconds
+ *
+ * @param ptw Paging time window value no greater than 15
+ * @return Window length in milliseconds
+ */
+uint32_t TP_NBIoT_Interface::edrx_ptw_ms(uint8_t ptw)
+{
+	return ((uint32_t)(ptw & 0x0F) + 1) * 2560;
+}
+
+/** Read T3412 and T3324 as both requested by the device and granted
+ *  by the network. The divergence callback, if attached, is called
+ *  when a new grant differs from the request. If the network hasn't
+ *  granted PSM the granted units are INVALID and the seconds zero
+ *
+ * @param &timers Address of TP_PSM_Timers in which to store the values
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::get_psm_timers(TP_PSM_Timers &timers)
+{
+	int status = read_requested_timers();
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		char active_time[10];
+		char periodic_tau[10];
+		int reg_status;
+
+		status = retry(TP_Modem_Call::TIMER, [&]()
+		{
+			return _modem.cereg_timers(reg_status, active_time, periodic_tau);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = store_granted_timers(active_time, periodic_tau);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		timers = _psm_timers;
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Register a function to be called whenever the network grants PSM
+ *  timers that differ from those requested, either on a call to 
+ *  get_psm_timers() or from a +CEREG URC
+ *
+ * @param callback Function taking the requested and granted timers
+ * @return None
+ */
+void TP_NBIoT_Interface::attach_psm_timer_divergence(Callback<void(const TP_PSM_Timers&)> callback)
+{
+	_psm_divergence_callback = callback;
+}
+
+/** Create a UDP socket on the modem. Datagrams sent and received
+ *  through this socket bypass the CoAP profile machinery entirely
+ *
+ * @param &socket Address of integer in which to store the socket
+ *                number allocated by the modem
+ * @param local_port Local port to bind to. 0 lets the modem choose
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::udp_open(int &socket, uint16_t local_port)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::SOCKET, [&]()
+		{
+			return _modem.nsocr(local_port, socket);
+		}, false);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Close a previously opened UDP socket
+ *
+ * @param socket Socket number returned by udp_open()
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::udp_close(int socket)
+{
+	if(socket < 0 || socket >= NBIOT_UDP_MAX_SOCKETS)
+	{
+		return TP_NBIoT_Interface::INVALID_SOCKET;
+	}
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::SOCKET, [&]()
+		{
+			return _modem.nsocl(socket);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		downlink_listen(socket, false);
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Send a single datagram to a remote host. The call returns as
+ *  soon as the modem has accepted the data, no acknowledgement
+ *  is expected from the remote end
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              destination as a string, i.e. "168.134.102.18"
+ * @param port Destination port
+ * @param *data Pointer to a byte array containing the datagram
+ * @param length Number of bytes to send, cannot be greater than
+ *               NBIOT_UDP_MAX_DATAGRAM
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::udp_sendto(int socket, char *ipv4, uint16_t port, uint8_t *data, size_t length)
+{
+	if(socket < 0 || socket >= NBIOT_UDP_MAX_SOCKETS)
+	{
+		return TP_NBIoT_Interface::INVALID_SOCKET;
+	}
+
+	if(length > NBIOT_UDP_MAX_DATAGRAM)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::SOCKET, [&]()
+		{
+			return _modem.nsost(socket, ipv4, port, data, length);
+		}, false);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Send a single datagram assembled from several segments, i.e. a
+ *  header, payload and trailer, without concatenating them into a
+ *  temporary buffer first. Each segment is streamed to the modem 
+ *  in turn
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              destination as a string, i.e. "168.134.102.18"
+ * @param port Destination port
+ * @param *segments Pointer to an array of segments making up the datagram
+ * @param count Number of segments
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::udp_sendto(int socket, char *ipv4, uint16_t port, const TP_Buffer_Segment *segments, 
+								   uint8_t count)
+{
+	if(socket < 0 || socket >= NBIOT_UDP_MAX_SOCKETS)
+	{
+		return TP_NBIoT_Interface::INVALID_SOCKET;
+	}
+
+	size_t length = 0;
+	for(uint8_t i = 0; i < count; i++)
+	{
+		length += segments[i].length;
+	}
+
+	if(length > NBIOT_UDP_MAX_DATAGRAM)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		/** The begin, writes and end form one AT+NSOST transaction and are
+		 *  counted as one socket call, which like the single-buffer send
+		 *  isn't repeated
+		 */
+		return retry(TP_Modem_Call::SOCKET, [&]()
+		{
+			/** The command prefix carries the total length, so it has to be
+			 *  known before the first segment is written
+			 */
+			int write_status = _modem.nsost_begin(socket, ipv4, port, length);
+			if(write_status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				return write_status;
+			}
+
+			for(uint8_t i = 0; i < count; i++)
+			{
+				write_status = _modem.nsost_write(segments[i].data, segments[i].length);
+				if(write_status != TP_NBIoT_Interface::NBIOT_OK)
+				{
+					break;
+				}
+			}
+
+			/** Always terminate the command line, even after a failed write, so
+			 *  the modem isn't left waiting for the rest of the payload
+			 */
+			int end_status = _modem.nsost_end();
+			if(write_status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				return write_status;
+			}
+
+			return end_status;
+		}, false);
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Read a received datagram from the modem. Normally called after
+ *  the callback registered with udp_attach() has reported that
+ *  data is waiting
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to a char array of at least 16 bytes in which
+ *              to store the source IPv4 address
+ * @param &port Address of integer in which to store the source port
+ * @param *data Pointer to a byte array in which to store the datagram
+ * @param buffer_len Size of data in bytes
+ * @param &length Address of size_t in which to store the number of
+ *                bytes copied into data
+ * @param &remaining Address of size_t in which to store the number of
+ *                   bytes still waiting to be read on this socket
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::udp_recvfrom(int socket, char *ipv4, uint16_t &port, uint8_t *data, size_t buffer_len,
+									 size_t &length, size_t &remaining)
+{
+	if(socket < 0 || socket >= NBIOT_UDP_MAX_SOCKETS)
+	{
+		return TP_NBIoT_Interface::INVALID_SOCKET;
+	}
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::SOCKET, [&]()
+		{
+			return _modem.nsorf(socket, ipv4, port, data, buffer_len, length, remaining);
+		}, false);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Register a function to be called when the modem reports, via 
+ *  +NSONMI, that a datagram has arrived on a socket
+ *
+ * @param callback Function taking the socket number and the number
+ *                 of bytes available
+ * @return None
+ */
+void TP_NBIoT_Interface::udp_attach(Callback<void(int, int)> callback)
+{
+	_udp_callback = callback;
+}
+
+/** Process any unsolicited result codes that the modem has sent 
+ *  while no command was in progress. Registered callbacks are
+ *  dispatched from within this call
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::process_urc()
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		/** Parses what the modem has already sent and issues no command, so
+		 *  there is nothing for the retry policy to repeat
+		 */
+		status = _modem.process_urc();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		/** +NSONMI handlers run inside the parser, where no further command
+		 *  can be issued, so waiting datagrams are only read out here
+		 */
+		status = collect_downlinks();
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Collect datagrams arriving on a socket into the downlink receive 
+ *  pool. Datagrams are read from the modem by process_urc() after it 
+ *  has dispatched the +NSONMI URC, so that server-initiated data is
+ *  picked up without an explicit udp_recvfrom(). The udp_attach() 
+ *  callback is no longer called for this socket
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param enable False to return the socket to manual udp_recvfrom()
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::downlink_listen(int socket, bool enable)
+{
+	if(socket < 0 || socket >= NBIOT_UDP_MAX_SOCKETS)
+	{
+		return TP_NBIoT_Interface::INVALID_SOCKET;
+	}
+
+	if(enable)
+	{
+		_downlink_sockets |= (uint8_t)(1 << socket);
+	}
+	else
+	{
+		_downlink_sockets &= (uint8_t)~(1 << socket);
+		_downlink_pending[socket] = false;
+		_downlink_blocked[socket] = false;
+		_coap_sockets &= (uint8_t)~(1 << socket);
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Register a function to be handed each downlink message as it is
+ *  collected, instead of queueing it for downlink_receive(). The
+ *  function owns the message until it calls downlink_release()
+ *
+ * @param callback Function taking a pointer to the received message
+ * @return None
+ */
+void TP_NBIoT_Interface::downlink_attach(Callback<void(TP_Downlink_Message*)> callback)
+{
+	_downlink_callback = callback;
+}
+
+/** Take the oldest queued downlink message. The message stays valid
+ *  until it is passed to downlink_release()
+ *
+ * @param *&message Address of pointer in which to store the message
+ * @return Indicates success or failure reason, NO_MESSAGE if the
+ *         queue is empty
+ */
+int TP_NBIoT_Interface::downlink_receive(TP_Downlink_Message *&message)
+{
+	if(_downlink_queue_count == 0)
+	{
+		message = nullptr;
+		return TP_NBIoT_Interface::NO_MESSAGE;
+	}
+
+	message = &_downlink_pool[_downlink_queue[_downlink_queue_head]];
+	_downlink_queue_head = (_downlink_queue_head + 1) % NBIOT_DOWNLINK_BUFFERS;
+	_downlink_queue_count--;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Return a message's buffer to the downlink receive pool. Datagrams
+ *  left at the modem for want of a buffer are collected on the next
+ *  call to process_urc()
+ *
+ * @param *message Pointer returned by downlink_receive() or passed
+ *                 to the downlink_attach() callback
+ * @return None
+ */
+void TP_NBIoT_Interface::downlink_release(TP_Downlink_Message *message)
+{
+	if(message < &_downlink_pool[0] || message >= &_downlink_pool[NBIOT_DOWNLINK_BUFFERS])
+	{
+		return;
+	}
+
+	_downlink_in_use[message - _downlink_pool] = false;
+}
+
+/** Retrieve the downlink receive pool counters
+ *
+ * @param &stats Address of TP_Downlink_Stats in which to store the counters
+ * @return None
+ */
+void TP_NBIoT_Interface::get_downlink_stats(TP_Downlink_Stats &stats)
+{
+	stats = _downlink_stats;
+}
+
+/** Perform a confirmable CoAP GET over UDP, validating a cached 
+ *  representation by its ETag. If the server still holds the same
+ *  representation it answers 2.03 Valid with no payload. The socket
+ *  is put in listening mode with downlink_listen(). Only one CoAP 
+ *  request over UDP can await its response at a time, so this can't
+ *  be called from a downlink or Observe callback while another is
+ *  waiting
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              server as a string, i.e. "168.134.102.18"
+ * @param port Server port
+ * @param *uri Pointer to a null-terminated path, i.e. "config/device"
+ * @param *payload Pointer to a byte array in which to store the response
+ *                 payload
+ * @param buffer_len Size of payload in bytes
+ * @param &response On entry, etag and etag_length describe the cached
+ *                  representation, etag_length 0 for none. On success
+ *                  holds the response and its ETag
+ * @return Indicates success or failure reason, COAP_BUSY if another 
+ *         CoAP request over UDP is awaiting its response
+ */
+int TP_NBIoT_Interface::coap_get_validated(int socket, char *ipv4, uint16_t port, char *uri, uint8_t *payload, 
+										   size_t buffer_len, TP_CoAP_Response &response)
+{
+	if(_coap_pending.active)
+	{
+		return TP_NBIoT_Interface::COAP_BUSY;
+	}
+
+	if(response.etag_length > NBIOT_COAP_ETAG_MAX)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	int status = downlink_listen(socket);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	uint8_t token[NBIOT_COAP_TOKEN_LENGTH];
+	next_coap_token(token);
+	uint16_t message_id = next_coap_message_id();
+
+	uint8_t request[NBIOT_COAP_REQUEST_MAX];
+	size_t length = 0;
+	status = encode_coap_request(request, sizeof(request), COAP_TYPE_CON, COAP_CODE_GET, message_id, token, 
+								 response.etag, response.etag_length, -1, uri, false, length);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	TP_Buffer_Segment segment = { request, length };
+	return coap_exchange(socket, ipv4, port, &segment, 1, message_id, token, payload, buffer_len, response);
+}
+
+/** Register with a CoAP server to be notified of changes to a resource
+ *  (RFC 7641), so that it no longer has to be polled. The first response
+ *  and every later notification are passed to callback from within 
+ *  process_urc(). ipv4 and uri must remain valid until the observation
+ *  is cancelled. Like coap_get_validated(), this can't be called while
+ *  another CoAP request over UDP is awaiting its response
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              server as a string, i.e. "168.134.102.18"
+ * @param port Server port
+ * @param *uri Pointer to a null-terminated path, i.e. "config/device"
+ * @param callback Function taking each response or notification
+ * @param &observation Address of integer in which to store the observation 
+ *                     handle, -1 if the server declined to be observed 
+ * @return Indicates success or failure reason, COAP_BUSY if another 
+ *         CoAP request over UDP is awaiting its response
+ */
+int TP_NBIoT_Interface::coap_observe(int socket, char *ipv4, uint16_t port, char *uri,
+									 Callback<void(const TP_CoAP_Response&)> callback, int &observation)
+{
+	observation = -1;
+
+	if(_coap_pending.active)
+	{
+		return TP_NBIoT_Interface::COAP_BUSY;
+	}
+
+	int slot = -1;
+	for(int i = 0; i < NBIOT_COAP_OBSERVATIONS; i++)
+	{
+		if(!_coap_observations[i].active)
+		{
+			slot = i;
+			break;
+		}
+	}
+
+	if(slot < 0)
+	{
+		return TP_NBIoT_Interface::NO_FREE_OBSERVATION;
+	}
+
+	int status = downlink_listen(socket);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	CoAP_Observation &entry = _coap_observations[slot];
+	next_coap_token(entry.token);
+	uint16_t message_id = next_coap_message_id();
+
+	uint8_t request[NBIOT_COAP_REQUEST_MAX];
+	size_t length = 0;
+	status = encode_coap_request(request, sizeof(request), COAP_TYPE_CON, COAP_CODE_GET, message_id, entry.token, 
+								 nullptr, 0, 0, uri, false, length);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	/** Activate the slot before sending so that the first response is
+	 *  delivered to the callback like any later notification
+	 */
+	entry.socket = socket;
+	entry.ipv4 = ipv4;
+	entry.port = port;
+	entry.uri = uri;
+	entry.callback = callback;
+	entry.cancelling = false;
+	entry.notified = false;
+	entry.active = true;
+
+	TP_CoAP_Response response = {};
+	TP_Buffer_Segment segment = { request, length };
+	status = coap_exchange(socket, ipv4, port, &segment, 1, message_id, entry.token, nullptr, 0, response);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		entry.active = false;
+		return status;
+	}
+
+	/** A server that can't or won't be observed answers without the Observe
+	 *  option, which is an ordinary response to an ordinary GET
+	 */
+	if(!response.observe_present || response.code / 100 != 2)
+	{
+		entry.active = false;
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	observation = slot;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Deregister an observation with the server and free its slot once
+ *  the server has answered. Notifications arriving meanwhile are 
+ *  acknowledged but not passed to the callback
+ *
+ * @param observation Handle returned by coap_observe()
+ * @return Indicates success or failure reason, COAP_BUSY if another 
+ *         CoAP request over UDP is awaiting its response. On any
+ *         failure the observation is left active
+ */
+int TP_NBIoT_Interface::coap_cancel_observe(int observation)
+{
+	if(observation < 0 || observation >= NBIOT_COAP_OBSERVATIONS || !_coap_observations[observation].active)
+	{
+		return TP_NBIoT_Interface::INVALID_OBSERVATION;
+	}
+
+	if(_coap_pending.active)
+	{
+		return TP_NBIoT_Interface::COAP_BUSY;
+	}
+
+	CoAP_Observation &entry = _coap_observations[observation];
+
+	uint16_t message_id = next_coap_message_id();
+
+	uint8_t request[NBIOT_COAP_REQUEST_MAX];
+	size_t length = 0;
+	int status = encode_coap_request(request, sizeof(request), COAP_TYPE_CON, COAP_CODE_GET, message_id, entry.token,
+									 nullptr, 0, 1, entry.uri, false, length);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	/** Keep the slot while the deregistration is in flight, so its token is
+	 *  still recognised, but stop notifications and the response to the
+	 *  deregistration from reaching the callback
+	 */
+	entry.cancelling = true;
+
+	TP_CoAP_Response response = {};
+	TP_Buffer_Segment segment = { request, length };
+	status = coap_exchange(entry.socket, entry.ipv4, entry.port, &segment, 1, message_id, entry.token, 
+						   nullptr, 0, response);
+
+	entry.cancelling = false;
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	entry.active = false;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Open a telemetry stream to a CoAP resource. Uplinks are sent as
+ *  non-confirmable POSTs, so the radio can be released without 
+ *  waiting for the server, and carry a 24-bit sequence number in the
+ *  token, after a prefix byte of NBIOT_COAP_STREAM_TOKEN | stream,
+ *  so the server can detect gaps. Every heartbeat_s seconds an
+ *  uplink is sent confirmable instead as a liveness check. ipv4 and 
+ *  uri must remain valid until the stream is closed
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+ *              server as a string, i.e. "168.134.102.18"
+ * @param port Server port
+ * @param *uri Pointer to a null-terminated path, i.e. "telemetry"
+ * @param heartbeat_s Seconds between confirmable uplinks, 0 for none
+ * @param &stream Address of integer in which to store the stream handle
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_stream_open(int socket, char *ipv4, uint16_t port, char *uri, uint32_t heartbeat_s, 
+										 int &stream)
+{
+	stream = -1;
+
+	int slot = -1;
+	for(int i = 0; i < NBIOT_COAP_STREAMS; i++)
+	{
+		if(!_coap_streams[i].active)
+		{
+			slot = i;
+			break;
+		}
+	}
+
+	if(slot < 0)
+	{
+		return TP_NBIoT_Interface::NO_FREE_STREAM;
+	}
+
+	/** Heartbeat responses arrive through the downlink path
+	 */
+	int status = downlink_listen(socket);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	CoAP_Stream &entry = _coap_streams[slot];
+	entry.socket = socket;
+	entry.ipv4 = ipv4;
+	entry.port = port;
+	entry.uri = uri;
+	entry.sequence = 0;
+	entry.heartbeat_s = heartbeat_s;
+	entry.last_confirmed_ms = now_ms();
+	entry.active = true;
+
+	stream = slot;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Send one uplink on a stream, confirmable if a heartbeat is due and
+ *  otherwise fire-and-forget. A failed heartbeat is retried on the 
+ *  next uplink, as is one due while another CoAP request over UDP is
+ *  awaiting its response, i.e. when called from a downlink or Observe
+ *  callback; that uplink is sent non-confirmable instead
+ *
+ * @param stream Handle returned by coap_stream_open()
+ * @param *data Pointer to the payload
+ * @param length Number of bytes in data
+ * @param &confirmed Address of boolean set true if the uplink was sent
+ *                   confirmable and the server responded
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_stream_send(int stream, const uint8_t *data, size_t length, bool &confirmed)
+{
+	confirmed = false;
+
+	if(stream < 0 || stream >= NBIOT_COAP_STREAMS || !_coap_streams[stream].active)
+	{
+		return TP_NBIoT_Interface::INVALID_STREAM;
+	}
+
+	CoAP_Stream &entry = _coap_streams[stream];
+
+	uint64_t start_ms = now_ms();
+	bool confirmable = entry.heartbeat_s > 0 && start_ms - entry.last_confirmed_ms >= (uint64_t)entry.heartbeat_s * 1000 &&
+					   !_coap_pending.active;
+	TP_Uplink_Mode_Stats &stats = _uplink_mode_stats[confirmable ? 1 : 0];
+
+	/** The token is the stream's prefix byte followed by the low 24 bits 
+	 *  of the sequence number, big-endian. The sequence advances even if
+	 *  the uplink fails so that the server sees the gap
+	 */
+	uint8_t token[NBIOT_COAP_TOKEN_LENGTH];
+	token[0] = (uint8_t)(NBIOT_COAP_STREAM_TOKEN | stream);
+	for(int i = 1; i < NBIOT_COAP_TOKEN_LENGTH; i++)
+	{
+		token[i] = (uint8_t)(entry.sequence >> (8 * (NBIOT_COAP_TOKEN_LENGTH - 1 - i)));
+	}
+	entry.sequence++;
+
+	uint16_t message_id = next_coap_message_id();
+
+	uint8_t request[NBIOT_COAP_REQUEST_MAX];
+	size_t header_length = 0;
+	int status = encode_coap_request(request, sizeof(request), confirmable ? COAP_TYPE_CON : COAP_TYPE_NON, 
+									 COAP_CODE_POST, message_id, token, nullptr, 0, -1, entry.uri, length > 0, 
+									 header_length);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	TP_Buffer_Segment segments[2] = { { request, header_length }, { data, length } };
+	uint8_t count = (length > 0) ? 2 : 1;
+
+	/** Mark the RRC session so that its radio-on time is attributed to
+	 *  this mode when +CSCON reports the release
+	 */
+	_rrc_session_modes |= confirmable ? 2 : 1;
+
+	if(confirmable)
+	{
+		TP_CoAP_Response response = {};
+		status = coap_exchange(entry.socket, entry.ipv4, entry.port, segments, count, message_id, token, 
+							   nullptr, 0, response);
+	}
+	else
+	{
+		status = udp_sendto(entry.socket, entry.ipv4, entry.port, segments, count);
+	}
+
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		stats.failed++;
+		return status;
+	}
+
+	uint32_t elapsed_ms = (uint32_t)(now_ms() - start_ms);
+	stats.sent++;
+	stats.last_ms = elapsed_ms;
+	stats.total_ms += elapsed_ms;
+	if(elapsed_ms > stats.max_ms)
+	{
+		stats.max_ms = elapsed_ms;
+	}
+
+	if(confirmable)
+	{
+		entry.last_confirmed_ms = now_ms();
+		confirmed = true;
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Close a stream and free its slot
+ *
+ * @param stream Handle returned by coap_stream_open()
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::coap_stream_close(int stream)
+{
+	if(stream < 0 || stream >= NBIOT_COAP_STREAMS || !_coap_streams[stream].active)
+	{
+		return TP_NBIoT_Interface::INVALID_STREAM;
+	}
+
+	_coap_streams[stream].active = false;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Retrieve the latency and radio-on counters for one uplink mode
+ *
+ * @param confirmable True for confirmable uplinks, false for 
+ *                    non-confirmable
+ * @param &stats Address of TP_Uplink_Mode_Stats in which to store the counters
+ * @return None
+ */
+void TP_NBIoT_Interface::get_uplink_mode_stats(bool confirmable, TP_Uplink_Mode_Stats &stats)
+{
+	stats = _uplink_mode_stats[confirmable ? 1 : 0];
+}
+
+/** Write a GPRS timer as the 8-character binary string expected by the
+ *  modem, i.e. unit 0b101 with 10 multiples = "10101010"
+ * 
+ * @param unit_bits 3-bit timer unit field
+ * @param multiples 5-bit timer value
+ * @param *timer Pointer to a char array of at least 9 bytes to which
+ *               to write the null-terminated binary string
+ * @return None
+ */
+void TP_NBIoT_Interface::encode_gprs_timer(uint8_t unit_bits, uint8_t multiples, char *timer)
+{
+    encode_bits((uint8_t)((unit_bits << 5) | (multiples & 0x1F)), 8, timer);
+}
+
+/** Parse the 8-character binary string reported by the modem for a GPRS
+ *  timer into its unit field and multiples in a single pass
+ * 
+ * @param *timer Pointer to the binary string returned by the modem
+ * @param &unit_bits Address of uint8_t in which to store the 3-bit unit field
+ * @param &multiples Address of uint8_t in which to store the 5-bit value
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::decode_gprs_timer(const char *timer, uint8_t &unit_bits, uint8_t &multiples)
+{
+    uint8_t value;
+
+    int status = decode_bits(timer, 8, value);
+    if(status != TP_NBIoT_Interface::NBIOT_OK)
+    {
+        return status;
+    }
+
+    unit_bits = value >> 5;
+    multiples = value & 0x1F;
+
+    return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Write the low bits of value as a null-terminated string of '0' and '1',
+ *  most significant bit first
+ * 
+ * @param value Value to encode
+ * @param bits Number of bits to write, no greater than 8
+ * @param *binary Pointer to a char array of at least bits + 1 bytes
+ * @return None
+ */
+void TP_NBIoT_Interface::encode_bits(uint8_t value, uint8_t bits, char *binary)
+{
+    for(uint8_t i = 0; i < bits; i++)
+    {
+        binary[i] = (value & (1 << (bits - 1 - i))) ? '1' : '0';
+    }
+
+    binary[bits] = '\0';
+}
+
+/** Parse a string of '0' and '1', most significant bit first, in a single pass
+ * 
+ * @param *binary Pointer to the binary string
+ * @param bits Number of characters to parse, no greater than 8
+ * @param &value Address of uint8_t in which to store the parsed value
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::decode_bits(const char *binary, uint8_t bits, uint8_t &value)
+{
+    value = 0;
+
+    for(uint8_t i = 0; i < bits; i++)
+    {
+        if(binary[i] != '0' && binary[i] != '1')
+        {
+            return TP_NBIoT_Interface::INVALID_UNIT_VALUE;
+        }
+
+        value = (uint8_t)((value << 1) | (binary[i] - '0'));
+    }
+
+    return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Current time in milliseconds from the attached clock
+ *
+ * @return Milliseconds since an arbitrary epoch
+ */
+uint64_t TP_NBIoT_Interface::now_ms()
+{
+	if(_clock)
+	{
+		return _clock();
+	}
+
+	return Kernel::get_ms_count();
+}
+
+/** Sleep for the given period using the attached sleep function
+ *
+ * @param ms Period in milliseconds
+ * @return None
+ */
+void TP_NBIoT_Interface::sleep_ms(uint32_t ms)
+{
+	if(_sleep)
+	{
+		_sleep(ms);
+		return;
+	}
+
+	ThisThread::sleep_for(ms);
+}
+
+/** Decide whether a failed modem transaction is worth repeating. Codes
+ *  from DRIVER_UNKNOWN upwards are produced by this interface from its
+ *  own checks and will fail identically every time; anything below is
+ *  from the driver, i.e. an ERROR or a timed out response
+ *
+ * @param status Status returned by the failed transaction
+ * @return True if the transaction may succeed on another attempt
+ */
+bool TP_NBIoT_Interface::is_retryable(int status)
+{
+	return status != TP_NBIoT_Interface::NBIOT_OK && status < TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Next value from the per-instance xorshift32 generator, seeded on 
+ *  first use from the hardware RNG, if any, and the clock
+ *
+ * @return Pseudo-random value
+ */
+uint32_t TP_NBIoT_Interface::next_random()
+{
+	if(_random_state == 0)
+	{
+		uint32_t seed = (uint32_t)now_ms();
+
+		#if DEVICE_TRNG
+			trng_t trng;
+			uint32_t entropy = 0;
+			size_t output_length = 0;
+
+			trng_init(&trng);
+			trng_get_bytes(&trng, (uint8_t*)&entropy, sizeof(entropy), &output_length);
+			trng_free(&trng);
+
+			seed ^= entropy;
+		#endif /* #if DEVICE_TRNG */
+
+		_random_state = (seed != 0) ? seed : 0x9E3779B9;
+	}
+
+	_random_state ^= _random_state << 13;
+	_random_state ^= _random_state >> 17;
+	_random_state ^= _random_state << 5;
+
+	return _random_state;
+}
+
+/** Mix the modem IMEI into the random generator so that its sequence
+ *  differs between devices. Called once the modem answers AT
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::seed_random_from_imei()
+{
+	if(_random_imei_seeded)
+	{
+		return;
+	}
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		char imei[NBIOT_IMEI_LENGTH + 1] = {};
+		int status = retry(TP_Modem_Call::STATUS_QUERY, [&]()
+		{
+			return _modem.get_imei(imei);
+		});
+
+		if(status == TP_NBIoT_Interface::NBIOT_OK)
+		{
+			seed_random(crc32((const uint8_t*)imei, strlen(imei)));
+			_random_imei_seeded = true;
+		}
+	}
+}
+
+/** Fetch a cached status value if it is within the configured max age
+ *
+ * @param &state Cached value to read
+ * @param &value Address of integer in which to store the cached value
+ * @return True if value was populated from the cache
+ */
+bool TP_NBIoT_Interface::read_cached_state(const Cached_State &state, int &value)
+{
+	if(!state.valid || _status_cache_max_age_ms == 0)
+	{
+		return false;
+	}
+
+	if(now_ms() - state.updated_ms > _status_cache_max_age_ms)
+	{
+		return false;
+	}
+
+	value = state.value;
+	return true;
+}
+
+/** Store a freshly observed status value in the cache
+ *
+ * @param &state Cached value to update
+ * @param value Value observed from a query or URC
+ * @return None
+ */
+void TP_NBIoT_Interface::write_cached_state(Cached_State &state, int value)
+{
+	state.value = value;
+	state.updated_ms = now_ms();
+	state.valid = true;
+}
+
+/** Handler for the +CSCON URC
+ *
+ * @param connected 1 if RRC connected, 0 if released
+ * @return None
+ */
+void TP_NBIoT_Interface::cscon_handler(int connected)
+{
+	/** T3412 and T3324 both start when the RRC connection is released
+	 */
+	/** Session edges are tracked here rather than from _connected_state,
+	 *  which invalidate_status_cache() and queries can change mid-session
+	 */
+	if(connected == 0 && _rrc_connected)
+	{
+		_rrc_release_ms = now_ms();
+		_rrc_release_valid = true;
+
+		/** A session carrying any confirmable uplink is charged to the
+		 *  confirmable mode, since it was held open for the response
+		 */
+		if(_rrc_session_modes != 0)
+		{
+			TP_Uplink_Mode_Stats &stats = _uplink_mode_stats[(_rrc_session_modes & 2) ? 1 : 0];
+			stats.radio_sessions++;
+			stats.radio_on_ms += _rrc_release_ms - _rrc_connect_ms;
+		}
+
+		_rrc_session_modes = 0;
+	}
+	else if(connected == 1 && !_rrc_connected)
+	{
+		_rrc_connect_ms = now_ms();
+	}
+
+	_rrc_connected = (connected == 1);
+
+	write_cached_state(_connected_state, connected);
+}
+
+/** Handler for the +CEREG URC
+ *
+ * @param registered Network registration status
+ * @return None
+ */
+void TP_NBIoT_Interface::cereg_handler(int registered)
+{
+	write_cached_state(_registered_state, registered);
+}
+
+/** Handler for the +NPSMR URC
+ *
+ * @param psm 1 if the modem has entered PSM, 0 if it has left
+ * @return None
+ */
+void TP_NBIoT_Interface::npsmr_handler(int psm)
+{
+	write_cached_state(_psm_state, psm);
+}
+
+/** Interrupt handler for both edges of VINT
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::vint_handler()
+{
+	_vint_level = _vint.read();
+}
+
+/** Handler for the PSM timers carried in an extended +CEREG URC
+ *
+ * @param *active_time Granted T3324 as binary string
+ * @param *periodic_tau Granted T3412 as binary string
+ * @return None
+ */
+void TP_NBIoT_Interface::cereg_timers_handler(const char *active_time, const char *periodic_tau)
+{
+	store_granted_timers(active_time, periodic_tau);
+}
+
+/** Decode network-granted timers into _psm_timers, update the uplink
+ *  scheduler and raise the divergence callback if the grant has changed
+ *  and differs from the request. Empty strings mean the network hasn't
+ *  granted PSM, in which case the granted values are cleared and the
+ *  scheduler falls back to the requested ones
+ *
+ * @param *active_time Granted T3324 as binary string
+ * @param *periodic_tau Granted T3412 as binary string
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::store_granted_timers(const char *active_time, const char *periodic_tau)
+{
+	if(active_time == nullptr || periodic_tau == nullptr || active_time[0] == '\0' || periodic_tau[0] == '\0')
+	{
+		_psm_timers.granted_tau_unit = T3412_units::INVALID;
+		_psm_timers.granted_tau_multiples = 0;
+		_psm_timers.granted_tau_s = 0;
+		_psm_timers.granted_active_unit = T3324_units::INVALID;
+		_psm_timers.granted_active_multiples = 0;
+		_psm_timers.granted_active_s = 0;
+		_psm_timers_granted_valid = false;
+
+		if(_psm_timers_requested_valid)
+		{
+			_t3412_s = _psm_timers.requested_tau_s;
+			_t3324_s = _psm_timers.requested_active_s;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	uint8_t tau_bits;
+	uint8_t tau_multiples;
+	uint8_t active_bits;
+	uint8_t active_multiples;
+
+	int status = decode_gprs_timer(periodic_tau, tau_bits, tau_multiples);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	status = decode_gprs_timer(active_time, active_bits, active_multiples);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	uint32_t previous_tau_s = _psm_timers.granted_tau_s;
+	uint32_t previous_active_s = _psm_timers.granted_active_s;
+	bool previous_valid = _psm_timers_granted_valid;
+
+	_psm_timers.granted_tau_unit = t3412_units_from_bits[tau_bits];
+	_psm_timers.granted_tau_multiples = tau_multiples;
+	_psm_timers.granted_tau_s = t3412_to_seconds(_psm_timers.granted_tau_unit, tau_multiples);
+	_psm_timers.granted_active_unit = t3324_units_from_bits[active_bits];
+	_psm_timers.granted_active_multiples = active_multiples;
+	_psm_timers.granted_active_s = t3324_to_seconds(_psm_timers.granted_active_unit, active_multiples);
+
+	/** The network's values are the ones the modem actually runs with
+	 */
+	_t3412_s = _psm_timers.granted_tau_s;
+	_t3324_s = _psm_timers.granted_active_s;
+	_psm_timers_granted_valid = true;
+
+	/** Every +CEREG URC repeats the grant, so only report a new one
+	 */
+	bool changed = !previous_valid || _psm_timers.granted_tau_s != previous_tau_s || 
+				   _psm_timers.granted_active_s != previous_active_s;
+
+	if(changed && _psm_timers_requested_valid && _psm_divergence_callback &&
+	  (_psm_timers.granted_tau_s != _psm_timers.requested_tau_s || 
+	   _psm_timers.granted_active_s != _psm_timers.requested_active_s))
+	{
+		_psm_divergence_callback(_psm_timers);
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Read the T3412 and T3324 values requested by the device into
+ *  _psm_timers
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::read_requested_timers()
+{
+	T3412_units tau_unit;
+	T3324_units active_unit;
+	uint8_t tau_multiples;
+	uint8_t active_multiples;
+
+	int status = get_tau_timer(tau_unit, tau_multiples);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	status = get_active_time(active_unit, active_multiples);
+	if(status != TP_NBIoT_Interface::NBIOT_OK)
+	{
+		return status;
+	}
+
+	_psm_timers.requested_tau_unit = tau_unit;
+	_psm_timers.requested_tau_multiples = tau_multiples;
+	_psm_timers.requested_tau_s = t3412_to_seconds(tau_unit, tau_multiples);
+	_psm_timers.requested_active_unit = active_unit;
+	_psm_timers.requested_active_multiples = active_multiples;
+	_psm_timers.requested_active_s = t3324_to_seconds(active_unit, active_multiples);
+	_psm_timers_requested_valid = true;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Map radio connection, network registration and PSM status to the
+ *  u-blox defined connection status
+ *
+ * @param connected 1 if RRC connected, 0 if released
+ * @param registered Network registration status
+ * @param psm 1 if in PSM, 0 if active
+ * @return Connection status
+ */
+TP_NBIoT_Interface::TP_Connection_Status TP_NBIoT_Interface::classify_connection(int connected, int registered, int psm)
+{
+	if(registered == 0 && connected == 0 && psm == 0)
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_NO_NETWORK_ACTIVITY;
+	}
+	else if(registered == 2 && connected == 0 && psm == 0)
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_SCANNING_FOR_BASE_STATION;
+	}
+	else if(registered == 2 && connected == 1 && psm == 0)
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_STARTING_REGISTRATION;
+	}
+	else if((registered == 1 || registered == 5) && (connected == 1 && psm == 0))
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_REGISTERED_RRC_CONNECTED;
+	}
+	else if((registered == 1 || registered == 5) && (connected == 0 && psm == 0))
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::ACTIVE_REGISTERED_RRC_RELEASED;
+	}
+	else if((registered == 1 || registered == 5) && (connected == 0 && psm == 1))
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::PSM_REGISTERED;
+	}
+	else if(registered == 3)
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::REGISTRATION_FAILED;
+	}
+	else
+	{
+		return TP_NBIoT_Interface::TP_Connection_Status::STATE_UNDEFINED;
+	}
+}
+
+/** Map an EARFCN to its LTE band
+ *
+ * @param earfcn LTE channel number
+ * @return Band, BAND_UNKNOWN if outside band 8 and band 20
+ */
+TP_NBIoT_Interface::TP_NBIoT_Band TP_NBIoT_Interface::band_from_earfcn(int earfcn)
+{
+	if(earfcn >= EARFCN_B8_LOW && earfcn <= EARFCN_B8_HIGH)
+	{
+		return TP_NBIoT_Interface::TP_NBIoT_Band::BAND_8;
+	}
+	else if(earfcn >= EARFCN_B20_LOW && earfcn <= EARFCN_B20_HIGH)
+	{
+		return TP_NBIoT_Interface::TP_NBIoT_Band::BAND_20;
+	}
+	else 
+	{
+		return TP_NBIoT_Interface::TP_NBIoT_Band::BAND_UNKNOWN;
+	}
+}
+
+/** Convert T3412 units and multiples to seconds
+ *
+ * @param unit Timer unit
+ * @param multiples Multiples of unit
+ * @return Timer period in seconds, 0 if deactivated or invalid
+ */
+uint32_t TP_NBIoT_Interface::t3412_to_seconds(T3412_units unit, uint8_t multiples)
+{
+	if((int)unit < 0 || (int)unit >= (int)T3412_units::INVALID)
+	{
+		return 0;
+	}
+
+	return t3412_unit_seconds[(int)unit] * multiples;
+}
+
+/** Convert T3324 units and multiples to seconds
+ *
+ * @param unit Timer unit
+ * @param multiples Multiples of unit
+ * @return Timer period in seconds, 0 if deactivated or invalid
+ */
+uint32_t TP_NBIoT_Interface::t3324_to_seconds(T3324_units unit, uint8_t multiples)
+{
+	if((int)unit < 0 || (int)unit >= (int)T3324_units::INVALID)
+	{
+		return 0;
+	}
+
+	return t3324_unit_seconds[(int)unit] * multiples;
+}
+
+/** Handler for the +NSONMI URC, forwards the notification
+ *  to the application callback if one has been attached
+ *
+ * @param socket Socket number on which data has arrived
+ * @param length Number of bytes available to read
+ * @return None
+ */
+void TP_NBIoT_Interface::nsonmi_handler(int socket, int length)
+{
+	if(socket >= 0 && socket < NBIOT_UDP_MAX_SOCKETS && (_downlink_sockets & (1 << socket)))
+	{
+		_downlink_pending[socket] = true;
+		return;
+	}
+
+	if(_udp_callback)
+	{
+		_udp_callback(socket, length);
+	}
+}
+
+/** Read datagrams waiting on listening sockets into free receive
+ *  buffers, then queue each one or hand it to the downlink callback
+ *
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::collect_downlinks()
+{
+	int result = TP_NBIoT_Interface::NBIOT_OK;
+
+	for(int socket = 0; socket < NBIOT_UDP_MAX_SOCKETS; socket++)
+	{
+		while(_downlink_pending[socket])
+		{
+			int buffer = -1;
+			uint8_t in_use = 0;
+			for(int i = 0; i < NBIOT_DOWNLINK_BUFFERS; i++)
+			{
+				if(_downlink_in_use[i])
+				{
+					in_use++;
+				}
+				else if(buffer < 0)
+				{
+					buffer = i;
+				}
+			}
+
+			/** Leave the datagram at the modem rather than discard it, it is
+			 *  collected once the application releases a buffer
+			 */
+			if(buffer < 0)
+			{
+				if(!_downlink_blocked[socket])
+				{
+					_downlink_blocked[socket] = true;
+					_downlink_stats.overflows++;
+				}
+				return result;
+			}
+
+			_downlink_blocked[socket] = false;
+
+			TP_Downlink_Message *message = &_downlink_pool[buffer];
+			size_t remaining = 0;
+
+			int status = retry(TP_Modem_Call::SOCKET, [&]()
+			{
+				return _modem.nsorf(socket, message->ipv4, message->port, message->data, 
+									NBIOT_UDP_MAX_DATAGRAM, message->length, remaining);
+			}, false);
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				_downlink_stats.dropped++;
+				_downlink_pending[socket] = false;
+				result = status;
+				break;
+			}
+
+			_downlink_pending[socket] = (remaining > 0);
+
+			if(message->length == 0)
+			{
+				continue;
+			}
+
+			message->socket = socket;
+			_downlink_in_use[buffer] = true;
+			_downlink_stats.received++;
+			if(in_use + 1 > _downlink_stats.peak_in_use)
+			{
+				_downlink_stats.peak_in_use = in_use + 1;
+			}
+
+			/** CoAP responses and notifications are handled here and the
+			 *  buffer returned straight away
+			 */
+			if(dispatch_coap(message))
+			{
+				_downlink_in_use[buffer] = false;
+				continue;
+			}
+
+			if(_downlink_callback)
+			{
+				_downlink_callback(message);
+			}
+			else
+			{
+				uint8_t tail = (_downlink_queue_head + _downlink_queue_count) % NBIOT_DOWNLINK_BUFFERS;
+				_downlink_queue[tail] = (uint8_t)buffer;
+				_downlink_queue_count++;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Forget every socket the modem closed when it restarted: listening
+ *  and CoAP sockets, Observe registrations and open NON streams.
+ *  Downlink messages already in the pool are kept. An RRC session in
+ *  progress ended with the restart and is not charged to either mode
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::drop_socket_state()
+{
+	_downlink_sockets = 0;
+	_coap_sockets = 0;
+	_rrc_connected = false;
+	_rrc_session_modes = 0;
+
+	for(int i = 0; i < NBIOT_UDP_MAX_SOCKETS; i++)
+	{
+		_downlink_pending[i] = false;
+		_downlink_blocked[i] = false;
+	}
+
+	for(int i = 0; i < NBIOT_COAP_OBSERVATIONS; i++)
+	{
+		_coap_observations[i].active = false;
+	}
+
+	for(int i = 0; i < NBIOT_COAP_STREAMS; i++)
+	{
+		_coap_streams[i].active = false;
+	}
+}
+
+/** Encode a CoAP request header with the given token and options
+ *
+ * @param *buffer Pointer to a byte array in which to build the message
+ * @param buffer_len Size of buffer in bytes
+ * @param type COAP_TYPE_CON or COAP_TYPE_NON
+ * @param code Request method code, i.e. COAP_CODE_GET
+ * @param message_id CoAP message ID
+ * @param *token Pointer to NBIOT_COAP_TOKEN_LENGTH token bytes
+ * @param *etag Pointer to an ETag to send, nullptr for none
+ * @param etag_length Number of bytes in etag
+ * @param observe Observe option value, negative to omit the option
+ * @param *uri Pointer to a null-terminated path, split into Uri-Path options
+ * @param payload True to end the header with the payload marker, the
+ *                payload itself is sent as a separate segment
+ * @param &length Address of size_t in which to store the header length
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::encode_coap_request(uint8_t *buffer, size_t buffer_len, uint8_t type, uint8_t code, 
+											uint16_t message_id, const uint8_t *token, const uint8_t *etag, 
+											uint8_t etag_length, int32_t observe, const char *uri, bool payload, 
+											size_t &length)
+{
+	if(buffer_len < 4 + NBIOT_COAP_TOKEN_LENGTH)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	buffer[0] = (uint8_t)(0x40 | (type << 4) | NBIOT_COAP_TOKEN_LENGTH);
+	buffer[1] = code;
+	buffer[2] = (uint8_t)(message_id >> 8);
+	buffer[3] = (uint8_t)(message_id & 0xFF);
+	memcpy(&buffer[4], token, NBIOT_COAP_TOKEN_LENGTH);
+
+	size_t offset = 4 + NBIOT_COAP_TOKEN_LENGTH;
+	uint16_t last_number = 0;
+	int status = -1;
+
+	if(etag != nullptr && etag_length > 0)
+	{
+		status = encode_coap_option(buffer, buffer_len, offset, last_number, COAP_OPTION_ETAG, etag, etag_length);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+	}
+
+	if(observe >= 0)
+	{
+		/** Option values are unsigned integers with leading zero bytes
+		 *  removed, so 0 is sent as an empty option
+		 */
+		uint8_t value[3] = { (uint8_t)(observe >> 16), (uint8_t)(observe >> 8), (uint8_t)observe };
+		uint8_t skip = 0;
+		while(skip < 3 && value[skip] == 0)
+		{
+			skip++;
+		}
+
+		status = encode_coap_option(buffer, buffer_len, offset, last_number, COAP_OPTION_OBSERVE, 
+									&value[skip], 3 - skip);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+	}
+
+	const char *segment = uri;
+	while(*segment != '\0')
+	{
+		const char *end = segment;
+		while(*end != '\0' && *end != '/')
+		{
+			end++;
+		}
+
+		if(end > segment)
+		{
+			status = encode_coap_option(buffer, buffer_len, offset, last_number, COAP_OPTION_URI_PATH,
+										(const uint8_t *)segment, end - segment);
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				return status;
+			}
+		}
+
+		segment = (*end == '/') ? end + 1 : end;
+	}
+
+	if(payload)
+	{
+		if(offset + 1 > buffer_len)
+		{
+			return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+		}
+
+		buffer[offset++] = 0xFF;
+	}
+
+	length = offset;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Append a single CoAP option to a message being encoded
+ *
+ * @param *buffer Pointer to the message
+ * @param buffer_len Size of buffer in bytes
+ * @param &offset Address of the write position, advanced past the option
+ * @param &last_number Address of the previous option number, updated
+ * @param number Option number, no less than last_number
+ * @param *value Pointer to the option value
+ * @param value_length Number of bytes in value
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::encode_coap_option(uint8_t *buffer, size_t buffer_len, size_t &offset, uint16_t &last_number,
+										   uint16_t number, const uint8_t *value, size_t value_length)
+{
+	uint16_t fields[2] = { (uint16_t)(number - last_number), (uint16_t)value_length };
+	uint8_t nibbles[2];
+	uint8_t extended[4];
+	uint8_t extended_length = 0;
+
+	/** Delta and length are each 4 bits, extended by one byte from 13 
+	 *  or two bytes from 269
+	 */
+	for(int i = 0; i < 2; i++)
+	{
+		if(fields[i] < 13)
+		{
+			nibbles[i] = (uint8_t)fields[i];
+		}
+		else if(fields[i] < 269)
+		{
+			nibbles[i] = 13;
+			extended[extended_length++] = (uint8_t)(fields[i] - 13);
+		}
+		else
+		{
+			nibbles[i] = 14;
+			extended[extended_length++] = (uint8_t)((fields[i] - 269) >> 8);
+			extended[extended_length++] = (uint8_t)((fields[i] - 269) & 0xFF);
+		}
+	}
+
+	if(offset + 1 + extended_length + value_length > buffer_len)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	buffer[offset++] = (uint8_t)((nibbles[0] << 4) | nibbles[1]);
+	memcpy(&buffer[offset], extended, extended_length);
+	offset += extended_length;
+	memcpy(&buffer[offset], value, value_length);
+	offset += value_length;
+
+	last_number = number;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Parse the fields of a received CoAP message that this interface uses
+ *
+ * @param *data Pointer to the received datagram
+ * @param length Number of bytes in data
+ * @param &type Address of uint8_t in which to store the message type
+ * @param &message_id Address of uint16_t in which to store the message ID
+ * @param &token Address of pointer in which to store the token position
+ * @param &token_length Address of uint8_t in which to store the token length
+ * @param &response Address of TP_CoAP_Response in which to store the code,
+ *                  ETag, Observe option and payload
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::decode_coap(const uint8_t *data, size_t length, uint8_t &type, uint16_t &message_id, 
+									const uint8_t *&token, uint8_t &token_length, TP_CoAP_Response &response)
+{
+	if(length < 4 || (data[0] >> 6) != 1)
+	{
+		return TP_NBIoT_Interface::COAP_MALFORMED;
+	}
+
+	type = (data[0] >> 4) & 0x03;
+	token_length = data[0] & 0x0F;
+	response.code = (data[1] >> 5) * 100 + (data[1] & 0x1F);
+	message_id = (uint16_t)((data[2] << 8) | data[3]);
+
+	if(token_length > 8 || 4 + (size_t)token_length > length)
+	{
+		return TP_NBIoT_Interface::COAP_MALFORMED;
+	}
+
+	token = &data[4];
+	response.etag_length = 0;
+	response.observe_present = false;
+	response.observe = 0;
+	response.payload = nullptr;
+	response.payload_length = 0;
+
+	size_t offset = 4 + token_length;
+	uint16_t number = 0;
+
+	while(offset < length)
+	{
+		uint8_t header = data[offset++];
+		if(header == 0xFF)
+		{
+			if(offset == length)
+			{
+				return TP_NBIoT_Interface::COAP_MALFORMED;
+			}
+
+			response.payload = &data[offset];
+			response.payload_length = length - offset;
+			break;
+		}
+
+		uint16_t fields[2] = { (uint16_t)(header >> 4), (uint16_t)(header & 0x0F) };
+		for(int i = 0; i < 2; i++)
+		{
+			if(fields[i] == 13 && offset + 1 <= length)
+			{
+				fields[i] = 13 + data[offset];
+				offset += 1;
+			}
+			else if(fields[i] == 14 && offset + 2 <= length)
+			{
+				fields[i] = 269 + ((data[offset] << 8) | data[offset + 1]);
+				offset += 2;
+			}
+			else if(fields[i] >= 13)
+			{
+				return TP_NBIoT_Interface::COAP_MALFORMED;
+			}
+		}
+
+		number += fields[0];
+		if(offset + fields[1] > length)
+		{
+			return TP_NBIoT_Interface::COAP_MALFORMED;
+		}
+
+		if(number == COAP_OPTION_ETAG && fields[1] <= NBIOT_COAP_ETAG_MAX)
+		{
+			memcpy(response.etag, &data[offset], fields[1]);
+			response.etag_length = (uint8_t)fields[1];
+		}
+		else if(number == COAP_OPTION_OBSERVE && fields[1] <= 3)
+		{
+			for(uint16_t i = 0; i < fields[1]; i++)
+			{
+				response.observe = (response.observe << 8) | data[offset + i];
+			}
+			response.observe_present = true;
+		}
+
+		offset += fields[1];
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Send a confirmable request and wait for its response, retransmitting
+ *  with exponential backoff until it is acknowledged. Responses are
+ *  matched by dispatch_coap() while process_urc() is polled. That runs
+ *  application callbacks, which must not start another exchange while
+ *  this one holds _coap_pending, so nested calls are refused
+ *
+ * @param socket Socket number returned by udp_open()
+ * @param *ipv4 Pointer to the server IPv4 address string
+ * @param port Server port
+ * @param *request Pointer to the segments making up the encoded request
+ * @param count Number of segments
+ * @param message_id Message ID of the request
+ * @param *token Pointer to the request token
+ * @param *payload Pointer to a byte array in which to store the response
+ *                 payload, nullptr to discard it
+ * @param buffer_len Size of payload in bytes
+ * @param &response Address of TP_CoAP_Response in which to store the response
+ * @return Indicates success or failure reason, COAP_BUSY if an exchange
+ *         is already in progress
+ */
+int TP_NBIoT_Interface::coap_exchange(int socket, char *ipv4, uint16_t port, const TP_Buffer_Segment *request, 
+									  uint8_t count, uint16_t message_id, const uint8_t *token, uint8_t *payload, 
+									  size_t buffer_len, TP_CoAP_Response &response)
+{
+	if(_coap_pending.active)
+	{
+		return TP_NBIoT_Interface::COAP_BUSY;
+	}
+
+	_coap_pending = {};
+	_coap_pending.socket = socket;
+	_coap_pending.message_id = message_id;
+	memcpy(_coap_pending.token, token, NBIOT_COAP_TOKEN_LENGTH);
+	_coap_pending.payload = payload;
+	_coap_pending.buffer_len = buffer_len;
+	_coap_pending.response = &response;
+	_coap_pending.active = true;
+
+	if(socket >= 0 && socket < NBIOT_UDP_MAX_SOCKETS)
+	{
+		_coap_sockets |= (uint8_t)(1 << socket);
+	}
+
+	uint32_t timeout_ms = NBIOT_COAP_ACK_TIMEOUT_MS;
+
+	for(int attempt = 0; attempt <= NBIOT_COAP_MAX_RETRANSMIT; attempt++)
+	{
+		/** Once acknowledged the server has the request and will send a 
+		 *  separate response, so only keep waiting
+		 */
+		if(!_coap_pending.acknowledged)
+		{
+			int status = udp_sendto(socket, ipv4, port, request, count);
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				_coap_pending.active = false;
+				return status;
+			}
+		}
+
+		uint64_t deadline = now_ms() + timeout_ms;
+		while(now_ms() < deadline)
+		{
+			process_urc();
+
+			if(_coap_pending.complete)
+			{
+				_coap_pending.active = false;
+				return _coap_pending.reset ? TP_NBIoT_Interface::FAIL_TO_CONNECT : TP_NBIoT_Interface::NBIOT_OK;
+			}
+
+			sleep_ms(NBIOT_COAP_POLL_INTERVAL_MS);
+		}
+
+		timeout_ms *= 2;
+	}
+
+	_coap_pending.active = false;
+
+	return TP_NBIoT_Interface::COAP_TIMEOUT;
+}
+
+/** Offer a downlink message to the CoAP client. Responses to a pending
+ *  exchange and Observe notifications are consumed and acknowledged, 
+ *  confirmable responses with an unknown token on a socket used by the
+ *  client are consumed and reset, anything else is left for the application
+ *
+ * @param *message Pointer to the received message
+ * @return True if the message was consumed
+ */
+bool TP_NBIoT_Interface::dispatch_coap(TP_Downlink_Message *message)
+{
+	uint8_t type = 0;
+	uint16_t message_id = 0;
+	const uint8_t *token = nullptr;
+	uint8_t token_length = 0;
+	TP_CoAP_Response response;
+
+	if(decode_coap(message->data, message->length, type, message_id, token, token_length, response) != NBIOT_OK)
+	{
+		return false;
+	}
+
+	bool consumed = false;
+	bool token_valid = (token_length == NBIOT_COAP_TOKEN_LENGTH);
+	CoAP_Pending &pending = _coap_pending;
+
+	if(pending.active && !pending.complete && message->socket == pending.socket)
+	{
+		if((type == COAP_TYPE_ACK || type == COAP_TYPE_RST) && message_id == pending.message_id)
+		{
+			pending.acknowledged = true;
+			consumed = true;
+
+			if(type == COAP_TYPE_RST)
+			{
+				pending.reset = true;
+				pending.complete = true;
+				return true;
+			}
+		}
+
+		/** Either piggybacked on the ACK or sent separately, in which case
+		 *  only the token ties it to the request
+		 */
+		if(response.code != 0 && token_valid && memcmp(token, pending.token, NBIOT_COAP_TOKEN_LENGTH) == 0)
+		{
+			*pending.response = response;
+			pending.response->payload = pending.payload;
+			pending.response->payload_length = 0;
+			if(pending.payload != nullptr && response.payload != nullptr)
+			{
+				size_t copied = (response.payload_length < pending.buffer_len) ? response.payload_length 
+																			   : pending.buffer_len;
+				memcpy(pending.payload, response.payload, copied);
+				pending.response->payload_length = copied;
+			}
+
+			pending.acknowledged = true;
+			pending.complete = true;
+			consumed = true;
+		}
+	}
+
+	for(int i = 0; i < NBIOT_COAP_OBSERVATIONS && response.code != 0 && token_valid; i++)
+	{
+		CoAP_Observation &entry = _coap_observations[i];
+		if(!entry.active || entry.socket != message->socket || 
+		   memcmp(token, entry.token, NBIOT_COAP_TOKEN_LENGTH) != 0)
+		{
+			continue;
+		}
+
+		consumed = true;
+
+		if(entry.cancelling)
+		{
+			break;
+		}
+
+		/** Notifications older than the last one delivered are dropped, using
+		 *  the 24-bit sequence comparison and 128 second window of RFC 7641
+		 */
+		uint64_t now = now_ms();
+		if(entry.notified && response.observe_present)
+		{
+			uint32_t v1 = entry.last_observe;
+			uint32_t v2 = response.observe;
+			bool fresh = (v1 < v2 && v2 - v1 < (1UL << 23)) || (v1 > v2 && v1 - v2 > (1UL << 23)) ||
+						 (now > entry.last_notified_ms + 128000);
+			if(!fresh)
+			{
+				break;
+			}
+		}
+
+		entry.notified = true;
+		entry.last_observe = response.observe;
+		entry.last_notified_ms = now;
+
+		/** A notification without Observe, or with an error code, ends the 
+		 *  observation at the server
+		 */
+		bool registering = pending.active && memcmp(token, pending.token, NBIOT_COAP_TOKEN_LENGTH) == 0;
+		if(!registering && (!response.observe_present || response.code / 100 != 2))
+		{
+			entry.active = false;
+		}
+
+		if(entry.callback)
+		{
+			entry.callback(response);
+		}
+
+		break;
+	}
+
+	if(consumed && type == COAP_TYPE_CON)
+	{
+		send_coap_empty(message, COAP_TYPE_ACK, message_id);
+	}
+	else if(!consumed && type == COAP_TYPE_CON && response.code / 100 >= 2 && token_valid &&
+			(_coap_sockets & (1 << message->socket)))
+	{
+		/** A confirmable response or notification nobody is waiting for,
+		 *  e.g. for a cancelled observation, is rejected so the server
+		 *  stops sending it (RFC 7641 section 3.6)
+		 */
+		send_coap_empty(message, COAP_TYPE_RST, message_id);
+		consumed = true;
+	}
+
+	return consumed;
+}
+
+/** Send an empty ACK or RST for a received confirmable message
+ *
+ * @param *message Pointer to the received message, used for the reply address
+ * @param type 2 for ACK, 3 for RST
+ * @param message_id Message ID being acknowledged or rejected
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::send_coap_empty(TP_Downlink_Message *message, uint8_t type, uint16_t message_id)
+{
+	uint8_t reply[4] = { (uint8_t)(0x40 | (type << 4)), 0, (uint8_t)(message_id >> 8), (uint8_t)(message_id & 0xFF) };
+
+	return udp_sendto(message->socket, message->ipv4, message->port, reply, sizeof(reply));
+}
+
+/** Fill a token with the next token value. Values whose first byte
+ *  falls in the NBIOT_COAP_STREAM_TOKEN range are skipped, as those
+ *  are reserved for coap_stream_send()
+ *
+ * @param *token Pointer to NBIOT_COAP_TOKEN_LENGTH bytes
+ * @return None
+ */
+void TP_NBIoT_Interface::next_coap_token(uint8_t *token)
+{
+	seed_coap_counters();
+
+	do
+	{
+		_coap_token++;
+	}
+	while((_coap_token & NBIOT_COAP_STREAM_TOKEN) == NBIOT_COAP_STREAM_TOKEN);
+
+	for(int i = 0; i < NBIOT_COAP_TOKEN_LENGTH; i++)
+	{
+		token[i] = (uint8_t)(_coap_token >> (8 * i));
+	}
+}
+
+/** Take the next CoAP message ID
+ *
+ * @return Message ID
+ */
+uint16_t TP_NBIoT_Interface::next_coap_message_id()
+{
+	seed_coap_counters();
+
+	return _coap_message_id++;
+}
+
+/** Seed the token and message ID counters on first use
+ *
+ * @return None
+ */
+void TP_NBIoT_Interface::seed_coap_counters()
+{
+	/** Start from a random point so tokens and message IDs from one boot
+	 *  are unlikely to match a previous one. This only holds where
+	 *  next_random() has per-boot entropy, from the hardware RNG or
+	 *  seed_random(), otherwise the sequence repeats each boot
+	 */
+	if(_coap_token == 0)
+	{
+		_coap_token = next_random();
+		_coap_message_id = (uint16_t)next_random();
+	}
+}
+
+/** Time a burst of +NUESTATS reads, each about NBIOT_NUESTATS_BYTES
+ *  on the UART, and report the bytes per second moved. The response
+ *  is large next to the command latency and involves no radio 
+ *  activity, so the figure follows the baud rate
+ *
+ * @param &bytes_per_s Address of uint32_t in which to store the 
+ *                     throughput, 0 if the burst took under 1 ms
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::measure_link_throughput(uint32_t &bytes_per_s)
+{
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		uint64_t start_ms = now_ms();
+
+		for(int i = 0; i < NBIOT_BAUD_PROBE_COUNT; i++)
+		{
+			status = get_nuestats(_nuestats.data);
+			if(status != TP_NBIoT_Interface::NBIOT_OK)
+			{
+				return status;
+			}
+		}
+
+		uint64_t elapsed_ms = now_ms() - start_ms;
+
+		bytes_per_s = (elapsed_ms > 0) ? 
+					  (uint32_t)(((uint64_t)NBIOT_BAUD_PROBE_COUNT * NBIOT_NUESTATS_BYTES * 1000) / elapsed_ms) : 0;
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Write IP address, port and URI to a CoAP profile and save it
+ *  to the modem's NVM in a single command line. Nothing is sent if
+ *  the profile is known to hold the same settings already, and the
+ *  first write to each profile after boot reads it back to find out
+ *
+ * @param profile CoAP profile number to write
+ * @param *ipv4 Pointer to a byte array storing the IPv4 address
+ * @param port Destination server port
+ * @param *uri Pointer to a byte array storing the URI
+ * @param uri_length Number of characters in URI
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::write_coap_profile(uint8_t profile, char *ipv4, uint16_t port, char *uri, uint8_t uri_length)
+{
+	if(uri_length > NBIOT_COAP_URI_MAX)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	int status = -1;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		uint8_t slot = profile - SaraN2::COAP_PROFILE_0;
+		uint32_t hash = hash_coap_profile(ipv4, port, uri, uri_length);
+
+		if(_coap_profile_hash[slot] == hash)
+		{
+			return TP_NBIoT_Interface::NBIOT_OK;
+		}
+
+		/** Profiles persist in NVM across reboots of either side, so a read
+		 *  is cheaper than rewriting a profile that may well be unchanged
+		 */
+		if(_coap_profile_hash[slot] == 0)
+		{
+			char stored_ipv4[16] = {};
+			uint16_t stored_port = 0;
+			uint8_t stored_length = 0;
+
+			status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+			{
+				return _modem.read_profile(profile, stored_ipv4, stored_port, _stored_uri, sizeof(_stored_uri), 
+										   stored_length);
+			});
+			if(status == TP_NBIoT_Interface::NBIOT_OK && 
+			   hash_coap_profile(stored_ipv4, stored_port, _stored_uri, stored_length) == hash)
+			{
+				_coap_profile_hash[slot] = hash;
+				return TP_NBIoT_Interface::NBIOT_OK;
+			}
+		}
+
+		/** Select, IP/port, URI, Uri-Path header, validity and NVM save in one 
+		 *  command line rather than six round trips
+		 */
+		_coap_profile_hash[slot] = 0;
+
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.write_profile(profile, ipv4, port, uri, uri_length);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		_coap_profile_hash[slot] = hash;
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** FNV-1a hash of a CoAP profile's settings, never 0 so that 0 can
+ *  mark a profile whose contents are unknown
+ *
+ * @param *ipv4 Pointer to the null-terminated IPv4 address string
+ * @param port Destination server port
+ * @param *uri Pointer to a byte array storing the URI
+ * @param uri_length Number of characters in URI
+ * @return Hash of the settings
+ */
+uint32_t TP_NBIoT_Interface::hash_coap_profile(const char *ipv4, uint16_t port, const char *uri, uint8_t uri_length)
+{
+	uint32_t hash = 2166136261UL;
+
+	auto add = [&hash](uint8_t byte)
+	{
+		hash = (hash ^ byte) * 16777619UL;
+	};
+
+	for(const char *c = ipv4; *c != '\0'; c++)
+	{
+		add((uint8_t)*c);
+	}
+
+	/** Separator, so that the address and port can't run together
+	 */
+	add(0);
+	add((uint8_t)(port >> 8));
+	add((uint8_t)(port & 0xFF));
+
+	for(uint8_t i = 0; i < uri_length; i++)
+	{
+		add((uint8_t)uri[i]);
+	}
+
+	return (hash == 0) ? 1 : hash;
+}
+
+/** CRC-32 (IEEE 802.3) of a byte array
+ *
+ * @param *data Pointer to the bytes
+ * @param length Number of bytes in data
+ * @return CRC of the bytes
+ */
+uint32_t TP_NBIoT_Interface::crc32(const uint8_t *data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for(size_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for(int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+
+	return ~crc;
+}
+
+/** Size of the Uri-Path options a request to this URI carries, assuming
+ *  single-byte option headers for the deltas
+ *
+ * @param *uri Pointer to a byte array storing the URI
+ * @param uri_length Number of characters in URI
+ * @return Number of bytes
+ */
+uint16_t TP_NBIoT_Interface::uri_path_option_bytes(const char *uri, uint8_t uri_length)
+{
+	const char *end = uri + uri_length;
+	const char *path = uri;
+
+	/** Skip the scheme and authority, the path starts at the next '/'
+	 */
+	for(const char *c = uri; c + 2 < end; c++)
+	{
+		if(c[0] == ':' && c[1] == '/' && c[2] == '/')
+		{
+			path = c + 3;
+			break;
+		}
+	}
+
+	while(path < end && *path != '/')
+	{
+		path++;
+	}
+
+	uint16_t bytes = 0;
+	const char *segment = path;
+
+	while(segment < end && *segment != '?' && *segment != '#')
+	{
+		segment++;
+
+		const char *segment_end = segment;
+		while(segment_end < end && *segment_end != '/' && *segment_end != '?' && *segment_end != '#')
+		{
+			segment_end++;
+		}
+
+		size_t length = segment_end - segment;
+		if(length > 0)
+		{
+			bytes += 1 + length + (length >= 13 ? 1 : 0);
+		}
+
+		segment = segment_end;
+	}
+
+	return bytes;
+}
+
+/** Ensure that a registered endpoint occupies a CoAP profile, evicting
+ *  the least recently used profile on a miss unless a free profile is
+ *  known to hold the endpoint's settings already, then load that profile
+ *  and select the CoAP AT interface ready for a request
+ *
+ * @param endpoint Handle returned by register_coap_endpoint()
+ * @return Indicates success or failure reason
+ */
+int TP_NBIoT_Interface::select_coap_endpoint(int endpoint)
+{
+	if(endpoint < 0 || endpoint >= NBIOT_COAP_MAX_ENDPOINTS || _coap_endpoints[endpoint].ipv4 == nullptr)
+	{
+		return TP_NBIoT_Interface::INVALID_ENDPOINT;
+	}
+
+	int slot = -1;
+	int victim = -1;
+
+	for(int i = 0; i < NBIOT_COAP_PROFILES; i++)
+	{
+		if(_coap_slots[i].endpoint == endpoint)
+		{
+			slot = i;
+			break;
+		}
+
+		if(_coap_slots[i].endpoint == COAP_SLOT_PINNED)
+		{
+			continue;
+		}
+
+		/** Prefer a free profile, otherwise the one used longest ago
+		 */
+		if(victim == -1 || 
+		  (_coap_slots[victim].endpoint != COAP_SLOT_FREE && 
+		  (_coap_slots[i].endpoint == COAP_SLOT_FREE || _coap_slots[i].last_used < _coap_slots[victim].last_used)))
+		{
+			victim = i;
+		}
+	}
+
+	int status = -1;
+
+	if(slot == -1)
+	{
+		if(victim == -1)
+		{
+			return TP_NBIoT_Interface::NO_FREE_ENDPOINT;
+		}
+
+		CoAP_Endpoint &ep = _coap_endpoints[endpoint];
+		char compact[32];
+		char *uri = ep.uri;
+		uint8_t uri_length = ep.uri_length;
+		if(ep.alias != 0)
+		{
+			int length = snprintf(compact, sizeof(compact), "coap://%s:%u/%c", ep.ipv4, ep.port, ep.alias);
+			if(length < 0 || length >= (int)sizeof(compact))
+			{
+				return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+			}
+
+			uri = compact;
+			uri_length = (uint8_t)length;
+		}
+
+		/** A free profile known to hold these settings already, i.e. after
+		 *  resume(), is taken first so it needn't be rewritten whatever
+		 *  order the endpoints were registered in
+		 */
+		uint32_t hash = hash_coap_profile(ep.ipv4, ep.port, uri, uri_length);
+		for(int i = 0; i < NBIOT_COAP_PROFILES; i++)
+		{
+			if(_coap_slots[i].endpoint == COAP_SLOT_FREE && _coap_profile_hash[i] == hash)
+			{
+				victim = i;
+				break;
+			}
+		}
+
+		/** Mark the profile free until it has been written successfully so that
+		 *  a partial write is never mistaken for a hit
+		 */
+		_coap_slots[victim].endpoint = COAP_SLOT_FREE;
+
+		status = write_coap_profile(SaraN2::COAP_PROFILE_0 + victim, ep.ipv4, ep.port, uri, uri_length);
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		_coap_slots[victim].endpoint = endpoint;
+		slot = victim;
+	}
+
+	_coap_slots[slot].last_used = ++_coap_lru_clock;
+	_coap_endpoints[endpoint].alias_saved_total += _coap_endpoints[endpoint].alias_saving;
+
+	if(_driver == TP_NBIoT_Interface::SARAN2)
+	{
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.load_profile(SaraN2::COAP_PROFILE_0 + slot);
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		status = retry(TP_Modem_Call::COAP_PROFILE, [&]()
+		{
+			return _modem.select_coap_at_interface();
+		});
+		if(status != TP_NBIoT_Interface::NBIOT_OK)
+		{
+			return status;
+		}
+
+		return TP_NBIoT_Interface::NBIOT_OK;
+	}
+
+	return TP_NBIoT_Interface::DRIVER_UNKNOWN;
+}
+
+/** Current virtual time in milliseconds
+ *
+ * @return Milliseconds since the clock was created
+ */
+uint64_t TP_Virtual_Clock::now()
+{
+	return _now_ms;
+}
+
+/** Advance virtual time by ms milliseconds
+ *
+ * @param ms Number of milliseconds to advance by
+ * @return None
+ */
+void TP_Virtual_Clock::sleep(uint32_t ms)
+{
+	_now_ms += ms;
+}
+
+/** Copy a sample's fields into the array order used by the codec
+ *
+ * @param &sample Sample to read
+ * @param *values Pointer to NBIOT_METRIC_FIELDS values
+ * @return None
+ */
+static void metric_fields(const TP_Metric_Store::TP_Metric_Sample &sample, uint32_t *values)
+{
+	values[0] = (uint32_t)sample.rsrp;
+	values[1] = (uint32_t)sample.rsrq;
+	values[2] = (uint32_t)sample.earfcn;
+	values[3] = (uint32_t)sample.ecl;
+	values[4] = (uint32_t)sample.registered;
+}
+
+/** Sign-extend the low bits of a value
+ *
+ * @param value Value whose low bits hold a two's complement number
+ * @param bits Width of the number
+ * @return Extended value
+ */
+static int32_t sign_extend(uint32_t value, uint8_t bits)
+{
+	uint32_t sign = (uint32_t)1 << (bits - 1);
+
+	return (int32_t)((value ^ sign) - sign);
+}
+
+/** Add a sample, starting a new block if it doesn't fit in the
+ *  current one
+ *
+ * @param &sample Sample to store, no older than the last one stored
+ * @return Indicates success or failure reason
+ */
+int TP_Metric_Store::append(const TP_Metric_Sample &sample)
+{
+	if(_count > 0)
+	{
+		Metric_Block &head = _blocks[(_first + _count - 1) % NBIOT_METRIC_BLOCKS];
+		if(sample.time_s < head.end_s)
+		{
+			return TP_NBIoT_Interface::SAMPLE_OUT_OF_ORDER;
+		}
+
+		if(encode(head, sample))
+		{
+			return TP_NBIoT_Interface::NBIOT_OK;
+		}
+	}
+
+	if(_count == NBIOT_METRIC_BLOCKS)
+	{
+		_first = (_first + 1) % NBIOT_METRIC_BLOCKS;
+		_count--;
+		_dropped++;
+	}
+
+	Metric_Block &block = _blocks[(_first + _count) % NBIOT_METRIC_BLOCKS];
+	block.start_s = sample.time_s;
+	block.end_s = sample.time_s;
+	block.count = 0;
+	block.bits = 0;
+	_count++;
+
+	if(!encode(block, sample))
+	{
+		_count--;
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Decode the stored samples taken within a time window, oldest first
+ *
+ * @param from_s Start of the window in seconds, inclusive
+ * @param to_s End of the window in seconds, inclusive
+ * @param *samples Pointer to an array in which to store the samples
+ * @param max_samples Number of elements in samples
+ * @param &count Address of size_t in which to store the number of
+ *               samples decoded
+ * @return Indicates success or failure reason, EXCEEDS_MAX_VALUE if
+ *         samples was too small to hold the whole window
+ */
+int TP_Metric_Store::query(uint32_t from_s, uint32_t to_s, TP_Metric_Sample *samples, size_t max_samples,
+						   size_t &count)
+{
+	count = 0;
+
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		const Metric_Block &block = _blocks[(_first + i) % NBIOT_METRIC_BLOCKS];
+		if(block.end_s < from_s || block.start_s > to_s)
+		{
+			continue;
+		}
+
+		Codec_State state;
+		uint16_t offset = 0;
+		for(uint16_t n = 0; n < block.count; n++)
+		{
+			TP_Metric_Sample sample;
+			decode(block, offset, state, sample);
+
+			if(sample.time_s < from_s || sample.time_s > to_s)
+			{
+				continue;
+			}
+
+			if(count == max_samples)
+			{
+				return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+			}
+
+			samples[count++] = sample;
+		}
+	}
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Serialise the blocks overlapping a time window, still compressed,
+ *  for upload. The blob is a version byte and a block count, then for
+ *  each block its start time, sample count and bit length, little-
+ *  endian, followed by the bitstream. Blocks are exported whole, so
+ *  the receiver trims samples outside the window
+ *
+ * @param from_s Start of the window in seconds, inclusive
+ * @param to_s End of the window in seconds, inclusive
+ * @param *buffer Pointer to a byte array in which to build the blob
+ * @param buffer_len Size of buffer in bytes
+ * @param &length Address of size_t in which to store the blob length
+ * @return Indicates success or failure reason
+ */
+int TP_Metric_Store::export_blocks(uint32_t from_s, uint32_t to_s, uint8_t *buffer, size_t buffer_len, size_t &length)
+{
+	length = 0;
+
+	if(buffer_len < 2)
+	{
+		return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+	}
+
+	buffer[0] = NBIOT_METRIC_FORMAT_VERSION;
+	buffer[1] = 0;
+	size_t offset = 2;
+
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		const Metric_Block &block = _blocks[(_first + i) % NBIOT_METRIC_BLOCKS];
+		if(block.end_s < from_s || block.start_s > to_s)
+		{
+			continue;
+		}
+
+		size_t data_length = (block.bits + 7) / 8;
+		if(offset + 8 + data_length > buffer_len)
+		{
+			return TP_NBIoT_Interface::EXCEEDS_MAX_VALUE;
+		}
+
+		for(int b = 0; b < 4; b++)
+		{
+			buffer[offset++] = (uint8_t)(block.start_s >> (8 * b));
+		}
+		buffer[offset++] = (uint8_t)block.count;
+		buffer[offset++] = (uint8_t)(block.count >> 8);
+		buffer[offset++] = (uint8_t)block.bits;
+		buffer[offset++] = (uint8_t)(block.bits >> 8);
+
+		memcpy(&buffer[offset], block.data, data_length);
+		offset += data_length;
+		buffer[1]++;
+	}
+
+	length = offset;
+
+	return TP_NBIoT_Interface::NBIOT_OK;
+}
+
+/** Discard every stored sample
+ *
+ * @return None
+ */
+void TP_Metric_Store::clear()
+{
+	_first = 0;
+	_count = 0;
+}
+
+/** Number of samples currently stored
+ *
+ * @return Sample count
+ */
+size_t TP_Metric_Store::sample_count()
+{
+	size_t samples = 0;
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		samples += _blocks[(_first + i) % NBIOT_METRIC_BLOCKS].count;
+	}
+
+	return samples;
+}
+
+/** Number of blocks dropped to make room for newer samples
+ *
+ * @return Dropped block count
+ */
+uint32_t TP_Metric_Store::dropped_blocks()
+{
+	return _dropped;
+}
+
+/** Encode a sample onto the end of a block. On failure the block
+ *  and encoder are left as they were
+ *
+ * @param &block Block to extend
+ * @param &sample Sample to encode
+ * @return True if the sample fitted
+ */
+bool TP_Metric_Store::encode(Metric_Block &block, const TP_Metric_Sample &sample)
+{
+	Codec_State saved = _encoder;
+	uint16_t saved_bits = block.bits;
+	bool fits = true;
+
+	uint32_t values[NBIOT_METRIC_FIELDS];
+	metric_fields(sample, values);
+
+	if(block.count == 0)
+	{
+		/** The first sample is stored in full, its time in the block header
+		 */
+		for(int f = 0; f < NBIOT_METRIC_FIELDS && fits; f++)
+		{
+			fits = write_bits(block, values[f], 32);
+			_encoder.values[f] = values[f];
+			_encoder.leading[f] = 0xFF;
+		}
+		_encoder.time_s = sample.time_s;
+		_encoder.delta = 0;
+	}
+	else
+	{
+		/** Timestamp delta-of-delta in Gorilla's variable-length buckets
+		 */
+		int32_t delta = (int32_t)(sample.time_s - _encoder.time_s);
+		int32_t dod = delta - _encoder.delta;
+
+		if(dod == 0)
+		{
+			fits = write_bits(block, 0x0, 1);
+		}
+		else if(dod >= -64 && dod <= 63)
+		{
+			fits = write_bits(block, 0x2, 2) && write_bits(block, (uint32_t)dod, 7);
+		}
+		else if(dod >= -256 && dod <= 255)
+		{
+			fits = write_bits(block, 0x6, 3) && write_bits(block, (uint32_t)dod, 9);
+		}
+		else if(dod >= -2048 && dod <= 2047)
+		{
+			fits = write_bits(block, 0xE, 4) && write_bits(block, (uint32_t)dod, 12);
+		}
+		else
+		{
+			fits = write_bits(block, 0xF, 4) && write_bits(block, (uint32_t)dod, 32);
+		}
+		_encoder.time_s = sample.time_s;
+		_encoder.delta = delta;
+
+		/** Each value as the XOR with its predecessor, reusing the previous
+		 *  leading/trailing zero window when the new bits fall inside it
+		 */
+		for(int f = 0; f < NBIOT_METRIC_FIELDS && fits; f++)
+		{
+			uint32_t xor_value = values[f] ^ _encoder.values[f];
+			_encoder.values[f] = values[f];
+
+			if(xor_value == 0)
+			{
+				fits = write_bits(block, 0x0, 1);
+				continue;
+			}
+
+			uint8_t leading = (uint8_t)__builtin_clz(xor_value);
+			uint8_t trailing = (uint8_t)__builtin_ctz(xor_value);
+
+			if(_encoder.leading[f] != 0xFF && leading >= _encoder.leading[f] && trailing >= _encoder.trailing[f])
+			{
+				uint8_t meaningful = 32 - _encoder.leading[f] - _encoder.trailing[f];
+				fits = write_bits(block, 0x2, 2) &&
+					   write_bits(block, xor_value >> _encoder.trailing[f], meaningful);
+			}
+			else
+			{
+				uint8_t meaningful = 32 - leading - trailing;
+				fits = write_bits(block, 0x3, 2) && write_bits(block, leading, 5) &&
+					   write_bits(block, meaningful - 1, 5) && write_bits(block, xor_value >> trailing, meaningful);
+				_encoder.leading[f] = leading;
+				_encoder.trailing[f] = trailing;
+			}
+		}
+	}
+
+	if(!fits)
+	{
+		_encoder = saved;
+		block.bits = saved_bits;
+		return false;
+	}
+
+	block.count++;
+	block.end_s = sample.time_s;
+
+	return true;
+}
+
+/** Decode the next sample from a block
+ *
+ * @param &block Block to read
+ * @param &offset Bit offset of the sample, advanced past it
+ * @param &state Decoder state, updated to this sample
+ * @param &sample Address of TP_Metric_Sample in which to store the sample
+ * @return None
+ */
+void TP_Metric_Store::decode(const Metric_Block &block, uint16_t &offset, Codec_State &state, TP_Metric_Sample &sample)
+{
+	if(offset == 0)
+	{
+		for(int f = 0; f < NBIOT_METRIC_FIELDS; f++)
+		{
+			state.values[f] = read_bits(block, offset, 32);
+			state.leading[f] = 0xFF;
+		}
+		state.time_s = block.start_s;
+		state.delta = 0;
+	}
+	else
+	{
+		int32_t dod = 0;
+		if(read_bits(block, offset, 1) == 0)
+		{
+			dod = 0;
+		}
+		else if(read_bits(block, offset, 1) == 0)
+		{
+			dod = sign_extend(read_bits(block, offset, 7), 7);
+		}
+		else if(read_bits(block, offset, 1) == 0)
+		{
+			dod = sign_extend(read_bits(block, offset, 9), 9);
+		}
+		else if(read_bits(block, offset, 1) == 0)
+		{
+			dod = sign_extend(read_bits(block, offset, 12), 12);
+		}
+		else
+		{
+			dod = (int32_t)read_bits(block, offset, 32);
+		}
+		state.delta += dod;
+		state.time_s += (uint32_t)state.delta;
+
+		for(int f = 0; f < NBIOT_METRIC_FIELDS; f++)
+		{
+			if(read_bits(block, offset, 1) == 0)
+			{
+				continue;
+			}
+
+			if(read_bits(block, offset, 1) == 1)
+			{
+				state.leading[f] = (uint8_t)read_bits(block, offset, 5);
+				uint8_t meaningful = (uint8_t)read_bits(block, offset, 5) + 1;
+				state.trailing[f] = 32 - state.leading[f] - meaningful;
+			}
+
+			uint8_t meaningful = 32 - state.leading[f] - state.trailing[f];
+			state.values[f] ^= read_bits(block, offset, meaningful) << state.trailing[f];
+		}
+	}
+
+	sample.time_s = state.time_s;
+	sample.rsrp = (int32_t)state.values[0];
+	sample.rsrq = (int32_t)state.values[1];
+	sample.earfcn = (int32_t)state.values[2];
+	sample.ecl = (int32_t)state.values[3];
+	sample.registered = (int32_t)state.values[4];
+}
+
+/** Append bits to a block, most significant first
+ *
+ * @param &block Block to extend
+ * @param value Value whose low bits are written
+ * @param bits Number of bits to write, no more than 32
+ * @return True if the bits fitted
+ */
+bool TP_Metric_Store::write_bits(Metric_Block &block, uint32_t value, uint8_t bits)
+{
+	if(block.bits + bits > NBIOT_METRIC_BLOCK_BYTES * 8)
+	{
+		return false;
+	}
+
+	for(int i = bits - 1; i >= 0; i--)
+	{
+		uint8_t mask = (uint8_t)(0x80 >> (block.bits % 8));
+		if((value >> i) & 1)
+		{
+			block.data[block.bits / 8] |= mask;
+		}
+		else
+		{
+			block.data[block.bits / 8] &= (uint8_t)~mask;
+		}
+		block.bits++;
+	}
+
+	return true;
+}
+
+/** Read bits from a block, most significant first
+ *
+ * @param &block Block to read
+ * @param &offset Bit offset, advanced past the bits read
+ * @param bits Number of bits to read, no more than 32
+ * @return Value read
+ */
+uint32_t TP_Metric_Store::read_bits(const Metric_Block &block, uint16_t &offset, uint8_t bits)
+{
+	uint32_t value = 0;
+	for(uint8_t i = 0; i < bits; i++)
+	{
+		value = (value << 1) | ((block.data[offset / 8] >> (7 - offset % 8)) & 1);
+		offset++;
+	}
+
+	return value;
 }
 
 #endif /* #if BOARD == WRIGHT_V1_0_0 || BOARD == DEVELOPMENT_BOARD_V1_1_0 */
@@ -1,6 +1,6 @@
 /**
   * @file    tp_nbiot_interface.h
-  * @version 0.4.0
+  * @version 0.5.0
   * @author  Adam Mitchell
   * @brief   Header file of the Thingpilot NB-IoT interface. This interface is hardware agnostic
   *          and depends on the underlying modem drivers exposing an identical interface
@@ -21,11 +21,298 @@
 #define EARFCN_B20_LOW  6150
 #define EARFCN_B20_HIGH 6449
 
+/** UDP socket #defines
+ */
+#define NBIOT_UDP_MAX_SOCKETS  7
+#define NBIOT_UDP_MAX_DATAGRAM 512
+
+/** CoAP endpoint registry #defines
+ */
+#define NBIOT_COAP_PROFILES      4
+#define NBIOT_COAP_MAX_ENDPOINTS 8
+#define NBIOT_COAP_RECV_MAX      512
+#define NBIOT_COAP_URI_MAX       200
+#define NBIOT_COAP_BLOCK_MAX     512
+#define NBIOT_BLOCK_PACING_MS    100
+
+/** UART baud rate negotiation #defines
+ */
+#define NBIOT_BAUD_REVERT_TIMEOUT_S 3
+#define NBIOT_BAUD_PROBE_COUNT      10
+#define NBIOT_NUESTATS_BYTES        200
+
+/** Uplink scheduler #defines
+ */
+#define NBIOT_DEFERRED_UPLINKS 4
+#define NBIOT_TAU_GUARD_MS     10000
+
+/** VINT power monitor #defines
+ */
+#define NBIOT_VINT_POLL_MS 10
+
+/** Recovery #defines. Each tier's wait for the modem to answer AT, and the
+ *  RESET_N low period, which the SARA-N2 requires to be at least 100 ms
+ */
+#define NBIOT_RECOVERY_PROBE_S    2
+#define NBIOT_RECOVERY_REBOOT_S   10
+#define NBIOT_RECOVERY_RESET_S    10
+#define NBIOT_RECOVERY_POWER_S    15
+#define NBIOT_RESET_PULSE_MS      200
+
+/** Attach profiler #defines. Histogram bucket 0 counts phases shorter than
+ *  1 s, bucket n phases from 2^(n-1) s up to 2^n s, and the last bucket 
+ *  everything longer
+ */
+#define NBIOT_START_HISTOGRAM_BUCKETS 10
+#define NBIOT_START_POLL_MS           2500
+
+/** Warm resume record #defines
+ */
+#define NBIOT_RESUME_MAGIC   0x54504E42
+#define NBIOT_RESUME_VERSION 1
+
+/** Length of the IMEI string read to seed the random generator
+ */
+#define NBIOT_IMEI_LENGTH 15
+
+/** Downlink receive pool #defines
+ */
+#ifndef NBIOT_DOWNLINK_BUFFERS
+	#define NBIOT_DOWNLINK_BUFFERS 4
+#endif /* #ifndef NBIOT_DOWNLINK_BUFFERS */
+
+/** CoAP over UDP #defines. Timing follows the RFC 7252 defaults
+ */
+#define NBIOT_COAP_OBSERVATIONS     2
+#define NBIOT_COAP_ETAG_MAX         8
+#define NBIOT_COAP_TOKEN_LENGTH     4
+#define NBIOT_COAP_ACK_TIMEOUT_MS   2000
+#define NBIOT_COAP_MAX_RETRANSMIT   4
+#define NBIOT_COAP_POLL_INTERVAL_MS 100
+#define NBIOT_COAP_REQUEST_MAX      128
+#define NBIOT_COAP_STREAMS          2
+#define NBIOT_COAP_STREAM_TOKEN     0xF0
+
+/** Layout version of TP_NBIoT_Interface::TP_Diagnostics, to be bumped
+ *  whenever a field is added, removed or reordered
+ */
+#define NBIOT_DIAGNOSTICS_VERSION 1
+
+/** Radio metric history #defines. The first sample in a block costs 20
+ *  bytes, later samples as little as 6 bits when nothing has changed
+ */
+#ifndef NBIOT_METRIC_BLOCKS
+	#define NBIOT_METRIC_BLOCKS 8
+#endif /* #ifndef NBIOT_METRIC_BLOCKS */
+
+#ifndef NBIOT_METRIC_BLOCK_BYTES
+	#define NBIOT_METRIC_BLOCK_BYTES 128
+#endif /* #ifndef NBIOT_METRIC_BLOCK_BYTES */
+
+#define NBIOT_METRIC_FIELDS         5
+#define NBIOT_METRIC_FORMAT_VERSION 1
+
+
+/** Lowest SARA-N2 driver API level this interface builds against. Level 2
+ *  adds the socket, URC, baud rate, flow control, eDRX, IMEI and CoAP 
+ *  profile read/write methods listed in the release notes, and its CoAP
+ *  requests take the size of the receive buffer
+ */
+#define NBIOT_SARAN2_DRIVER_API 2
+
 
 #if BOARD == WRIGHT_V1_0_0 || BOARD == DEVELOPMENT_BOARD_V1_1_0
 	#include "SaraN2Driver.h"
+
+	#if !defined(SARAN2_DRIVER_API) || SARAN2_DRIVER_API < NBIOT_SARAN2_DRIVER_API
+		#error "TP_NBIoT_Interface needs a SARA-N2 driver that defines SARAN2_DRIVER_API >= NBIOT_SARAN2_DRIVER_API"
+	#endif /* #if !defined(SARAN2_DRIVER_API) || SARAN2_DRIVER_API < NBIOT_SARAN2_DRIVER_API */
 #endif /* #if BOARD == WRIGHT_V1_0_0 || BOARD == DEVELOPMENT_BOARD_V1_1_0 */
 
+/** Discrete-event clock for running the interface against simulated time.
+ *  sleep() advances time instantly, so multi-day PSM/T3412 scenarios run as
+ *  fast as the modem can answer. Attach with TP_NBIoT_Interface::set_clock()
+ */
+class TP_Virtual_Clock
+{
+
+	public:
+
+		/** Current virtual time in milliseconds
+		 *
+		 * @return Milliseconds since the clock was created
+		 */
+		uint64_t now();
+
+		/** Advance virtual time by ms milliseconds
+		 *
+		 * @param ms Number of milliseconds to advance by
+		 * @return None
+		 */
+		void sleep(uint32_t ms);
+
+	private:
+
+		uint64_t _now_ms = 0;
+};
+
+/** Ring buffer of radio metric samples held in Gorilla-compressed blocks.
+ *  Within a block, timestamps are stored as delta-of-delta and each value
+ *  as the XOR with its predecessor, so a steady sampling interval and an
+ *  unchanged reading cost a single bit each. When every block is full the
+ *  oldest is dropped. The store is owned by the application, so it can be
+ *  placed in whatever RAM suits, and filled by 
+ *  TP_NBIoT_Interface::sample_metrics()
+ *
+ *  Sample times are seconds on a time base chosen by the application, and
+ *  must never go backwards for as long as the store is kept. Unix time from
+ *  the RTC suits a store held in retained RAM across MCU resets; uptime 
+ *  does not, since it restarts at zero and later samples are then refused
+ *  with SAMPLE_OUT_OF_ORDER. Query windows and uploaded block start times
+ *  are on the same time base
+ */
+class TP_Metric_Store
+{
+
+	public:
+
+		/** One sample. Signal fields are as reported by +NUESTATS, in tenths
+		 *  of a dB or dBm; registered is the +CEREG status
+		 */
+		struct TP_Metric_Sample
+		{
+			uint32_t time_s;
+			int32_t rsrp;
+			int32_t rsrq;
+			int32_t earfcn;
+			int32_t ecl;
+			int32_t registered;
+		};
+
+		/** Add a sample, starting a new block if it doesn't fit in the 
+		 *  current one
+		 *
+		 * @param &sample Sample to store, no older than the last one stored
+		 * @return Indicates success or failure reason
+		 */
+		int append(const TP_Metric_Sample &sample);
+
+		/** Decode the stored samples taken within a time window, oldest first
+		 *
+		 * @param from_s Start of the window in seconds, inclusive
+		 * @param to_s End of the window in seconds, inclusive
+		 * @param *samples Pointer to an array in which to store the samples
+		 * @param max_samples Number of elements in samples
+		 * @param &count Address of size_t in which to store the number of 
+		 *               samples decoded
+		 * @return Indicates success or failure reason, EXCEEDS_MAX_VALUE if
+		 *         samples was too small to hold the whole window
+		 */
+		int query(uint32_t from_s, uint32_t to_s, TP_Metric_Sample *samples, size_t max_samples, size_t &count);
+
+		/** Serialise the blocks overlapping a time window, still compressed, 
+		 *  for upload. The blob is a version byte and a block count, then for
+		 *  each block its start time, sample count and bit length, little-
+		 *  endian, followed by the bitstream. Blocks are exported whole, so 
+		 *  the receiver trims samples outside the window
+		 *
+		 * @param from_s Start of the window in seconds, inclusive
+		 * @param to_s End of the window in seconds, inclusive
+		 * @param *buffer Pointer to a byte array in which to build the blob
+		 * @param buffer_len Size of buffer in bytes
+		 * @param &length Address of size_t in which to store the blob length
+		 * @return Indicates success or failure reason
+		 */
+		int export_blocks(uint32_t from_s, uint32_t to_s, uint8_t *buffer, size_t buffer_len, size_t &length);
+
+		/** Discard every stored sample
+		 *
+		 * @return None
+		 */
+		void clear();
+
+		/** Number of samples currently stored
+		 *
+		 * @return Sample count
+		 */
+		size_t sample_count();
+
+		/** Number of blocks dropped to make room for newer samples
+		 *
+		 * @return Dropped block count
+		 */
+		uint32_t dropped_blocks();
+
+	private:
+
+		/** A compressed block. The first sample is stored in full and its
+		 *  time is start_s
+		 */
+		struct Metric_Block
+		{
+			uint32_t start_s;
+			uint32_t end_s;
+			uint16_t count;
+			uint16_t bits;
+			uint8_t data[NBIOT_METRIC_BLOCK_BYTES];
+		};
+
+		/** Previous sample as seen by the encoder or decoder, and the XOR
+		 *  window of each field, leading 0xFF when there is none yet
+		 */
+		struct Codec_State
+		{
+			uint32_t time_s;
+			int32_t delta;
+			uint32_t values[NBIOT_METRIC_FIELDS];
+			uint8_t leading[NBIOT_METRIC_FIELDS];
+			uint8_t trailing[NBIOT_METRIC_FIELDS];
+		};
+
+		/** Encode a sample onto the end of a block. On failure the block
+		 *  and encoder are left as they were
+		 *
+		 * @param &block Block to extend
+		 * @param &sample Sample to encode
+		 * @return True if the sample fitted
+		 */
+		bool encode(Metric_Block &block, const TP_Metric_Sample &sample);
+
+		/** Decode the next sample from a block
+		 *
+		 * @param &block Block to read
+		 * @param &offset Bit offset of the sample, advanced past it
+		 * @param &state Decoder state, updated to this sample
+		 * @param &sample Address of TP_Metric_Sample in which to store the sample
+		 * @return None
+		 */
+		void decode(const Metric_Block &block, uint16_t &offset, Codec_State &state, TP_Metric_Sample &sample);
+
+		/** Append bits to a block, most significant first
+		 *
+		 * @param &block Block to extend
+		 * @param value Value whose low bits are written
+		 * @param bits Number of bits to write, no more than 32
+		 * @return True if the bits fitted
+		 */
+		bool write_bits(Metric_Block &block, uint32_t value, uint8_t bits);
+
+		/** Read bits from a block, most significant first
+		 *
+		 * @param &block Block to read
+		 * @param &offset Bit offset, advanced past the bits read
+		 * @param bits Number of bits to read, no more than 32
+		 * @return Value read
+		 */
+		uint32_t read_bits(const Metric_Block &block, uint16_t &offset, uint8_t bits);
+
+		Metric_Block _blocks[NBIOT_METRIC_BLOCKS];
+		uint8_t _first = 0;
+		uint8_t _count = 0;
+		uint32_t _dropped = 0;
+		Codec_State _encoder = {};
+};
+
 /** Base class for the Thingpilot NB-IoT interface
  */
 class TP_NBIoT_Interface
@@ -45,11 +332,26 @@ class TP_NBIoT_Interface
 		 */
 		enum
 		{
-			NBIOT_OK           = 0,
-			DRIVER_UNKNOWN     = 60,
-			EXCEEDS_MAX_VALUE  = 61,
-			INVALID_UNIT_VALUE = 62,
-			FAIL_TO_CONNECT    = 63
+			NBIOT_OK              = 0,
+			DRIVER_UNKNOWN        = 60,
+			EXCEEDS_MAX_VALUE     = 61,
+			INVALID_UNIT_VALUE    = 62,
+			FAIL_TO_CONNECT       = 63,
+			INVALID_SOCKET        = 64,
+			NO_FREE_ENDPOINT      = 65,
+			INVALID_ENDPOINT      = 66,
+			QUEUE_FULL            = 67,
+			NO_MESSAGE            = 68,
+			NO_FREE_OBSERVATION   = 69,
+			INVALID_OBSERVATION   = 70,
+			COAP_TIMEOUT          = 71,
+			COAP_MALFORMED        = 72,
+			NO_FREE_STREAM        = 73,
+			INVALID_STREAM        = 74,
+			SAMPLE_OUT_OF_ORDER   = 75,
+			INVALID_RESUME_RECORD = 76,
+			UPLOAD_REJECTED       = 77,
+			COAP_BUSY             = 78
 		};
 
 		/** LTE Bands
@@ -103,6 +405,307 @@ class TP_NBIoT_Interface
             INVALID = 4
 		};
 
+		/** List of possible NB-S1 eDRX cycle lengths
+		 */
+		enum class eDRX_cycles
+		{
+			SEC_20_48    = 0, // 0 0 1 0
+			SEC_40_96    = 1, // 0 0 1 1
+			SEC_81_92    = 2, // 0 1 0 1
+			SEC_163_84   = 3, // 1 0 0 1
+			SEC_327_68   = 4, // 1 0 1 0
+			SEC_655_36   = 5, // 1 0 1 1
+			SEC_1310_72  = 6, // 1 1 0 0
+			SEC_2621_44  = 7, // 1 1 0 1
+			SEC_5242_88  = 8, // 1 1 1 0
+			SEC_10485_76 = 9, // 1 1 1 1
+			INVALID      = 10
+		};
+
+		/** Categories of modem transaction against which retries are counted
+		 */
+		enum class TP_Modem_Call
+		{
+			CONFIGURE_UE    = 0,
+			RADIO           = 1,
+			REGISTRATION    = 2,
+			POWER_SAVE_MODE = 3,
+			STATUS_QUERY    = 4,
+			COAP_PROFILE    = 5,
+			COAP_REQUEST    = 6,
+			TIMER           = 7,
+			SOCKET          = 8,
+			REBOOT          = 9,
+			COUNT           = 10
+		};
+
+		/** Retry policy applied to modem transactions. The delay before
+		 *  retry n is jittered between half and all of base_delay_ms * 2^(n-1),
+		 *  capped at max_delay_ms. The AT+NATSPEED probe, the AT poll in 
+		 *  ready() and the soft reboot in recover() are single attempts
+		 */
+		struct TP_Retry_Policy
+		{
+			uint8_t max_attempts;
+			uint16_t base_delay_ms;
+			uint16_t max_delay_ms;
+		};
+
+		/** Escalating recovery actions, cheapest first
+		 */
+		enum class TP_Recovery_Tier
+		{
+			AT_PROBE       = 0,
+			SOFT_REBOOT    = 1,
+			HARDWARE_RESET = 2,
+			POWER_CYCLE    = 3,
+			COUNT          = 4
+		};
+
+		/** Counters kept by recover(). recovered counts successes by the tier
+		 *  that brought the modem back; times are from the start of recovery
+		 */
+		struct TP_Recovery_Stats
+		{
+			uint32_t recovered[(int)TP_Recovery_Tier::COUNT];
+			uint32_t failures;
+			uint32_t last_ms;
+			uint32_t max_ms;
+			uint64_t total_ms;
+		};
+
+		/** Milestones of start(), in the order they are normally reached
+		 */
+		enum class TP_Start_Phase
+		{
+			CONFIGURED  = 0,
+			REBOOTED    = 1,
+			AT_READY    = 2,
+			SCANNING    = 3,
+			REGISTERING = 4,
+			REGISTERED  = 5,
+			COUNT       = 6
+		};
+
+		/** Breakdown of one call to start(). at_ms holds the time from the 
+		 *  start of the call at which each phase was reached, and duration_ms
+		 *  the time from the previous phase reached. A phase's bit in reached
+		 *  is clear if start() failed before it, or if registration progressed
+		 *  past it between two status polls
+		 */
+		struct TP_Start_Profile
+		{
+			uint32_t at_ms[(int)TP_Start_Phase::COUNT];
+			uint32_t duration_ms[(int)TP_Start_Phase::COUNT];
+			uint8_t reached;
+			uint32_t total_ms;
+			int status;
+		};
+
+		/** Phase durations of every call to start(), bucketed as described 
+		 *  at NBIOT_START_HISTOGRAM_BUCKETS
+		 */
+		struct TP_Start_Histogram
+		{
+			uint16_t buckets[(int)TP_Start_Phase::COUNT][NBIOT_START_HISTOGRAM_BUCKETS];
+			uint32_t starts;
+			uint32_t failures;
+		};
+
+		/** Per-category retry counters
+		 */
+		struct TP_Retry_Stats
+		{
+			uint32_t calls;
+			uint32_t retries;
+			uint32_t failures;
+		};
+
+		/** Counters kept by the uplink scheduler. A merged wake is a flush of
+		 *  deferred uplinks into a radio session that was happening anyway; a
+		 *  forced wake is a flush because an uplink reached its deadline.
+		 *  failed counts send attempts, so an uplink retried after a failure
+		 *  may be counted more than once. dropped counts uplinks discarded
+		 *  because their send failed after their deadline had passed
+		 */
+		struct TP_Uplink_Stats
+		{
+			uint32_t merged_wakes;
+			uint32_t forced_wakes;
+			uint32_t sent;
+			uint32_t failed;
+			uint32_t dropped;
+		};
+
+		/** Counters kept by coap_post_blocks(). A retry is a block that had to
+		 *  be resent, typically after UART overrun corrupted the transfer
+		 */
+		struct TP_Block_Stats
+		{
+			uint32_t blocks_sent;
+			uint32_t retries;
+			uint32_t failures;
+		};
+
+		/** Counters kept by coap_stream_send() for one uplink mode. Latency
+		 *  is until the modem accepts a non-confirmable datagram, or until
+		 *  the server responds to a confirmable one. Radio-on time is from
+		 *  +CSCON and counts each RRC session once, against confirmable if
+		 *  any uplink in the session was confirmable
+		 */
+		struct TP_Uplink_Mode_Stats
+		{
+			uint32_t sent;
+			uint32_t failed;
+			uint32_t last_ms;
+			uint32_t max_ms;
+			uint64_t total_ms;
+			uint32_t radio_sessions;
+			uint64_t radio_on_ms;
+		};
+
+		/** Bits of TP_Diagnostics::valid, one per source of fields
+		 */
+		enum TP_Diagnostics_Valid
+		{
+			DIAG_RADIO             = 1 << 0,
+			DIAG_CONNECTED         = 1 << 1,
+			DIAG_REGISTERED        = 1 << 2,
+			DIAG_PSM               = 1 << 3,
+			DIAG_CONNECTION_STATUS = 1 << 4,
+			DIAG_UE_STATS          = 1 << 5,
+			DIAG_REQUESTED_TIMERS  = 1 << 6,
+			DIAG_GRANTED_TIMERS    = 1 << 7
+		};
+
+		/** Radio and network health gathered by snapshot(). Fields are fixed
+		 *  width and ordered so the struct has no padding, and it can be sent 
+		 *  as-is in a binary uplink. Multi-byte fields are then in the MCU's
+		 *  byte order, little-endian on the Cortex-M targets, and a server 
+		 *  must decode them as such. A field is only meaningful if its 
+		 *  TP_Diagnostics_Valid bit is set in valid. rsrp, total_power and
+		 *  tx_power are in tenths of a dBm and rsrq and snr in tenths of a 
+		 *  dB, unscaled from +NUESTATS, i.e. -1053 is -105.3 dBm
+		 */
+		struct TP_Diagnostics
+		{
+			uint32_t valid;
+			uint32_t cell_id;            // DIAG_UE_STATS
+			uint32_t earfcn;             // DIAG_UE_STATS
+			uint32_t tx_time_ms;         // DIAG_UE_STATS, ms transmitting since boot
+			uint32_t rx_time_ms;         // DIAG_UE_STATS, ms receiving since boot
+			uint32_t requested_tau_s;    // DIAG_REQUESTED_TIMERS, seconds
+			uint32_t requested_active_s; // DIAG_REQUESTED_TIMERS, seconds
+			uint32_t granted_tau_s;      // DIAG_GRANTED_TIMERS, seconds
+			uint32_t granted_active_s;   // DIAG_GRANTED_TIMERS, seconds
+			int16_t rsrp;                // DIAG_UE_STATS, 0.1 dBm
+			int16_t rsrq;                // DIAG_UE_STATS, 0.1 dB
+			int16_t snr;                 // DIAG_UE_STATS, 0.1 dB
+			int16_t total_power;         // DIAG_UE_STATS, 0.1 dBm
+			int16_t tx_power;            // DIAG_UE_STATS, 0.1 dBm
+			uint16_t pci;                // DIAG_UE_STATS
+			uint8_t version;
+			uint8_t connection_status;   // DIAG_CONNECTION_STATUS, a TP_Connection_Status
+			uint8_t connected;           // DIAG_CONNECTED
+			uint8_t registered;          // DIAG_REGISTERED
+			uint8_t psm;                 // DIAG_PSM
+			uint8_t radio;               // DIAG_RADIO
+			uint8_t ecl;                 // DIAG_UE_STATS
+			uint8_t band;                // DIAG_UE_STATS, a TP_NBIoT_Band
+		};
+
+		/** PSM timers as requested by the device and as granted by the network
+		 *  in its CEREG extended report. The network is free to grant values
+		 *  other than those requested
+		 */
+		struct TP_PSM_Timers
+		{
+			T3412_units requested_tau_unit;
+			uint8_t requested_tau_multiples;
+			T3324_units requested_active_unit;
+			uint8_t requested_active_multiples;
+			T3412_units granted_tau_unit;
+			uint8_t granted_tau_multiples;
+			T3324_units granted_active_unit;
+			uint8_t granted_active_multiples;
+			uint32_t requested_tau_s;
+			uint32_t requested_active_s;
+			uint32_t granted_tau_s;
+			uint32_t granted_active_s;
+		};
+
+		/** Interface state saved by save_resume() for resume() after the MCU
+		 *  wakes from deep sleep. Only the baud rate, flow control, CoAP 
+		 *  profile contents, CoAP message ID/token counters and PSM timers 
+		 *  are kept; anything tied to the MCU clock is not. check is a 
+		 *  CRC-32 of every byte before it
+		 */
+		struct TP_Resume_Record
+		{
+			uint32_t magic;
+			uint16_t version;
+			uint16_t length;
+			int32_t baud;
+			uint32_t coap_token;
+			uint16_t coap_message_id;
+			uint8_t flow_control;
+			uint8_t psm_timers_valid;
+			uint32_t coap_profile_hash[NBIOT_COAP_PROFILES];
+			TP_PSM_Timers psm_timers;
+			uint32_t check;
+		};
+
+		/** A single piece of a scatter-gather write. Segments are sent
+		 *  back-to-back without being copied into a common buffer
+		 */
+		struct TP_Buffer_Segment
+		{
+			const uint8_t *data;
+			size_t length;
+		};
+
+		/** A datagram received from the network, held in one of the
+		 *  NBIOT_DOWNLINK_BUFFERS receive buffers until released
+		 */
+		struct TP_Downlink_Message
+		{
+			int socket;
+			char ipv4[16];
+			uint16_t port;
+			size_t length;
+			uint8_t data[NBIOT_UDP_MAX_DATAGRAM];
+		};
+
+		/** Counters kept by the downlink receive pool. An overflow is a waiting
+		 *  datagram found while every buffer was in use, counted once however
+		 *  many polls it waits; the datagram is left at the modem and collected
+		 *  later. A drop is a datagram that could not be read from the modem 
+		 *  and is lost
+		 */
+		struct TP_Downlink_Stats
+		{
+			uint32_t received;
+			uint32_t overflows;
+			uint32_t dropped;
+			uint8_t peak_in_use;
+		};
+
+		/** Response to a CoAP request made over UDP, or an Observe notification.
+		 *  code is class * 100 + detail, i.e. 205 for 2.05 Content or 203 for
+		 *  2.03 Valid. payload is only valid for the duration of the call or
+		 *  callback that provides it
+		 */
+		struct TP_CoAP_Response
+		{
+			int code;
+			uint8_t etag[NBIOT_COAP_ETAG_MAX];
+			uint8_t etag_length;
+			bool observe_present;
+			uint32_t observe;
+			const uint8_t *payload;
+			size_t payload_length;
+		};
+
 	    #if BOARD == WRIGHT_V1_0_0 || BOARD == DEVELOPMENT_BOARD_V1_1_0
 			/** Constructor for the TP_NBIoT_Interface class, specifically when 
 			 *  using a ublox Sara N2xx. Instantiates an ATCmdParser object
@@ -111,8 +714,10 @@ class TP_NBIoT_Interface
 			 * @param txu Pin connected to SaraN2 TXD (This is MCU TXU)
 			 * @param rxu Pin connected to SaraN2 RXD (This is MCU RXU)
 			 * @param cts Pin connected to SaraN2 CTS
-			 * @param rst Pin connected to SaraN2 RST
-			 * @param vint Pin conencted to SaraN2 VINT
+			 * @param rst Pin connected to SaraN2 RST, owned by hardware_reset() so
+			 *            it is not passed to the driver
+			 * @param vint Pin conencted to SaraN2 VINT, owned by the power monitor
+			 *             so it is not passed to the driver
 			 * @param gpio Pin connected to SaraN2 GPIO1
 			 * @param baud Baud rate for UART between MCU and SaraN2
 			 */  
@@ -132,6 +737,43 @@ class TP_NBIoT_Interface
          */
         int ready(uint8_t timeout_s = 10);
 
+		/** Switch the modem and MCU UART to the fastest baud rate that
+		 *  passes an AT probe, starting at 460800 and working down. The
+		 *  chosen rate is stored in the modem so it survives a reboot.
+		 *  If no faster rate is stable both ends are reverted to the
+		 *  rate in use before the call
+		 *
+		 * @param &baud Address of integer in which to store the baud rate
+		 *              in use after negotiation
+		 * @param &bytes_per_s Address of uint32_t in which to store the UART 
+		 *                     throughput measured at that rate, see 
+		 *                     measure_link_throughput()
+		 * @return Indicates success or failure reason
+		 */
+		int negotiate_baud_rate(int &baud, uint32_t &bytes_per_s);
+
+		/** Enable or disable hardware flow control on the modem UART. The 
+		 *  modem holds CTS to pause the MCU when its receive buffer fills,
+		 *  which prevents overruns at high baud rates and lets block uploads
+		 *  stream without pacing delays. The MCU serial port belongs to the
+		 *  driver, so its set_flow_control() must switch both ends: AT+IFC
+		 *  on the modem and the CTS input passed to the constructor on the 
+		 *  MCU UART. A driver that only configures the modem leaves the MCU
+		 *  ignoring CTS, and unpaced uploads can then overrun the modem
+		 *
+		 * @param enable True to enable CTS flow control, false to disable it
+		 * @return Indicates success or failure reason
+		 */
+		int set_flow_control(bool enable);
+
+		/** Read back the flow control setting from the modem, i.e. to verify
+		 *  that it took effect or survived a reboot
+		 *
+		 * @param &enabled Address of bool in which to store the setting
+		 * @return Indicates success or failure reason
+		 */
+		int get_flow_control(bool &enabled);
+
 		/** Initialise the modem with default parameters:
 		 *  AUTOCONNECT = TRUE
 		 *  CELL_RESELECTION = TRUE
@@ -149,19 +791,106 @@ class TP_NBIoT_Interface
 		 */
 		int start(uint16_t timeout_s = 300);
 
-		/** Power-cycle the NB-IoT modem
+		/** Retrieve the phase breakdown of the most recent call to start()
+		 *
+		 * @param &profile Address of TP_Start_Profile in which to store the breakdown
+		 * @return None
+		 */
+		void get_start_profile(TP_Start_Profile &profile);
+
+		/** Retrieve the phase duration histograms accumulated over every call
+		 *  to start()
+		 *
+		 * @param &histogram Address of TP_Start_Histogram in which to store the 
+		 *                   histograms
+		 * @return None
+		 */
+		void get_start_histogram(TP_Start_Histogram &histogram);
+
+		/** Empty the phase duration histograms, i.e. once they have been 
+		 *  uploaded
+		 *
+		 * @return None
+		 */
+		void clear_start_histogram();
+
+		/** Save the interface state that outlives MCU deep sleep, i.e. into
+		 *  backup RAM before entering standby, so that the next boot can 
+		 *  call resume() instead of start()
+		 *
+		 * @param &record Address of TP_Resume_Record in which to store the state
+		 * @return None
+		 */
+		void save_resume(TP_Resume_Record &record);
+
+		/** Restore the state saved by save_resume() on a newly constructed
+		 *  interface and check, with a single AT+CEREG? query, that the modem
+		 *  is still registered. Nothing is written to the modem's NVM and the
+		 *  modem is not rebooted. CoAP endpoints must be registered again, in
+		 *  any order; each is placed in the free profile already holding its
+		 *  settings, if there is one, so that it isn't rewritten
+		 *
+		 * @param &record State saved by save_resume()
+		 * @return Indicates success or failure reason, INVALID_RESUME_RECORD 
+		 *         if the record is corrupt or from another version, and 
+		 *         FAIL_TO_CONNECT if the modem is no longer registered, in
+		 *         which case start() is needed
+		 */
+		int resume(const TP_Resume_Record &record);
+
+		/** Power-cycle the NB-IoT modem. Sockets are dropped as described
+		 *  for recover()
 		 * 
 		 * @return Indicates success or failure reason
 		 */
 		int reboot_modem();
 
+		/** Reset the modem by pulling its RESET_N pin low. Works when the
+		 *  modem no longer answers AT commands, unlike reboot_modem(). 
+		 *  Sockets are dropped as described for recover()
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int hardware_reset();
+
+		/** Bring an unresponsive modem back, escalating through an AT probe, 
+		 *  a soft reboot, a hardware reset and finally the power-cycle hook 
+		 *  until it answers AT. Each tier waits a bounded time. URC settings
+		 *  made with enable_status_urcs() don't survive a reboot and must be
+		 *  reapplied if the tier used was SOFT_REBOOT or above. The modem 
+		 *  also closes its sockets then, so downlink_listen() settings, 
+		 *  Observe registrations and NON streams are dropped and sockets
+		 *  must be reopened with udp_open()
+		 *
+		 * @param &tier Address of TP_Recovery_Tier in which to store the tier
+		 *              that recovered the modem, or the last one tried
+		 * @return Indicates success or failure reason
+		 */
+		int recover(TP_Recovery_Tier &tier);
+
+		/** Register a function that removes and restores power to the modem,
+		 *  used as the last recovery tier. Without one that tier is skipped
+		 *
+		 * @param hook Function performing the power cycle and returning its status
+		 * @return None
+		 */
+		void attach_power_cycle(Callback<int()> hook);
+
+		/** Retrieve the recovery counters and timings
+		 *
+		 * @param &stats Address of TP_Recovery_Stats in which to store the counters
+		 * @return None
+		 */
+		void get_recovery_stats(TP_Recovery_Stats &stats);
+
 		/** Is the modem TX/RX circuitry turned on or off? 1 is on, 0 is off
 		 * 
 		 * @param &status Address of integer value to which to return the status
 		 *                value of the radio
+		 * @param force_refresh Query the modem even if the cached value is fresh
 		 * @return Indicates success or failure reason
 		 */
-		int get_radio_status(int &radio_status);
+		int get_radio_status(int &radio_status, bool force_refresh = false);
 
 		/** Disable TX and RX RF circuits
 		 * 
@@ -224,10 +953,11 @@ class TP_NBIoT_Interface
 		 *                    status. See AT+CEREG=0/AT+CEREG? for possible values
 		 * @param &psm Address of integer value in which to store PSM status where 1 = in PSM
 		 *             and 0 is in Active mode
+		 * @param force_refresh Query the modem even if the cached values are fresh
 		 * @return Indicates success or failure reason
 		 */ 
 		int get_module_network_status(TP_Connection_Status &status, int &connected, 
-									  int &registered, int &psm);
+									  int &registered, int &psm, bool force_refresh = false);
 
 		/** Query UE for radio connection and network registration status
 		 * 
@@ -235,9 +965,10 @@ class TP_NBIoT_Interface
 		 *                   connection status
 		 * @param &reg_status Address of integer in which to store
 		 *                    network registration status
+		 * @param force_refresh Query the modem even if the cached values are fresh
 		 * @return Indicates success or failure reason
 		 */
-        int get_connection_status(int &connected, int &reg_status);
+        int get_connection_status(int &connected, int &reg_status, bool force_refresh = false);
 
         /** Get last known RSRP and RSRQ
         * 
@@ -265,6 +996,55 @@ class TP_NBIoT_Interface
          */
         int get_nuestats(char *data);
 
+		/** Gather every radio and network metric in a single modem session.
+		 *  Values held fresh by the status cache, the VINT monitor or earlier
+		 *  timer reads cost no AT traffic; +NUESTATS supplies signal and cell
+		 *  figures in place of AT+CSQ, and one AT+CEREG? read supplies both
+		 *  registration and the granted PSM timers. A query that fails only 
+		 *  clears its bit in valid
+		 *
+		 * @param &diagnostics Address of TP_Diagnostics in which to store the 
+		 *                     snapshot
+		 * @return Indicates success or failure reason, NBIOT_OK if any field
+		 *         is valid
+		 */
+		int snapshot(TP_Diagnostics &diagnostics);
+
+		/** Take one radio metric sample from +NUESTATS, which reports RSRP
+		 *  and RSRQ as well as the cell, and from the registration status, 
+		 *  cached if fresh, and add it to a metric store
+		 *
+		 * @param &store Store to which to add the sample
+		 * @param time_s Time of the sample in seconds on the store's time 
+		 *               base, see TP_Metric_Store
+		 * @return Indicates success or failure reason
+		 */
+		int sample_metrics(TP_Metric_Store &store, uint32_t time_s);
+
+		/** Upload the stored metric history within a time window as a single
+		 *  compressed blob, see TP_Metric_Store::export_blocks(). Blobs larger 
+		 *  than NBIOT_COAP_BLOCK_MAX are sent with coap_post_blocks()
+		 *
+		 * @param &store Store from which to take the history
+		 * @param from_s Start of the window in seconds, inclusive
+		 * @param to_s End of the window in seconds, inclusive
+		 * @param *buffer Pointer to a byte array in which to build the blob
+		 * @param buffer_len Size of buffer in bytes
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param *recv_data Pointer to a byte array where the data 
+		 *                   returned from the server will be stored
+		 * @param data_intenfier Integer value representing the data 
+		 *                       format type, i.e. TEXT_PLAIN
+		 * @param &response_code Address of integer where CoAP operation response code
+		 *                       will be stored
+		 * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+		 * @return Indicates success or failure reason, UPLOAD_REJECTED if the
+		 *         server answered with other than 2.xx
+		 */
+		int upload_metrics(TP_Metric_Store &store, uint32_t from_s, uint32_t to_s, uint8_t *buffer, size_t buffer_len,
+						   int endpoint, char *recv_data, int data_indentifier, int &response_code, 
+						   size_t recv_len);
+
 		/** Allow the platform to automatically attempt to connect to the 
 		 *  network after power-on or reboot. Will set AT+CFUN=1 and read
 		 *  the SIM PLMN. Will use APN provided by network.
@@ -372,9 +1152,10 @@ class TP_NBIoT_Interface
 		 * 
 		 * @param &psm Address of integer in which to store actual PSM value,
 		 *             1 = in PSM, 0 = active
+		 * @param force_refresh Query the modem even if the cached value is fresh
 		 * @return Indicates success or failure reason
 		 */ 
-		int get_power_save_mode_status(int &psm);
+		int get_power_save_mode_status(int &psm, bool force_refresh = false);
 
         /** Configure CoAP profile 0 with a given IP address, port and URI
          *
@@ -397,9 +1178,10 @@ class TP_NBIoT_Interface
 		 *              	 with the response from the server
          * @param &response_code Address of integer where CoAP operation response code
          *                       will be stored
+         * @param recv_len Size of recv_data in bytes. Longer responses are truncated
 		 * @return Indicates success or failure reason
 		 */
-		int coap_get(char *recv_data, int &response_code);
+		int coap_get(char *recv_data, int &response_code, size_t recv_len);
 
 		/** Perform a HTTP DELETE request over CoAP and capture the server
 		 *  response in recv_data
@@ -408,9 +1190,10 @@ class TP_NBIoT_Interface
 		 *              	 with the response from the server
          * @param &response_code Address of integer where CoAP operation response code
          *                       will be stored
+         * @param recv_len Size of recv_data in bytes. Longer responses are truncated
 		 * @return Indicates success or failure reason
 		 */
-		int coap_delete(char *recv_data, int &response_code);
+		int coap_delete(char *recv_data, int &response_code, size_t recv_len);
 
 		/** Perform a PUT request using CoAP and save the returned 
 		 *  data into recv_data
@@ -424,9 +1207,11 @@ class TP_NBIoT_Interface
 		 *                       in the header file, i.e. TEXT_PLAIN
          * @param &response_code Address of integer where CoAP operation response code
          *                       will be stored
+         * @param recv_len Size of recv_data in bytes. Longer responses are truncated
 		 * @return Indicates success or failure reason
 		 */ 
-		int coap_put(char *send_data, char *recv_data, int data_indentifier, int &response_code);
+		int coap_put(char *send_data, char *recv_data, int data_indentifier, int &response_code,
+					 size_t recv_len);
 
 		/** Perform a POST request using CoAP and save the returned 
 		 *  data into recv_data
@@ -440,25 +1225,174 @@ class TP_NBIoT_Interface
 		 *                       in the header file, i.e. TEXT_PLAIN
          * @param &response_code Address of integer where CoAP operation response code
          *                       will be stored
+         * @param recv_len Size of recv_data in bytes. Longer responses are truncated
 		 * @return Indicates success or failure reason
 		 */ 
 		int coap_post(uint8_t *send_data, size_t buffer_len, char *recv_data, int data_indentifier,
-                      uint8_t send_block_number, uint8_t send_more_block, int &response_code);
+                      uint8_t send_block_number, uint8_t send_more_block, int &response_code,
+                      size_t recv_len);
 
-		/** Set T3412 timer to multiples of given units
-		 * 
-		 * @param unit Enumerated value within T3412_units enum class
-		 * @param multiples Value no greater than 31 that determines
-		 *                  how many multiples of unit to set the
-		 *                  timer to
-		 * @return Indicates success or failure reason
+		/** Register a CoAP endpoint with the profile manager. Endpoints are
+		 *  assigned to one of the modem's CoAP profiles on first use and the
+		 *  least recently used profile is rewritten when all are occupied.
+		 *  ipv4 and uri are not copied so must remain valid until the 
+		 *  endpoint is unregistered
+		 *
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+		 *              destination server as a string
+		 * @param port Destination server port
+		 * @param *uri Pointer to a byte array storing the URI
+		 * @param uri_length Number of characters in URI, cannot be greater
+		 *                   than NBIOT_COAP_URI_MAX
+		 * @param &endpoint Address of integer in which to store the endpoint
+		 *                  handle to pass to subsequent requests
+		 * @return Indicates success or failure reason, INVALID_ENDPOINT if
+		 *         ipv4 or uri is null
 		 */
-		int set_tau_timer(T3412_units unit, uint8_t multiples);
+		int register_coap_endpoint(char *ipv4, uint16_t port, char *uri, uint8_t uri_length, int &endpoint);
 
-		/** Retrieve T3412 timer value as binary string
-		 * 
-		 * @param *timer Pointer to char array in which to store
-		 *               timer value as binary string
+		/** Remove a CoAP endpoint from the profile manager, releasing
+		 *  any profile it occupies
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @return Indicates success or failure reason
+		 */
+		int unregister_coap_endpoint(int endpoint);
+
+		/** Address an endpoint by a one-character alias instead of its full
+		 *  path. Its profile is written as coap://ipv4:port/alias so that each
+		 *  request carries a single one-byte Uri-Path option, and the server 
+		 *  is expected to map the alias back to the resource
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param alias Letter, digit or one of "-._~", or 0 to go back to the 
+		 *              full URI
+		 * @return Indicates success or failure reason
+		 */
+		int set_coap_alias(int endpoint, char alias);
+
+		/** Report the CoAP header bytes an endpoint's alias saves
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param &per_request Address of uint16_t in which to store the Uri-Path
+		 *                     bytes saved by each request
+		 * @param &total Address of uint32_t in which to store the bytes saved by
+		 *               all requests made through the alias so far
+		 * @return Indicates success or failure reason
+		 */
+		int get_coap_alias_savings(int endpoint, uint16_t &per_request, uint32_t &total);
+
+		/** Perform a GET request to a registered endpoint. The endpoint's
+		 *  profile is only rewritten if it isn't already held by the modem
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param *recv_data Pointer to a byte array that will be populated
+		 *              	 with the response from the server
+		 * @param &response_code Address of integer where CoAP operation response code
+		 *                       will be stored
+		 * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+		 * @return Indicates success or failure reason
+		 */
+		int coap_get(int endpoint, char *recv_data, int &response_code, size_t recv_len);
+
+		/** Perform a DELETE request to a registered endpoint. The endpoint's
+		 *  profile is only rewritten if it isn't already held by the modem
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param *recv_data Pointer to a byte array that will be populated
+		 *              	 with the response from the server
+		 * @param &response_code Address of integer where CoAP operation response code
+		 *                       will be stored
+		 * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+		 * @return Indicates success or failure reason
+		 */
+		int coap_delete(int endpoint, char *recv_data, int &response_code, size_t recv_len);
+
+		/** Perform a PUT request to a registered endpoint. The endpoint's
+		 *  profile is only rewritten if it isn't already held by the modem
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param *send_data Pointer to a byte array containing the 
+		 *                   data to be sent to the server
+		 * @param *recv_data Pointer to a byte array where the data 
+		 *                   returned from the server will be stored
+		 * @param data_intenfier Integer value representing the data 
+		 *                       format type, i.e. TEXT_PLAIN
+		 * @param &response_code Address of integer where CoAP operation response code
+		 *                       will be stored
+		 * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+		 * @return Indicates success or failure reason
+		 */
+		int coap_put(int endpoint, char *send_data, char *recv_data, int data_indentifier, int &response_code,
+					 size_t recv_len);
+
+		/** Perform a POST request to a registered endpoint. The endpoint's
+		 *  profile is only rewritten if it isn't already held by the modem
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param *send_data Pointer to a byte array containing the 
+		 *                   data to be sent to the server
+		 * @param buffer_len Number of bytes in send_data
+		 * @param *recv_data Pointer to a byte array where the data 
+		 *                   returned from the server will be stored
+		 * @param data_intenfier Integer value representing the data 
+		 *                       format type, i.e. TEXT_PLAIN
+		 * @param send_block_number Block1 number of this chunk
+		 * @param send_more_block 1 if further blocks follow, otherwise 0
+		 * @param &response_code Address of integer where CoAP operation response code
+		 *                       will be stored
+		 * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+		 * @return Indicates success or failure reason
+		 */
+		int coap_post(int endpoint, uint8_t *send_data, size_t buffer_len, char *recv_data, int data_indentifier,
+					  uint8_t send_block_number, uint8_t send_more_block, int &response_code,
+					  size_t recv_len);
+
+		/** POST a payload larger than one block to a registered endpoint as a
+		 *  sequence of Block1 transfers. The profile is selected once for the
+		 *  whole upload and blocks are sent back-to-back when flow control is 
+		 *  enabled, otherwise NBIOT_BLOCK_PACING_MS apart. Resending a block is
+		 *  safe, so failed blocks are retried under the retry policy. The upload
+		 *  stops early, returning UPLOAD_REJECTED, if the server answers a block
+		 *  with other than 2.xx
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @param *send_data Pointer to a byte array containing the payload
+		 * @param buffer_len Number of bytes in send_data
+		 * @param block_size Block size, a power of two from 16 to NBIOT_COAP_BLOCK_MAX
+		 * @param *recv_data Pointer to a byte array where the data 
+		 *                   returned from the server will be stored
+		 * @param data_intenfier Integer value representing the data 
+		 *                       format type, i.e. TEXT_PLAIN
+		 * @param &response_code Address of integer where the response code to
+		 *                       the last block sent will be stored
+		 * @param recv_len Size of recv_data in bytes. Longer responses are truncated
+		 * @return Indicates success or failure reason
+		 */
+		int coap_post_blocks(int endpoint, uint8_t *send_data, size_t buffer_len, size_t block_size, char *recv_data,
+							 int data_indentifier, int &response_code, size_t recv_len);
+
+		/** Retrieve the block upload counters
+		 *
+		 * @param &stats Address of TP_Block_Stats in which to store the counters
+		 * @return None
+		 */
+		void get_block_stats(TP_Block_Stats &stats);
+
+		/** Set T3412 timer to multiples of given units
+		 * 
+		 * @param unit Enumerated value within T3412_units enum class
+		 * @param multiples Value no greater than 31 that determines
+		 *                  how many multiples of unit to set the
+		 *                  timer to
+		 * @return Indicates success or failure reason
+		 */
+		int set_tau_timer(T3412_units unit, uint8_t multiples);
+
+		/** Retrieve T3412 timer value as binary string
+		 * 
+		 * @param *timer Pointer to char array in which to store
+		 *               timer value as binary string
 		 * @return Indicates success or failure reason
 		 */
 		int get_tau_timer(char *timer);
@@ -503,23 +1437,1066 @@ class TP_NBIoT_Interface
 		 */
 		int get_active_time(T3324_units &unit, uint8_t &multiples);
 
+		/** Request extended DRX with a given cycle length and paging time window
+		 *
+		 * @param cycle Enumerated value within eDRX_cycles enum class
+		 * @param ptw Paging time window as a value no greater than 15, where
+		 *            the window is (ptw + 1) * 2.56 seconds
+		 * @return Indicates success or failure reason
+		 */
+		int set_edrx(eDRX_cycles cycle, uint8_t ptw);
+
+		/** Stop requesting extended DRX
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int disable_edrx();
+
+		/** Retrieve the requested eDRX cycle and paging time window, or those
+		 *  granted by the network which may differ
+		 *
+		 * @param &cycle Address of eDRX_cycles value into which the cycle
+		 *               length will be stored
+		 * @param &ptw Address of uint8_t into which the paging time window 
+		 *             will be stored, where the window is (ptw + 1) * 2.56 seconds
+		 * @param granted If true return the values in use by the network rather
+		 *                than those requested
+		 * @return Indicates success or failure reason
+		 */
+		int get_edrx(eDRX_cycles &cycle, uint8_t &ptw, bool granted = false);
+
+		/** Length of an eDRX cycle in milliseconds, for comparing the downlink 
+		 *  latency of eDRX against PSM
+		 *
+		 * @param cycle Enumerated value within eDRX_cycles enum class
+		 * @return Cycle length in milliseconds, 0 if invalid
+		 */
+		uint32_t edrx_cycle_ms(eDRX_cycles cycle);
+
+		/** Length of a paging time window in milliseconds
+		 *
+		 * @param ptw Paging time window value no greater than 15
+		 * @return Window length in milliseconds
+		 */
+		uint32_t edrx_ptw_ms(uint8_t ptw);
+
+		/** Read T3412 and T3324 as both requested by the device and granted
+		 *  by the network. The divergence callback, if attached, is called
+		 *  when a new grant differs from the request. If the network hasn't
+		 *  granted PSM the granted units are INVALID and the seconds zero
+		 *
+		 * @param &timers Address of TP_PSM_Timers in which to store the values
+		 * @return Indicates success or failure reason
+		 */
+		int get_psm_timers(TP_PSM_Timers &timers);
+
+		/** Register a function to be called whenever the network grants PSM
+		 *  timers that differ from those requested, either on a call to 
+		 *  get_psm_timers() or from a +CEREG URC
+		 *
+		 * @param callback Function taking the requested and granted timers
+		 * @return None
+		 */
+		void attach_psm_timer_divergence(Callback<void(const TP_PSM_Timers&)> callback);
+
+		/** Create a UDP socket on the modem. Datagrams sent and received
+		 *  through this socket bypass the CoAP profile machinery entirely
+		 *
+		 * @param &socket Address of integer in which to store the socket
+		 *                number allocated by the modem
+		 * @param local_port Local port to bind to. 0 lets the modem choose
+		 * @return Indicates success or failure reason
+		 */
+		int udp_open(int &socket, uint16_t local_port = 0);
+
+		/** Close a previously opened UDP socket
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @return Indicates success or failure reason
+		 */
+		int udp_close(int socket);
+
+		/** Send a single datagram to a remote host. The call returns as
+		 *  soon as the modem has accepted the data, no acknowledgement
+		 *  is expected from the remote end
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+		 *              destination as a string, i.e. "168.134.102.18"
+		 * @param port Destination port
+		 * @param *data Pointer to a byte array containing the datagram
+		 * @param length Number of bytes to send, cannot be greater than
+		 *               NBIOT_UDP_MAX_DATAGRAM
+		 * @return Indicates success or failure reason
+		 */
+		int udp_sendto(int socket, char *ipv4, uint16_t port, uint8_t *data, size_t length);
+
+		/** Send a single datagram assembled from several segments, i.e. a
+		 *  header, payload and trailer, without concatenating them into a
+		 *  temporary buffer first. Each segment is streamed to the modem 
+		 *  in turn
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+		 *              destination as a string, i.e. "168.134.102.18"
+		 * @param port Destination port
+		 * @param *segments Pointer to an array of segments making up the datagram
+		 * @param count Number of segments
+		 * @return Indicates success or failure reason
+		 */
+		int udp_sendto(int socket, char *ipv4, uint16_t port, const TP_Buffer_Segment *segments, uint8_t count);
+
+		/** Read a received datagram from the modem. Normally called after
+		 *  the callback registered with udp_attach() has reported that
+		 *  data is waiting
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to a char array of at least 16 bytes in which
+		 *              to store the source IPv4 address
+		 * @param &port Address of integer in which to store the source port
+		 * @param *data Pointer to a byte array in which to store the datagram
+		 * @param buffer_len Size of data in bytes
+		 * @param &length Address of size_t in which to store the number of
+		 *                bytes copied into data
+		 * @param &remaining Address of size_t in which to store the number of
+		 *                   bytes still waiting to be read on this socket
+		 * @return Indicates success or failure reason
+		 */
+		int udp_recvfrom(int socket, char *ipv4, uint16_t &port, uint8_t *data, size_t buffer_len,
+						 size_t &length, size_t &remaining);
+
+		/** Register a function to be called when the modem reports, via 
+		 *  +NSONMI, that a datagram has arrived on a socket
+		 *
+		 * @param callback Function taking the socket number and the number
+		 *                 of bytes available
+		 * @return None
+		 */
+		void udp_attach(Callback<void(int, int)> callback);
+
+		/** Process any unsolicited result codes that the modem has sent 
+		 *  while no command was in progress. Registered callbacks are
+		 *  dispatched from within this call
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int process_urc();
+
+		/** Collect datagrams arriving on a socket into the downlink receive 
+		 *  pool. Datagrams are read from the modem by process_urc() after it 
+		 *  has dispatched the +NSONMI URC, so that server-initiated data is
+		 *  picked up without an explicit udp_recvfrom(). The udp_attach() 
+		 *  callback is no longer called for this socket
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param enable False to return the socket to manual udp_recvfrom()
+		 * @return Indicates success or failure reason
+		 */
+		int downlink_listen(int socket, bool enable = true);
+
+		/** Register a function to be handed each downlink message as it is
+		 *  collected, instead of queueing it for downlink_receive(). The
+		 *  function owns the message until it calls downlink_release()
+		 *
+		 * @param callback Function taking a pointer to the received message
+		 * @return None
+		 */
+		void downlink_attach(Callback<void(TP_Downlink_Message*)> callback);
+
+		/** Take the oldest queued downlink message. The message stays valid
+		 *  until it is passed to downlink_release()
+		 *
+		 * @param *&message Address of pointer in which to store the message
+		 * @return Indicates success or failure reason, NO_MESSAGE if the
+		 *         queue is empty
+		 */
+		int downlink_receive(TP_Downlink_Message *&message);
+
+		/** Return a message's buffer to the downlink receive pool. Datagrams
+		 *  left at the modem for want of a buffer are collected on the next
+		 *  call to process_urc()
+		 *
+		 * @param *message Pointer returned by downlink_receive() or passed
+		 *                 to the downlink_attach() callback
+		 * @return None
+		 */
+		void downlink_release(TP_Downlink_Message *message);
+
+		/** Retrieve the downlink receive pool counters
+		 *
+		 * @param &stats Address of TP_Downlink_Stats in which to store the counters
+		 * @return None
+		 */
+		void get_downlink_stats(TP_Downlink_Stats &stats);
+
+		/** Perform a confirmable CoAP GET over UDP, validating a cached 
+		 *  representation by its ETag. If the server still holds the same
+		 *  representation it answers 2.03 Valid with no payload. The socket
+		 *  is put in listening mode with downlink_listen(). Only one CoAP 
+		 *  request over UDP can await its response at a time, so this can't
+		 *  be called from a downlink or Observe callback while another is
+		 *  waiting
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+		 *              server as a string, i.e. "168.134.102.18"
+		 * @param port Server port
+		 * @param *uri Pointer to a null-terminated path, i.e. "config/device"
+		 * @param *payload Pointer to a byte array in which to store the response
+		 *                 payload
+		 * @param buffer_len Size of payload in bytes
+		 * @param &response On entry, etag and etag_length describe the cached
+		 *                  representation, etag_length 0 for none. On success
+		 *                  holds the response and its ETag
+		 * @return Indicates success or failure reason, COAP_BUSY if another 
+		 *         CoAP request over UDP is awaiting its response
+		 */
+		int coap_get_validated(int socket, char *ipv4, uint16_t port, char *uri, uint8_t *payload, 
+							   size_t buffer_len, TP_CoAP_Response &response);
+
+		/** Register with a CoAP server to be notified of changes to a resource
+		 *  (RFC 7641), so that it no longer has to be polled. The first response
+		 *  and every later notification are passed to callback from within 
+		 *  process_urc(). ipv4 and uri must remain valid until the observation
+		 *  is cancelled. Like coap_get_validated(), this can't be called while
+		 *  another CoAP request over UDP is awaiting its response
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+		 *              server as a string, i.e. "168.134.102.18"
+		 * @param port Server port
+		 * @param *uri Pointer to a null-terminated path, i.e. "config/device"
+		 * @param callback Function taking each response or notification
+		 * @param &observation Address of integer in which to store the observation 
+		 *                     handle, -1 if the server declined to be observed 
+		 * @return Indicates success or failure reason, COAP_BUSY if another 
+		 *         CoAP request over UDP is awaiting its response
+		 */
+		int coap_observe(int socket, char *ipv4, uint16_t port, char *uri,
+						 Callback<void(const TP_CoAP_Response&)> callback, int &observation);
+
+		/** Deregister an observation with the server and free its slot once
+		 *  the server has answered. Notifications arriving meanwhile are 
+		 *  acknowledged but not passed to the callback
+		 *
+		 * @param observation Handle returned by coap_observe()
+		 * @return Indicates success or failure reason, COAP_BUSY if another 
+		 *         CoAP request over UDP is awaiting its response. On any
+		 *         failure the observation is left active
+		 */
+		int coap_cancel_observe(int observation);
+
+		/** Open a telemetry stream to a CoAP resource. Uplinks are sent as
+		 *  non-confirmable POSTs, so the radio can be released without 
+		 *  waiting for the server, and carry a 24-bit sequence number in the
+		 *  token, after a prefix byte of NBIOT_COAP_STREAM_TOKEN | stream,
+		 *  so the server can detect gaps. Every heartbeat_s seconds an
+		 *  uplink is sent confirmable instead as a liveness check. ipv4 and 
+		 *  uri must remain valid until the stream is closed
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address of the 
+		 *              server as a string, i.e. "168.134.102.18"
+		 * @param port Server port
+		 * @param *uri Pointer to a null-terminated path, i.e. "telemetry"
+		 * @param heartbeat_s Seconds between confirmable uplinks, 0 for none
+		 * @param &stream Address of integer in which to store the stream handle
+		 * @return Indicates success or failure reason
+		 */
+		int coap_stream_open(int socket, char *ipv4, uint16_t port, char *uri, uint32_t heartbeat_s, int &stream);
+
+		/** Send one uplink on a stream, confirmable if a heartbeat is due and
+		 *  otherwise fire-and-forget. A failed heartbeat is retried on the 
+		 *  next uplink, as is one due while another CoAP request over UDP is
+		 *  awaiting its response, i.e. when called from a downlink or Observe
+		 *  callback; that uplink is sent non-confirmable instead
+		 *
+		 * @param stream Handle returned by coap_stream_open()
+		 * @param *data Pointer to the payload
+		 * @param length Number of bytes in data
+		 * @param &confirmed Address of boolean set true if the uplink was sent
+		 *                   confirmable and the server responded
+		 * @return Indicates success or failure reason
+		 */
+		int coap_stream_send(int stream, const uint8_t *data, size_t length, bool &confirmed);
+
+		/** Close a stream and free its slot
+		 *
+		 * @param stream Handle returned by coap_stream_open()
+		 * @return Indicates success or failure reason
+		 */
+		int coap_stream_close(int stream);
+
+		/** Retrieve the latency and radio-on counters for one uplink mode
+		 *
+		 * @param confirmable True for confirmable uplinks, false for 
+		 *                    non-confirmable
+		 * @param &stats Address of TP_Uplink_Mode_Stats in which to store the counters
+		 * @return None
+		 */
+		void get_uplink_mode_stats(bool confirmable, TP_Uplink_Mode_Stats &stats);
+
+		/** Replace the time source and sleep function used for every timeout,
+		 *  poll interval and backoff in the interface. By default these are
+		 *  Kernel::get_ms_count() and ThisThread::sleep_for()
+		 *
+		 * @param clock Function returning the current time in milliseconds
+		 * @param sleep Function that blocks, or advances virtual time, for
+		 *              the given number of milliseconds
+		 * @return None
+		 */
+		void set_clock(Callback<uint64_t()> clock, Callback<void(uint32_t)> sleep);
+
+		/** Set the retry policy applied to modem transactions
+		 *
+		 * @param &policy Maximum attempts and backoff bounds. max_attempts
+		 *                of 1 disables retries
+		 * @return None
+		 */
+		void set_retry_policy(const TP_Retry_Policy &policy);
+
+		/** Retrieve the attempt, retry and failure counters for a category
+		 *  of modem transaction
+		 *
+		 * @param call Category of modem transaction
+		 * @param &stats Address of TP_Retry_Stats in which to store the counters
+		 * @return None
+		 */
+		void get_retry_stats(TP_Modem_Call call, TP_Retry_Stats &stats);
+
+		/** Seed the generator behind retry jitter and CoAP token/message ID
+		 *  starting points. Without a call it is seeded from the hardware 
+		 *  RNG where the target has one and from the modem IMEI once start()
+		 *  reaches the modem, so devices that fail together back off 
+		 *  differently. Pass a value from persistent storage to also make
+		 *  each boot differ on targets without a hardware RNG
+		 *
+		 * @param seed Any value, mixed into the current state
+		 * @return None
+		 */
+		void seed_random(uint32_t seed);
+
+		/** Zero the retry counters for every category
+		 *
+		 * @return None
+		 */
+		void reset_retry_stats();
+
+		/** Serve get_connection_status, get_power_save_mode_status, get_radio_status
+		 *  and get_module_network_status from cached values no older than max_age_ms
+		 *  instead of querying the modem. Cached values are refreshed by queries and
+		 *  by +CSCON, +CEREG and +NPSMR URCs. 0 disables the cache
+		 *
+		 * @param max_age_ms Maximum age in milliseconds of a cached value
+		 * @return None
+		 */
+		void set_status_cache_max_age(uint32_t max_age_ms);
+
+		/** Discard all cached status values, including the network-granted PSM
+		 *  timers, so the next getter queries the modem
+		 *
+		 * @return None
+		 */
+		void invalidate_status_cache();
+
+		/** Ask the modem to report radio connection, network registration and PSM
+		 *  changes as URCs so that the status cache stays current without polling.
+		 *  Registration is reported in CEREG mode 4 so that network-granted PSM
+		 *  timers arrive too. URCs are dispatched from process_urc() or during 
+		 *  any other command
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int enable_status_urcs();
+
+		/** Track the modem's power state from its VINT pin, which is driven high
+		 *  while the module is active and falls when it enters deep-sleep PSM.
+		 *  While enabled, get_power_save_mode_status() answers from the pin with
+		 *  no AT traffic, and ready() waits for VINT to rise before probing
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int enable_power_monitor();
+
+		/** Stop tracking VINT and return to querying the modem for PSM state
+		 *
+		 * @return None
+		 */
+		void disable_power_monitor();
+
+		/** Set the VINT level seen by the power monitor as though the pin had
+		 *  changed, so that simulated modems can drive PSM entry and exit
+		 *
+		 * @param level 1 for active, 0 for deep-sleep PSM
+		 * @return None
+		 */
+		void inject_vint(int level);
+
+		/** Read T3412 and T3324 from the modem for use by the uplink scheduler,
+		 *  preferring the values granted by the network. Call after changing 
+		 *  either timer
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int sync_psm_timers();
+
+		/** Hold an uplink until the modem next has a radio session for its own
+		 *  reasons, i.e. it is RRC connected, awake in its T3324 active window or 
+		 *  about to perform a periodic TAU, so that one session serves both. If
+		 *  no such opportunity arises within max_hold_s the uplink is sent anyway.
+		 *  Relies on the status URCs enabled by enable_status_urcs()
+		 *
+		 * @param send Function that performs the uplink, i.e. a coap_post() or 
+		 *             udp_sendto(), and returns its status
+		 * @param max_hold_s Longest time in seconds the uplink may be held
+		 * @return Indicates success or failure reason
+		 */
+		int defer_uplink(Callback<int()> send, uint32_t max_hold_s);
+
+		/** Send any deferred uplinks if the modem is in a radio session or one is
+		 *  due, or if any has reached its deadline. Uplinks whose send fails stay
+		 *  queued until their deadline has passed; one whose send fails after 
+		 *  that, i.e. on the forced wake its deadline caused, is dropped and 
+		 *  counted in TP_Uplink_Stats::dropped. Call periodically and after
+		 *  process_urc()
+		 *
+		 * @param &sent Address of uint8_t in which to store the number of uplinks
+		 *              sent by this call
+		 * @return Indicates success or failure reason
+		 */
+		int service_uplinks(uint8_t &sent);
+
+		/** Time until service_uplinks() is next expected to send, either for the
+		 *  next periodic TAU or the earliest deadline. Useful to decide how long
+		 *  the application can sleep
+		 *
+		 * @param &ms Address of uint32_t in which to store the delay in milliseconds.
+		 *            0 if nothing is deferred or a send is already due
+		 * @return Indicates success or failure reason
+		 */
+		int get_next_uplink_window(uint32_t &ms);
+
+		/** Retrieve the uplink scheduler counters
+		 *
+		 * @param &stats Address of TP_Uplink_Stats in which to store the counters
+		 * @return None
+		 */
+		void get_uplink_stats(TP_Uplink_Stats &stats);
+
 
 	private:
 
-		/** Convert decimal number (with max value of 5-bits) to a binary string,
-		 *  i.e. 10 = "01010"
+		/** Write a GPRS timer as the 8-character binary string expected by the
+		 *  modem, i.e. unit 0b101 with 10 multiples = "10101010"
 		 * 
-		 * @param multiples Decimal value to convert to binary
-		 * @param *binary Pointer to a char array to which to return 
-		 *                the binary string
+		 * @param unit_bits 3-bit timer unit field
+		 * @param multiples 5-bit timer value
+		 * @param *timer Pointer to a char array of at least 9 bytes to which
+		 *               to write the null-terminated binary string
+		 * @return None
+		 */
+		void encode_gprs_timer(uint8_t unit_bits, uint8_t multiples, char *timer);
+
+		/** Parse the 8-character binary string reported by the modem for a GPRS
+		 *  timer into its unit field and multiples in a single pass
+		 * 
+		 * @param *timer Pointer to the binary string returned by the modem
+		 * @param &unit_bits Address of uint8_t in which to store the 3-bit unit field
+		 * @param &multiples Address of uint8_t in which to store the 5-bit value
+		 * @return Indicates success or failure reason
+		 */
+		int decode_gprs_timer(const char *timer, uint8_t &unit_bits, uint8_t &multiples);
+
+		/** Write the low bits of value as a null-terminated string of '0' and '1',
+		 *  most significant bit first
+		 * 
+		 * @param value Value to encode
+		 * @param bits Number of bits to write, no greater than 8
+		 * @param *binary Pointer to a char array of at least bits + 1 bytes
+		 * @return None
+		 */
+		void encode_bits(uint8_t value, uint8_t bits, char *binary);
+
+		/** Parse a string of '0' and '1', most significant bit first, in a single pass
+		 * 
+		 * @param *binary Pointer to the binary string
+		 * @param bits Number of characters to parse, no greater than 8
+		 * @param &value Address of uint8_t in which to store the parsed value
+		 * @return Indicates success or failure reason
+		 */
+		int decode_bits(const char *binary, uint8_t bits, uint8_t &value);
+
+		/** Handler for the +NSONMI URC, forwards the notification
+		 *  to the application callback if one has been attached
+		 *
+		 * @param socket Socket number on which data has arrived
+		 * @param length Number of bytes available to read
+		 * @return None
+		 */
+		void nsonmi_handler(int socket, int length);
+
+		/** Read datagrams waiting on listening sockets into free receive
+		 *  buffers, then queue each one or hand it to the downlink callback
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int collect_downlinks();
+
+		/** Forget every socket the modem closed when it restarted: listening
+		 *  and CoAP sockets, Observe registrations and open NON streams.
+		 *  Downlink messages already in the pool are kept. An RRC session in
+		 *  progress ended with the restart and is not charged to either mode
+		 *
+		 * @return None
+		 */
+		void drop_socket_state();
+
+		/** Encode a CoAP request header with the given token and options
+		 *
+		 * @param *buffer Pointer to a byte array in which to build the message
+		 * @param buffer_len Size of buffer in bytes
+		 * @param type COAP_TYPE_CON or COAP_TYPE_NON
+		 * @param code Request method code, i.e. COAP_CODE_GET
+		 * @param message_id CoAP message ID
+		 * @param *token Pointer to NBIOT_COAP_TOKEN_LENGTH token bytes
+		 * @param *etag Pointer to an ETag to send, nullptr for none
+		 * @param etag_length Number of bytes in etag
+		 * @param observe Observe option value, negative to omit the option
+		 * @param *uri Pointer to a null-terminated path, split into Uri-Path options
+		 * @param payload True to end the header with the payload marker, the
+		 *                payload itself is sent as a separate segment
+		 * @param &length Address of size_t in which to store the header length
+		 * @return Indicates success or failure reason
+		 */
+		int encode_coap_request(uint8_t *buffer, size_t buffer_len, uint8_t type, uint8_t code, uint16_t message_id, 
+								const uint8_t *token, const uint8_t *etag, uint8_t etag_length, int32_t observe, 
+								const char *uri, bool payload, size_t &length);
+
+		/** Append a single CoAP option to a message being encoded
+		 *
+		 * @param *buffer Pointer to the message
+		 * @param buffer_len Size of buffer in bytes
+		 * @param &offset Address of the write position, advanced past the option
+		 * @param &last_number Address of the previous option number, updated
+		 * @param number Option number, no less than last_number
+		 * @param *value Pointer to the option value
+		 * @param value_length Number of bytes in value
+		 * @return Indicates success or failure reason
+		 */
+		int encode_coap_option(uint8_t *buffer, size_t buffer_len, size_t &offset, uint16_t &last_number,
+							   uint16_t number, const uint8_t *value, size_t value_length);
+
+		/** Parse the fields of a received CoAP message that this interface uses
+		 *
+		 * @param *data Pointer to the received datagram
+		 * @param length Number of bytes in data
+		 * @param &type Address of uint8_t in which to store the message type
+		 * @param &message_id Address of uint16_t in which to store the message ID
+		 * @param &token Address of pointer in which to store the token position
+		 * @param &token_length Address of uint8_t in which to store the token length
+		 * @param &response Address of TP_CoAP_Response in which to store the code,
+		 *                  ETag, Observe option and payload
+		 * @return Indicates success or failure reason
+		 */
+		int decode_coap(const uint8_t *data, size_t length, uint8_t &type, uint16_t &message_id, 
+						const uint8_t *&token, uint8_t &token_length, TP_CoAP_Response &response);
+
+		/** Send a confirmable request and wait for its response, retransmitting
+		 *  with exponential backoff until it is acknowledged. Responses are
+		 *  matched by dispatch_coap() while process_urc() is polled. That runs
+		 *  application callbacks, which must not start another exchange while
+		 *  this one holds _coap_pending, so nested calls are refused
+		 *
+		 * @param socket Socket number returned by udp_open()
+		 * @param *ipv4 Pointer to the server IPv4 address string
+		 * @param port Server port
+		 * @param *request Pointer to the segments making up the encoded request
+		 * @param count Number of segments
+		 * @param message_id Message ID of the request
+		 * @param *token Pointer to the request token
+		 * @param *payload Pointer to a byte array in which to store the response
+		 *                 payload, nullptr to discard it
+		 * @param buffer_len Size of payload in bytes
+		 * @param &response Address of TP_CoAP_Response in which to store the response
+		 * @return Indicates success or failure reason, COAP_BUSY if an exchange
+		 *         is already in progress
+		 */
+		int coap_exchange(int socket, char *ipv4, uint16_t port, const TP_Buffer_Segment *request, uint8_t count, 
+						  uint16_t message_id, const uint8_t *token, uint8_t *payload, size_t buffer_len,
+						  TP_CoAP_Response &response);
+
+		/** Offer a downlink message to the CoAP client. Responses to a pending
+		 *  exchange and Observe notifications are consumed and acknowledged, 
+		 *  confirmable responses with an unknown token on a socket used by the
+		 *  client are consumed and reset, anything else is left for the application
+		 *
+		 * @param *message Pointer to the received message
+		 * @return True if the message was consumed
+		 */
+		bool dispatch_coap(TP_Downlink_Message *message);
+
+		/** Send an empty ACK or RST for a received confirmable message
+		 *
+		 * @param *message Pointer to the received message, used for the reply address
+		 * @param type 2 for ACK, 3 for RST
+		 * @param message_id Message ID being acknowledged or rejected
+		 * @return Indicates success or failure reason
+		 */
+		int send_coap_empty(TP_Downlink_Message *message, uint8_t type, uint16_t message_id);
+
+		/** Fill a token with the next token value. Values whose first byte
+		 *  falls in the NBIOT_COAP_STREAM_TOKEN range are skipped, as those
+		 *  are reserved for coap_stream_send()
+		 *
+		 * @param *token Pointer to NBIOT_COAP_TOKEN_LENGTH bytes
+		 * @return None
+		 */
+		void next_coap_token(uint8_t *token);
+
+		/** Take the next CoAP message ID
+		 *
+		 * @return Message ID
+		 */
+		uint16_t next_coap_message_id();
+
+		/** Seed the token and message ID counters on first use
+		 *
+		 * @return None
+		 */
+		void seed_coap_counters();
+
+		/** Current time in milliseconds from the attached clock
+		 *
+		 * @return Milliseconds since an arbitrary epoch
+		 */
+		uint64_t now_ms();
+
+		/** Sleep for the given period using the attached sleep function
+		 *
+		 * @param ms Period in milliseconds
+		 * @return None
+		 */
+		void sleep_ms(uint32_t ms);
+
+		/** Run a modem operation under the current retry policy. Failures that
+		 *  is_retryable() classifies as transient are retried after a jittered,
+		 *  exponentially increasing delay. Operations that must not be repeated,
+		 *  such as a POST, are attempted once but still counted
+		 *
+		 * @param call Category under which to record attempts and failures
+		 * @param operation Callable returning a driver status code
+		 * @param idempotent False if repeating the operation could duplicate
+		 *                   its effect at the far end
+		 * @return Status of the last attempt
+		 */
+		template <typename F>
+		int retry(TP_Modem_Call call, F operation, bool idempotent = true);
+
+		/** Decide whether a failed modem transaction is worth repeating. Codes
+		 *  from DRIVER_UNKNOWN upwards are produced by this interface from its
+		 *  own checks and will fail identically every time; anything below is
+		 *  from the driver, i.e. an ERROR or a timed out response
+		 *
+		 * @param status Status returned by the failed transaction
+		 * @return True if the transaction may succeed on another attempt
+		 */
+		bool is_retryable(int status);
+
+		/** Next value from the per-instance xorshift32 generator, seeded on 
+		 *  first use from the hardware RNG, if any, and the clock
+		 *
+		 * @return Pseudo-random value
+		 */
+		uint32_t next_random();
+
+		/** Mix the modem IMEI into the random generator so that its sequence
+		 *  differs between devices. Called once the modem answers AT
+		 *
+		 * @return None
+		 */
+		void seed_random_from_imei();
+
+		/** A status value last seen in a query response or URC
+		 */
+		struct Cached_State
+		{
+			int value;
+			uint64_t updated_ms;
+			bool valid;
+		};
+
+		/** Fetch a cached status value if it is within the configured max age
+		 *
+		 * @param &state Cached value to read
+		 * @param &value Address of integer in which to store the cached value
+		 * @return True if value was populated from the cache
+		 */
+		bool read_cached_state(const Cached_State &state, int &value);
+
+		/** Store a freshly observed status value in the cache
+		 *
+		 * @param &state Cached value to update
+		 * @param value Value observed from a query or URC
+		 * @return None
+		 */
+		void write_cached_state(Cached_State &state, int value);
+
+		/** Handler for the +CSCON URC
+		 *
+		 * @param connected 1 if RRC connected, 0 if released
+		 * @return None
+		 */
+		void cscon_handler(int connected);
+
+		/** Handler for the +CEREG URC
+		 *
+		 * @param registered Network registration status
+		 * @return None
+		 */
+		void cereg_handler(int registered);
+
+		/** Handler for the +NPSMR URC
+		 *
+		 * @param psm 1 if the modem has entered PSM, 0 if it has left
+		 * @return None
+		 */
+		void npsmr_handler(int psm);
+
+		/** Interrupt handler for both edges of VINT
+		 *
+		 * @return None
+		 */
+		void vint_handler();
+
+		/** Handler for the PSM timers carried in an extended +CEREG URC
+		 *
+		 * @param *active_time Granted T3324 as binary string
+		 * @param *periodic_tau Granted T3412 as binary string
+		 * @return None
+		 */
+		void cereg_timers_handler(const char *active_time, const char *periodic_tau);
+
+		/** Decode network-granted timers into _psm_timers, update the uplink
+		 *  scheduler and raise the divergence callback if the grant has changed
+		 *  and differs from the request. Empty strings mean the network hasn't
+		 *  granted PSM, in which case the granted values are cleared and the
+		 *  scheduler falls back to the requested ones
+		 *
+		 * @param *active_time Granted T3324 as binary string
+		 * @param *periodic_tau Granted T3412 as binary string
+		 * @return Indicates success or failure reason
+		 */
+		int store_granted_timers(const char *active_time, const char *periodic_tau);
+
+		/** Read the T3412 and T3324 values requested by the device into
+		 *  _psm_timers
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int read_requested_timers();
+
+		/** The configuration, reboot and registration sequence of start(),
+		 *  marking each phase in _start_profile as it is reached
+		 *
+		 * @param timeout_s Timeout period in seconds
+		 * @return Indicates success or failure reason
+		 */
+		int run_start(uint16_t timeout_s);
+
+		/** Record that start() has reached a phase, unless it already has
+		 *
+		 * @param phase Phase reached
 		 * @return None
 		 */
-		void dec_to_bin_5_bit(uint8_t multiples, char *binary);
+		void mark_start_phase(TP_Start_Phase phase);
+
+		/** Map radio connection, network registration and PSM status to the
+		 *  u-blox defined connection status
+		 *
+		 * @param connected 1 if RRC connected, 0 if released
+		 * @param registered Network registration status
+		 * @param psm 1 if in PSM, 0 if active
+		 * @return Connection status
+		 */
+		TP_Connection_Status classify_connection(int connected, int registered, int psm);
+
+		/** Map an EARFCN to its LTE band
+		 *
+		 * @param earfcn LTE channel number
+		 * @return Band, BAND_UNKNOWN if outside band 8 and band 20
+		 */
+		TP_NBIoT_Band band_from_earfcn(int earfcn);
+
+		/** Expected time of the next periodic TAU, rolled forward by whole
+		 *  T3412 periods from the last RRC release
+		 *
+		 * @param now Current time in milliseconds
+		 * @param &tau_ms Address of uint64_t in which to store the time of the
+		 *                first TAU after now
+		 * @return True if a TAU is expected, false if the release time or T3412
+		 *         is unknown
+		 */
+		bool next_tau(uint64_t now, uint64_t &tau_ms);
+
+		/** Convert T3412 units and multiples to seconds
+		 *
+		 * @param unit Timer unit
+		 * @param multiples Multiples of unit
+		 * @return Timer period in seconds, 0 if deactivated or invalid
+		 */
+		uint32_t t3412_to_seconds(T3412_units unit, uint8_t multiples);
+
+		/** Convert T3324 units and multiples to seconds
+		 *
+		 * @param unit Timer unit
+		 * @param multiples Multiples of unit
+		 * @return Timer period in seconds, 0 if deactivated or invalid
+		 */
+		uint32_t t3324_to_seconds(T3324_units unit, uint8_t multiples);
+
+		/** Deferred uplink awaiting a radio session
+		 */
+		struct Deferred_Uplink
+		{
+			Callback<int()> send;
+			uint64_t deadline_ms;
+		};
+
+		/** Write IP address, port and URI to a CoAP profile and save it
+		 *  to the modem's NVM in a single command line. Nothing is sent if
+		 *  the profile is known to hold the same settings already, and the
+		 *  first write to each profile after boot reads it back to find out
+		 *
+		 * @param profile CoAP profile number to write
+		 * @param *ipv4 Pointer to a byte array storing the IPv4 address
+		 * @param port Destination server port
+		 * @param *uri Pointer to a byte array storing the URI
+		 * @param uri_length Number of characters in URI
+		 * @return Indicates success or failure reason
+		 */
+		int write_coap_profile(uint8_t profile, char *ipv4, uint16_t port, char *uri, uint8_t uri_length);
+
+		/** FNV-1a hash of a CoAP profile's settings, never 0 so that 0 can
+		 *  mark a profile whose contents are unknown
+		 *
+		 * @param *ipv4 Pointer to the null-terminated IPv4 address string
+		 * @param port Destination server port
+		 * @param *uri Pointer to a byte array storing the URI
+		 * @param uri_length Number of characters in URI
+		 * @return Hash of the settings
+		 */
+		uint32_t hash_coap_profile(const char *ipv4, uint16_t port, const char *uri, uint8_t uri_length);
+
+		/** CRC-32 (IEEE 802.3) of a byte array
+		 *
+		 * @param *data Pointer to the bytes
+		 * @param length Number of bytes in data
+		 * @return CRC of the bytes
+		 */
+		uint32_t crc32(const uint8_t *data, size_t length);
+
+		/** Size of the Uri-Path options a request to this URI carries, assuming
+		 *  single-byte option headers for the deltas
+		 *
+		 * @param *uri Pointer to a byte array storing the URI
+		 * @param uri_length Number of characters in URI
+		 * @return Number of bytes
+		 */
+		uint16_t uri_path_option_bytes(const char *uri, uint8_t uri_length);
+
+		/** Ensure that a registered endpoint occupies a CoAP profile, evicting
+		 *  the least recently used profile on a miss unless a free profile is
+		 *  known to hold the endpoint's settings already, then load that profile
+		 *  and select the CoAP AT interface ready for a request
+		 *
+		 * @param endpoint Handle returned by register_coap_endpoint()
+		 * @return Indicates success or failure reason
+		 */
+		int select_coap_endpoint(int endpoint);
+
+		/** Time a burst of +NUESTATS reads, each about NBIOT_NUESTATS_BYTES
+		 *  on the UART, and report the bytes per second moved. The response
+		 *  is large next to the command latency and involves no radio 
+		 *  activity, so the figure follows the baud rate
+		 *
+		 * @param &bytes_per_s Address of uint32_t in which to store the 
+		 *                     throughput, 0 if the burst took under 1 ms
+		 * @return Indicates success or failure reason
+		 */
+		int measure_link_throughput(uint32_t &bytes_per_s);
+
+		/** Registered CoAP endpoint. Strings are owned by the application
+		 */
+		struct CoAP_Endpoint
+		{
+			char *ipv4;
+			uint16_t port;
+			char *uri;
+			uint8_t uri_length;
+			char alias;
+			uint16_t alias_saving;
+			uint32_t alias_saved_total;
+		};
+
+		/** Occupancy of a modem CoAP profile. endpoint is -1 when the profile
+		 *  is free and COAP_SLOT_PINNED when written by configure_coap()
+		 */
+		struct CoAP_Profile_Slot
+		{
+			int endpoint;
+			uint32_t last_used;
+		};
+
+		/** An active Observe registration. Strings are owned by the application
+		 */
+		struct CoAP_Observation
+		{
+			bool active;
+			int socket;
+			char *ipv4;
+			uint16_t port;
+			char *uri;
+			uint8_t token[NBIOT_COAP_TOKEN_LENGTH];
+			Callback<void(const TP_CoAP_Response&)> callback;
+			bool cancelling;
+			bool notified;
+			uint32_t last_observe;
+			uint64_t last_notified_ms;
+		};
+
+		/** An open telemetry stream. Strings are owned by the application
+		 */
+		struct CoAP_Stream
+		{
+			bool active;
+			int socket;
+			char *ipv4;
+			uint16_t port;
+			char *uri;
+			uint32_t sequence;
+			uint32_t heartbeat_s;
+			uint64_t last_confirmed_ms;
+		};
+
+		/** The request currently awaiting a response in coap_exchange()
+		 */
+		struct CoAP_Pending
+		{
+			bool active;
+			bool acknowledged;
+			bool complete;
+			bool reset;
+			int socket;
+			uint16_t message_id;
+			uint8_t token[NBIOT_COAP_TOKEN_LENGTH];
+			uint8_t *payload;
+			size_t buffer_len;
+			TP_CoAP_Response *response;
+		};
+
+		static const int COAP_SLOT_FREE   = -1;
+		static const int COAP_SLOT_PINNED = -2;
+
+		static const uint8_t  COAP_TYPE_CON        = 0;
+		static const uint8_t  COAP_TYPE_NON        = 1;
+		static const uint8_t  COAP_TYPE_ACK        = 2;
+		static const uint8_t  COAP_TYPE_RST        = 3;
+		static const uint8_t  COAP_CODE_GET        = 1;
+		static const uint8_t  COAP_CODE_POST       = 2;
+		static const uint16_t COAP_OPTION_ETAG     = 4;
+		static const uint16_t COAP_OPTION_OBSERVE  = 6;
+		static const uint16_t COAP_OPTION_URI_PATH = 11;
 
 		#if _COMMS_NBIOT_DRIVER == COMMS_DRIVER_SARAN2
 			SaraN2 _modem;
 			int _driver = TP_NBIoT_Interface::SARAN2;
+
+			/** Scratch space for +NUESTATS, kept out of the stack of every 
+			 *  caller that needs a single field from it
+			 */
+			SaraN2::Nuestats_t _nuestats;
+
+			/** Scratch space for the URI read back by write_coap_profile(),
+			 *  which would otherwise sit on the stack of every CoAP request
+			 */
+			char _stored_uri[NBIOT_COAP_URI_MAX + 1];
+
+			InterruptIn _vint;
+			DigitalInOut _rst;
 		#else
 			int _driver = TP_NBIoT_Interface::UNDEFINED;
 		#endif /* #if _COMMS_NBIOT_DRIVER == COMMS_DRIVER_SARAN2 */
+
+		Callback<void(int, int)> _udp_callback;
+
+		Callback<int()> _power_cycle;
+		TP_Recovery_Stats _recovery_stats = {};
+
+		uint64_t _start_ms = 0;
+		TP_Start_Profile _start_profile = {};
+		TP_Start_Histogram _start_histogram = {};
+
+		volatile bool _power_monitor = false;
+		volatile int _vint_level = 1;
+
+		TP_Downlink_Message _downlink_pool[NBIOT_DOWNLINK_BUFFERS];
+		bool _downlink_in_use[NBIOT_DOWNLINK_BUFFERS] = {};
+		uint8_t _downlink_queue[NBIOT_DOWNLINK_BUFFERS];
+		uint8_t _downlink_queue_head = 0;
+		uint8_t _downlink_queue_count = 0;
+		uint8_t _downlink_sockets = 0;
+		bool _downlink_pending[NBIOT_UDP_MAX_SOCKETS] = {};
+		bool _downlink_blocked[NBIOT_UDP_MAX_SOCKETS] = {};
+		Callback<void(TP_Downlink_Message*)> _downlink_callback;
+		TP_Downlink_Stats _downlink_stats = {};
+
+		CoAP_Observation _coap_observations[NBIOT_COAP_OBSERVATIONS] = {};
+		CoAP_Pending _coap_pending = {};
+		uint16_t _coap_message_id = 0;
+		uint32_t _coap_token = 0;
+		uint8_t _coap_sockets = 0;
+
+		CoAP_Stream _coap_streams[NBIOT_COAP_STREAMS] = {};
+		TP_Uplink_Mode_Stats _uplink_mode_stats[2] = {};
+
+		Callback<uint64_t()> _clock;
+		Callback<void(uint32_t)> _sleep;
+
+		TP_Retry_Policy _retry_policy = { 3, 100, 2000 };
+		uint32_t _random_state = 0;
+		bool _random_imei_seeded = false;
+		TP_Retry_Stats _retry_stats[(int)TP_Modem_Call::COUNT] = {};
+
+		uint32_t _status_cache_max_age_ms = 0;
+		Cached_State _connected_state = {};
+		Cached_State _registered_state = {};
+		Cached_State _psm_state = {};
+		Cached_State _radio_state = {};
+
+		uint32_t _t3412_s = 0;
+		uint32_t _t3324_s = 0;
+		uint64_t _rrc_release_ms = 0;
+		bool _rrc_release_valid = false;
+		uint64_t _rrc_connect_ms = 0;
+		uint8_t _rrc_session_modes = 0;
+		bool _rrc_connected = false;
+
+		Deferred_Uplink _deferred_uplinks[NBIOT_DEFERRED_UPLINKS];
+		uint8_t _deferred_count = 0;
+		TP_Uplink_Stats _uplink_stats = {};
+
+		bool _flow_control = false;
+		TP_Block_Stats _block_stats = {};
+
+		TP_PSM_Timers _psm_timers = {};
+		bool _psm_timers_requested_valid = false;
+		bool _psm_timers_granted_valid = false;
+		Callback<void(const TP_PSM_Timers&)> _psm_divergence_callback;
+
+		CoAP_Endpoint _coap_endpoints[NBIOT_COAP_MAX_ENDPOINTS] = {};
+		CoAP_Profile_Slot _coap_slots[NBIOT_COAP_PROFILES];
+		uint32_t _coap_lru_clock = 0;
+		uint32_t _coap_profile_hash[NBIOT_COAP_PROFILES] = {};
+
+		int _baud = 57600;
 };
\ No newline at end of file